@@ -0,0 +1,40 @@
+#include "annual_statements.h"
+
+#include <cstdlib>
+
+int main(int argc, char** argv) {
+    int year = Date().year - 1;
+    string accountFolder = ".";
+    string outputFolder = ".";
+    unsigned threads = 0;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--year" && i + 1 < argc) {
+            year = atoi(argv[++i]);
+        } else if (arg == "--accounts" && i + 1 < argc) {
+            accountFolder = argv[++i];
+        } else if (arg == "--out" && i + 1 < argc) {
+            outputFolder = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = max(atoi(argv[++i]), 1);
+        } else {
+            cerr << "usage: " << argv[0] << " [--year Y] [--accounts <folder>] [--out <folder>] [--threads N]" << endl;
+            return 1;
+        }
+    }
+
+    error_code error;
+    filesystem::create_directories(outputFolder, error);
+    AnnualStatementGenerator generator(year, outputFolder, threads);
+    auto start = steady_clock::now();
+    AnnualStatementRun run = generator.generateAll(accountFolder);
+    double seconds = duration<double>(steady_clock::now() - start).count();
+
+    for (const auto& account : run.failed) {
+        cerr << "Could not produce a statement for " << account << endl;
+    }
+    cerr << "Wrote " << run.written << " statements for " << year << " to " << outputFolder << " in "
+         << fixed << setprecision(2) << seconds << "s" << endl;
+    return run.failed.empty() ? 0 : 1;
+}
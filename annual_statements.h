@@ -0,0 +1,419 @@
+#ifndef ANNUAL_STATEMENTS_H
+#define ANNUAL_STATEMENTS_H
+
+// Year-end statements for every account: income, spending by category,
+// deductible spending and the interest investments earned. Accounts are
+// loaded and their months aggregated as separate tasks on a work-stealing
+// pool; each month produces a partial aggregate, and the last month of an
+// account to finish merges them and writes the statement file.
+
+#include "finance_manager.h"
+
+#include <atomic>
+#include <memory>
+
+// A fixed set of worker threads, each with its own task deque. A worker runs
+// its newest task first, so the months an account spawns run while its
+// ledger is still in cache; an idle worker steals the oldest task of another.
+struct WorkStealingPool {
+    struct Worker {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    vector<thread> threads;
+    atomic<size_t> queued;       // tasks waiting in the deques
+    atomic<size_t> unfinished;   // tasks waiting or running
+    atomic<size_t> nextWorker;   // spreads tasks submitted from outside the pool
+    bool stopping;
+    mutex idleLock;
+    condition_variable wake;
+    condition_variable finished;
+
+    explicit WorkStealingPool(unsigned count = 0) : queued(0), unfinished(0), nextWorker(0), stopping(false) {
+        if (count == 0) count = max(thread::hardware_concurrency(), 1u);
+        for (unsigned i = 0; i < count; i++) workers.emplace_back(new Worker());
+        for (unsigned i = 0; i < count; i++) threads.push_back(thread([this, i]() { run(i); }));
+    }
+
+    // Queued tasks still run before the workers exit
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> guard(idleLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    // The worker running on this thread, or -1 outside the pool
+    int currentWorker() const {
+        return owner() == this ? index() : -1;
+    }
+
+    static const WorkStealingPool*& owner() {
+        static thread_local const WorkStealingPool* pool = nullptr;
+        return pool;
+    }
+
+    static int& index() {
+        static thread_local int worker = -1;
+        return worker;
+    }
+
+    // Tasks submitted by a task go to its own worker's deque
+    void submit(function<void()> task) {
+        int self = currentWorker();
+        Worker& worker = *workers[self >= 0 ? self : nextWorker++ % workers.size()];
+        unfinished++;
+        queued++;
+        {
+            lock_guard<mutex> guard(worker.lock);
+            worker.tasks.push_back(move(task));
+        }
+        {
+            lock_guard<mutex> guard(idleLock);
+        }
+        wake.notify_one();
+    }
+
+    // Blocks until every submitted task has finished; call from outside the pool
+    void wait() {
+        unique_lock<mutex> guard(idleLock);
+        finished.wait(guard, [this]() { return unfinished == 0; });
+    }
+
+    bool take(size_t self, function<void()>& task) {
+        {
+            Worker& own = *workers[self];
+            lock_guard<mutex> guard(own.lock);
+            if (!own.tasks.empty()) {
+                task = move(own.tasks.back());
+                own.tasks.pop_back();
+                queued--;
+                return true;
+            }
+        }
+        for (size_t k = 1; k < workers.size(); k++) {
+            Worker& victim = *workers[(self + k) % workers.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = move(victim.tasks.front());
+                victim.tasks.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t self) {
+        owner() = this;
+        index() = self;
+        function<void()> task;
+        while (true) {
+            if (take(self, task)) {
+                task();
+                task = nullptr;
+                if (--unfinished == 0) {
+                    lock_guard<mutex> guard(idleLock);
+                    finished.notify_all();
+                }
+                continue;
+            }
+            unique_lock<mutex> guard(idleLock);
+            wake.wait(guard, [this]() { return stopping || queued > 0; });
+            if (stopping && queued == 0) return;
+        }
+    }
+};
+
+// Income and spending in the base currency for one month of one account, or
+// a whole year once merged. Totals are indexed by category id.
+struct StatementShard {
+    double income;
+    double expense;
+    vector<double> incomeByCategory;
+    vector<double> expenseByCategory;
+
+    StatementShard() : income(0), expense(0) {}
+
+    void add(bool isIncome, int category, double amount) {
+        vector<double>& totals = isIncome ? incomeByCategory : expenseByCategory;
+        if (category < 0) return;
+        if (category >= (int)totals.size()) totals.resize(category + 1, 0.0);
+        totals[category] += amount;
+        (isIncome ? income : expense) += amount;
+    }
+
+    void merge(const StatementShard& other) {
+        income += other.income;
+        expense += other.expense;
+        if (incomeByCategory.size() < other.incomeByCategory.size()) incomeByCategory.resize(other.incomeByCategory.size(), 0.0);
+        if (expenseByCategory.size() < other.expenseByCategory.size()) expenseByCategory.resize(other.expenseByCategory.size(), 0.0);
+        for (size_t id = 0; id < other.incomeByCategory.size(); id++) incomeByCategory[id] += other.incomeByCategory[id];
+        for (size_t id = 0; id < other.expenseByCategory.size(); id++) expenseByCategory[id] += other.expenseByCategory[id];
+    }
+};
+
+struct AnnualStatement {
+    string account;
+    int year;
+    StatementShard months[12];
+    StatementShard total;
+    double fdInterest;
+    double sipInterest;
+
+    AnnualStatement() : year(0), fdInterest(0), sipInterest(0) {}
+
+    // One month's rows, archived and live, converted at each row's date.
+    // Only reads the ledger, so the months of an account run in parallel.
+    static void aggregateMonth(const FinanceManager& manager, int year, int month, StatementShard& shard) {
+        int firstKey = Date(1, month, year).key();
+        int lastKey = Date(Date::daysInMonth(month, year), month, year).key();
+        int firstDay = Date(1, month, year).dayNumber();
+        int lastDay = firstDay + Date::daysInMonth(month, year) - 1;
+
+        vector<ColdRow> rows;
+        for (const auto& block : manager.coldStore.blocks) {
+            if (block.zone.maxKey < firstKey || block.zone.minKey > lastKey) continue;
+            manager.coldStore.decodeInto(block, rows);
+            for (const auto& row : rows) {
+                if (row.dayNumber < firstDay || row.dayNumber > lastDay) continue;
+                shard.add(row.income, row.category, row.amount * manager.fx.rate(row.currency, row.dayNumber));
+            }
+        }
+        for (auto t : manager.transactions) {
+            if (t->date.month != month || t->date.year != year) continue;
+            if (t->type != "Income" && t->type != "Expenditure") continue;
+            shard.add(t->type == "Income", t->category, t->amount * manager.rateFor(*t));
+        }
+    }
+
+    void mergeMonths() {
+        total = StatementShard();
+        for (const auto& month : months) total.merge(month);
+    }
+
+    // Investments are converted at the rate on their start date, as elsewhere
+    void addInterest(const FinanceManager& manager) {
+        int firstDay = Date(1, 1, year).dayNumber();
+        int endDay = Date(1, 1, year + 1).dayNumber();
+        fdInterest = sipInterest = 0.0;
+        for (const auto& i : manager.investments) {
+            double interest = i.interestBetween(firstDay, endDay) * manager.fx.rate(i.currency, i.startDate.dayNumber());
+            (holds_alternative<FD>(i.product) ? fdInterest : sipInterest) += interest;
+        }
+    }
+
+    // Category names come from a snapshot of the registry, since other
+    // accounts may be registering categories while this one renders
+    void render(OutputBuffer& out, const vector<CategoryType>& deductible) const {
+        static const char* monthNames[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                           "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+        out.append("Annual Statement " + to_string(year) + " - " + account);
+        out.newline();
+        string base = currencies().code(0);
+        if (!base.empty()) {
+            out.append("Amounts in " + base);
+            out.newline();
+        }
+
+        out.newline();
+        out.appendField("Month", 8);
+        out.appendField("Income", 15);
+        out.appendField("Expenses", 15);
+        out.appendField("Net", 15);
+        out.newline();
+        out.append(string(53, '-'));
+        out.newline();
+        for (int m = 0; m < 12; m++) {
+            out.appendField(monthNames[m], 8);
+            out.appendFixed(months[m].income, 2, 15);
+            out.appendFixed(months[m].expense, 2, 15);
+            out.appendFixed(months[m].income - months[m].expense, 2, 15);
+            out.newline();
+        }
+        out.append(string(53, '-'));
+        out.newline();
+        out.appendField("Total", 8);
+        out.appendFixed(total.income, 2, 15);
+        out.appendFixed(total.expense, 2, 15);
+        out.appendFixed(total.income - total.expense, 2, 15);
+        out.newline();
+
+        CategoryTree tree = categories().snapshot();
+        vector<double> income = total.incomeByCategory;
+        vector<double> expense = total.expenseByCategory;
+        tree.rollUp(income);
+        tree.rollUp(expense);
+        vector<int> order = tree.preorder();
+        auto line = [&](const string& label, double amount) {
+            out.appendField(label, 20);
+            out.append(": ");
+            out.appendFixed(amount, 2);
+            out.newline();
+        };
+        auto breakdown = [&](const char* title, const vector<double>& totals) {
+            out.newline();
+            out.append(title);
+            out.newline();
+            for (int id : order) {
+                if (totals[id] == 0) continue;
+                int depth = tree.depth(id);
+                line(depth == 0 ? tree.labels[id] : string(depth * 2, '-') + " " + tree.labels[id], totals[id]);
+            }
+        };
+        breakdown("Income by Category:", income);
+        breakdown("Expenses by Category:", expense);
+
+        out.newline();
+        out.append("Deductible Expenses:");
+        out.newline();
+        double deductibleTotal = 0.0;
+        for (CategoryType id : deductible) {
+            if (!tree.valid(id)) continue;
+            line(tree.names[id], expense[id]);
+            deductibleTotal += expense[id];
+        }
+        line("Total", deductibleTotal);
+
+        out.newline();
+        out.append("Investment Interest Accrued:");
+        out.newline();
+        line(FD::NAME, fdInterest);
+        line(SIP::NAME, sipInterest);
+        line("Total", fdInterest + sipInterest);
+    }
+};
+
+struct AnnualStatementRun {
+    size_t written;
+    vector<string> failed;   // accounts whose ledger could not be read or statement written
+};
+
+struct AnnualStatementGenerator {
+    // One account in flight; the last of its month tasks finishes it
+    struct Job {
+        unique_ptr<FinanceManager> owned;
+        FinanceManager* manager;
+        AnnualStatement statement;
+        atomic<int> remaining;
+        bool writeFile;
+
+        Job() : manager(nullptr), remaining(12), writeFile(true) {}
+    };
+
+    static constexpr const char* DATA_SUFFIX = "_finance_data.txt";
+
+    int year;
+    string outputFolder;
+    vector<CategoryType> deductible;
+    WorkStealingPool pool;
+    mutex resultLock;
+    AnnualStatementRun result;
+
+    AnnualStatementGenerator(int y, const string& folder = ".", unsigned threads = 0)
+        : year(y), outputFolder(folder), deductible({HEALTHCARE, EDUCATION}), pool(threads) {
+        result.written = 0;
+    }
+
+    // Accounts are named by their <username>_finance_data.txt files
+    static vector<string> findAccounts(const string& folder) {
+        vector<string> accounts;
+        error_code error;
+        for (const auto& entry : filesystem::directory_iterator(folder, error)) {
+            string name = entry.path().filename().string();
+            size_t suffix = strlen(DATA_SUFFIX);
+            if (name.size() > suffix && name.compare(name.size() - suffix, suffix, DATA_SUFFIX) == 0) {
+                accounts.push_back(name.substr(0, name.size() - suffix));
+            }
+        }
+        sort(accounts.begin(), accounts.end());
+        return accounts;
+    }
+
+    string statementFile(const string& account) const {
+        return (filesystem::path(outputFolder) / (account + "_statement_" + to_string(year) + ".txt")).string();
+    }
+
+    void fail(const string& account) {
+        lock_guard<mutex> guard(resultLock);
+        result.failed.push_back(account);
+    }
+
+    void finish(Job& job) {
+        job.statement.mergeMonths();
+        job.statement.addInterest(*job.manager);
+        if (!job.writeFile) return;
+
+        OutputBuffer out;
+        job.statement.render(out, deductible);
+        ofstream file(statementFile(job.statement.account));
+        if (file.is_open()) out.flush(file);
+        if (!file.is_open() || !file.good()) {
+            fail(job.statement.account);
+            return;
+        }
+        lock_guard<mutex> guard(resultLock);
+        result.written++;
+    }
+
+    void submitMonths(const shared_ptr<Job>& job) {
+        for (int month = 1; month <= 12; month++) {
+            pool.submit([this, job, month]() {
+                AnnualStatement::aggregateMonth(*job->manager, year, month, job->statement.months[month - 1]);
+                if (--job->remaining == 0) {
+                    finish(*job);
+                }
+            });
+        }
+    }
+
+    // Each account is loaded the way its owner's session would load it
+    void submitAccount(const string& folder, const string& account) {
+        pool.submit([this, folder, account]() {
+            shared_ptr<Job> job(new Job());
+            job->owned.reset(new FinanceManager());
+            job->manager = job->owned.get();
+            job->statement.account = account;
+            job->statement.year = year;
+            string prefix = (filesystem::path(folder) / account).string();
+            job->manager->categorizer.loadRules(prefix + "_rules.txt");
+            job->manager->fx.loadFromFile(prefix + "_fx.txt");
+            double balance = 0;
+            if (!job->manager->loadFromFile(prefix + DATA_SUFFIX, balance)) {
+                fail(account);
+                return;
+            }
+            submitMonths(job);
+        });
+    }
+
+    // One statement file per account found in the folder
+    AnnualStatementRun generateAll(const string& accountFolder) {
+        FINANCE_TIME_SCOPE("annual_statements");
+        for (const auto& account : findAccounts(accountFolder)) {
+            submitAccount(accountFolder, account);
+        }
+        pool.wait();
+        FINANCE_COUNT("statements_written", result.written);
+        sort(result.failed.begin(), result.failed.end());
+        return result;
+    }
+
+    // A ledger that is already loaded, e.g. the signed-in user's
+    AnnualStatement generate(FinanceManager& manager, const string& account, bool writeFile = true) {
+        shared_ptr<Job> job(new Job());
+        job->manager = &manager;
+        job->writeFile = writeFile;
+        job->statement.account = account;
+        job->statement.year = year;
+        submitMonths(job);
+        pool.wait();
+        return job->statement;
+    }
+};
+
+#endif
@@ -0,0 +1,327 @@
+#include "ledger_generator.h"
+#include "columnar_export.h"
+#include "annual_statements.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <random>
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+// Every allocation made by the process goes through these, so each benchmark
+// can report how many bytes and blocks it allocated per operation.
+static atomic<unsigned long long> allocatedBytes(0);
+static atomic<unsigned long long> allocationCount(0);
+
+void* operator new(size_t size) {
+    allocatedBytes.fetch_add(size, memory_order_relaxed);
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+struct BenchResult {
+    string name;
+    size_t rows;
+    size_t ops;
+    size_t itemsPerOp;
+    double nanoseconds;
+    unsigned long long bytes;
+    unsigned long long allocations;
+};
+
+// Discards everything written to it; used to silence report output
+struct NullBuffer : streambuf {
+    int overflow(int c) override {
+        return c;
+    }
+    streamsize xsputn(const char*, streamsize n) override {
+        return n;
+    }
+};
+
+// itemsPerOp is how many rows one operation touches, for the throughput figure
+template <class Body>
+BenchResult measure(const string& name, size_t rows, size_t ops, size_t itemsPerOp, Body body) {
+    unsigned long long bytesBefore = allocatedBytes.load();
+    unsigned long long countBefore = allocationCount.load();
+    auto start = steady_clock::now();
+    body();
+    auto elapsed = duration<double, nano>(steady_clock::now() - start).count();
+
+    BenchResult result;
+    result.name = name;
+    result.rows = rows;
+    result.ops = ops;
+    result.itemsPerOp = itemsPerOp;
+    result.nanoseconds = elapsed;
+    result.bytes = allocatedBytes.load() - bytesBefore;
+    result.allocations = allocationCount.load() - countBefore;
+    return result;
+}
+
+// Repeats a full-ledger operation enough times to get a stable reading
+size_t repetitionsFor(size_t rows) {
+    return max<size_t>(1, min<size_t>(1000, 20000000 / max<size_t>(rows, 1)));
+}
+
+void runSize(size_t rows, unsigned long long seed, const string& scratchFile, vector<BenchResult>& results) {
+    LedgerGeneratorOptions options;
+    options.transactions = rows;
+    options.investments = rows / 10 + 1;
+    options.seed = seed;
+    LedgerGenerator generator(options);
+
+    vector<GeneratedTransaction> data, chunk;
+    for (size_t i = 0; i < generator.chunkCount(); i++) {
+        generator.generateChunk(i, chunk);
+        data.insert(data.end(), chunk.begin(), chunk.end());
+    }
+    FinanceManager manager;
+
+    results.push_back(measure("add_transaction", rows, rows, 1, [&]() {
+        for (const auto& row : data) {
+            manager.addTransaction(row.create());
+        }
+    }));
+
+    // The detector alone, as a bulk import feeds it
+    AnomalyDetector detector;
+    results.push_back(measure("anomaly_observe", rows, rows, 1, [&]() {
+        for (auto t : manager.transactions) {
+            detector.observe(*t, t->descriptionId, t->amount);
+        }
+    }));
+
+    // Investments are added after timing so add_transaction stays pure
+    for (size_t i = 0; i < generator.investmentCount(); i++) {
+        manager.addInvestment(generator.generateInvestment(i));
+    }
+
+    size_t reps = repetitionsFor(rows);
+    size_t found = 0;
+    const GeneratedTransaction& probe = data[data.size() / 2];
+
+    results.push_back(measure("search_by_description", rows, reps, rows, [&]() {
+        for (size_t i = 0; i < reps; i++) found += manager.searchTransactionsByDescription("Cafe_1").size();
+    }));
+    results.push_back(measure("search_fuzzy", rows, reps, rows, [&]() {
+        for (size_t i = 0; i < reps; i++) found += manager.searchTransactionsFuzzy("Grocry_Stor").size();
+    }));
+    results.push_back(measure("search_by_date", rows, reps, rows, [&]() {
+        for (size_t i = 0; i < reps; i++) found += manager.searchTransactionsByDate(probe.date).size();
+    }));
+    results.push_back(measure("search_by_category", rows, reps, rows, [&]() {
+        for (size_t i = 0; i < reps; i++) found += manager.searchTransactionsByCategory(FOOD).size();
+    }));
+    results.push_back(measure("top_expenses_20", rows, reps, rows, [&]() {
+        for (size_t i = 0; i < reps; i++) found += manager.topExpenses(20).size();
+    }));
+    results.push_back(measure("expense_quantile", rows, reps, rows, [&]() {
+        for (size_t i = 0; i < reps; i++) found += manager.expenseQuantile(0.95) > 0;
+    }));
+    Date yearStart(1, 1, probe.date.year), yearEnd(31, 12, probe.date.year);
+    results.push_back(measure("expense_quantile_estimate", rows, reps, rows, [&]() {
+        for (size_t i = 0; i < reps; i++) found += manager.estimateExpenseQuantile(0.95, yearStart, yearEnd, FOOD) > 0;
+    }));
+    results.push_back(measure("find_duplicates", rows, 1, rows, [&]() {
+        found += manager.findDuplicateRows().size();
+    }));
+    // A statement holding every fourth live row
+    Statement statement;
+    statement.account = "benchmark";
+    for (size_t i = 0; i < manager.transactions.size(); i += 4) {
+        const Transaction* t = manager.transactions[i];
+        statement.lines.push_back({t->date, Reconciler::signedAmount(t), t->description});
+    }
+    results.push_back(measure("reconcile_statement", statement.lines.size(), 1, statement.lines.size(), [&]() {
+        found += manager.reconcile({statement}).statements[0].matched.size();
+    }));
+    results.push_back(measure("search_investments_by_amount", manager.investments.size(), reps, manager.investments.size(), [&]() {
+        for (size_t i = 0; i < reps; i++) found += manager.searchInvestmentsByAmountRange(1000, 5000).size();
+    }));
+    results.push_back(measure("search_investments_by_type", manager.investments.size(), reps, manager.investments.size(), [&]() {
+        for (size_t i = 0; i < reps; i++) found += manager.searchInvestmentsByType("SIP").size();
+    }));
+    Date maturityFrom(1, probe.date.month, probe.date.year), maturityTo(28, probe.date.month, probe.date.year + 1);
+    results.push_back(measure("search_investments_by_maturity", manager.investments.size(), reps, manager.investments.size(), [&]() {
+        for (size_t i = 0; i < reps; i++) found += manager.searchInvestmentsMaturingBetween(maturityFrom, maturityTo).size();
+    }));
+    results.push_back(measure("search_investments_active", manager.investments.size(), reps, manager.investments.size(), [&]() {
+        for (size_t i = 0; i < reps; i++) found += manager.searchInvestmentsActiveOn(probe.date).size();
+    }));
+
+    // Every sort starts from the same shuffled order
+    vector<Transaction*> shuffledTransactions = manager.transactions;
+    shuffle(shuffledTransactions.begin(), shuffledTransactions.end(), mt19937_64(seed));
+    vector<Investment> shuffledInvestments = manager.investments;
+    shuffle(shuffledInvestments.begin(), shuffledInvestments.end(), mt19937_64(seed));
+
+    struct SortCase {
+        const char* name;
+        void (*run)(FinanceManager&);
+    };
+    SortCase transactionSorts[] = {
+        {"sort_transactions_by_amount_asc", [](FinanceManager& m) { m.sortTransactionsByAmount(true); }},
+        {"sort_transactions_by_amount_desc", [](FinanceManager& m) { m.sortTransactionsByAmount(false); }},
+        {"sort_transactions_by_date_asc", [](FinanceManager& m) { m.sortTransactionsByDate(true); }},
+        {"sort_transactions_by_date_desc", [](FinanceManager& m) { m.sortTransactionsByDate(false); }},
+        {"sort_transactions_by_category", [](FinanceManager& m) { m.sortTransactionsByCategory(); }},
+    };
+    for (const auto& sortCase : transactionSorts) {
+        manager.transactions = shuffledTransactions;
+        results.push_back(measure(sortCase.name, rows, 1, rows, [&]() { sortCase.run(manager); }));
+    }
+
+    SortCase investmentSorts[] = {
+        {"sort_investments_by_amount_asc", [](FinanceManager& m) { m.sortInvestmentsByAmount(true); }},
+        {"sort_investments_by_amount_desc", [](FinanceManager& m) { m.sortInvestmentsByAmount(false); }},
+        {"sort_investments_by_duration_asc", [](FinanceManager& m) { m.sortInvestmentsByDuration(true); }},
+        {"sort_investments_by_duration_desc", [](FinanceManager& m) { m.sortInvestmentsByDuration(false); }},
+    };
+    for (const auto& sortCase : investmentSorts) {
+        manager.investments = shuffledInvestments;
+        results.push_back(measure(sortCase.name, manager.investments.size(), 1, manager.investments.size(), [&]() { sortCase.run(manager); }));
+    }
+
+    NullBuffer nullBuffer;
+    streambuf* console = cout.rdbuf(&nullBuffer);
+    results.push_back(measure("generate_monthly_report", rows, reps, rows, [&]() {
+        for (size_t i = 0; i < reps; i++) manager.generateMonthlyReport(probe.date.month, probe.date.year);
+    }));
+    cout.rdbuf(console);
+
+    FinanceManager::removeSavedFiles(scratchFile);
+    results.push_back(measure("save_to_file", rows, 1, rows, [&]() { manager.saveToFile(scratchFile); }));
+
+    // Touching one row should only rewrite the segment holding it
+    size_t edited = manager.transactions.size() / 2;
+    const Transaction* old = manager.transactions[edited];
+    manager.updateTransaction(edited, new Expenditure(old->amount + 1, old->description, old->date, old->category));
+    results.push_back(measure("save_to_file_one_change", rows, 1, 1, [&]() { manager.saveToFile(scratchFile); }));
+
+    FinanceManager loaded;
+    double balance = 0;
+    results.push_back(measure("load_from_file", rows, 1, rows, [&]() { loaded.loadFromFile(scratchFile, balance); }));
+    FinanceManager::removeSavedFiles(scratchFile);
+    results.push_back(measure("freeze_closed_months", rows, 1, rows, [&]() { loaded.freezeClosedMonths(); }));
+
+    // Closed months are frozen now, so these searches mostly hit cold blocks
+    results.push_back(measure("search_by_category_cold", rows, reps, rows, [&]() {
+        for (size_t i = 0; i < reps; i++) found += loaded.searchTransactionsByCategory(FOOD).size();
+    }));
+    results.push_back(measure("search_by_date_cold", rows, reps, rows, [&]() {
+        for (size_t i = 0; i < reps; i++) found += loaded.searchTransactionsByDate(probe.date).size();
+    }));
+
+    // Twelve month tasks over mostly cold rows, without writing the file
+    AnnualStatementGenerator statements(probe.date.year);
+    results.push_back(measure("annual_statement", rows, 1, rows, [&]() {
+        found += statements.generate(loaded, "bench", false).total.expense > 0;
+    }));
+
+    // Mostly cold rows, exported one row group at a time
+    ColumnarExporter exporter(loaded);
+    results.push_back(measure("export_arrow", rows, 1, rows, [&]() { exporter.exportLedger(scratchFile + ".export", false); }));
+    results.push_back(measure("export_parquet", rows, 1, rows, [&]() { exporter.exportLedger(scratchFile + ".export", true); }));
+    for (const char* file : {"_transactions.arrow", "_investments.arrow", "_transactions.parquet", "_investments.parquet"}) {
+        remove((scratchFile + ".export" + file).c_str());
+    }
+
+    // The first exchange between two replicas carries every record
+    FinanceManager replica;
+    loaded.enableSync();
+    replica.enableSync();
+    vector<SyncOp> writes;
+    size_t merged = 0;
+    results.push_back(measure("sync_delta_full", rows, 1, rows, [&]() { loaded.syncDelta(replica.sync.seen, writes); }));
+    results.push_back(measure("sync_merge_full", rows, 1, rows, [&]() { replica.mergeSync(writes, loaded.sync.seen, merged); }));
+    found += merged;
+
+    if (loaded.transactionCount() != manager.transactionCount()) {
+        cerr << "warning: reloaded " << loaded.transactionCount() << " of " << manager.transactionCount() << " rows" << endl;
+    }
+    if (found == 0) {
+        cerr << "warning: searches matched nothing" << endl;
+    }
+}
+
+void writeJson(ostream& out, const vector<BenchResult>& results, unsigned long long seed) {
+    out << "{\n  \"seed\": " << seed << ",\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        double ops = max<size_t>(r.ops, 1);
+        double seconds = r.nanoseconds / 1e9;
+        out << "    {\"name\": \"" << r.name << "\", \"rows\": " << r.rows << ", \"ops\": " << r.ops
+            << fixed << setprecision(2)
+            << ", \"ns_per_op\": " << r.nanoseconds / ops
+            << ", \"bytes_allocated_per_op\": " << r.bytes / ops
+            << ", \"allocations_per_op\": " << r.allocations / ops
+            << ", \"ops_per_second\": " << (seconds > 0 ? ops / seconds : 0.0)
+            << ", \"items_per_second\": " << (seconds > 0 ? ops * r.itemsPerOp / seconds : 0.0) << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+        out.unsetf(ios::floatfield);
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+    size_t minRows = 1000;
+    size_t maxRows = 1000000;
+    unsigned long long seed = 42;
+    string outFile;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--min-rows" && i + 1 < argc) {
+            minRows = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--max-rows" && i + 1 < argc) {
+            maxRows = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--out" && i + 1 < argc) {
+            outFile = argv[++i];
+        } else {
+            cerr << "usage: " << argv[0] << " [--min-rows N] [--max-rows N] [--seed S] [--out results.json]" << endl;
+            return 1;
+        }
+    }
+
+    vector<BenchResult> results;
+    for (size_t rows = max<size_t>(minRows, 1); rows <= maxRows; rows *= 10) {
+        cerr << "benchmarking " << rows << " rows..." << endl;
+        runSize(rows, seed, "benchmark_scratch_finance_data.txt", results);
+    }
+
+    if (outFile.empty()) {
+        writeJson(cout, results, seed);
+    } else {
+        ofstream out(outFile);
+        writeJson(out, results, seed);
+    }
+    return 0;
+}
@@ -0,0 +1,840 @@
+#ifndef COLUMNAR_EXPORT_H
+#define COLUMNAR_EXPORT_H
+
+// Columnar export for analysis tools: Arrow IPC files (read by pandas, polars,
+// DuckDB and anything else built on Arrow, also known as Feather v2) and
+// Parquet. Both formats are written here directly, uncompressed, one row group
+// at a time, so memory stays bounded by the group size however large the
+// ledger is. Descriptions, categories, currencies and types are dictionary
+// encoded; dates are stored as days since 1970.
+
+#include "finance_manager.h"
+
+#include <cstdint>
+
+enum ColumnKind { INT32_COLUMN, DATE_COLUMN, DOUBLE_COLUMN, DICTIONARY_COLUMN };
+
+struct ColumnSpec {
+    string name;
+    ColumnKind kind;
+    const vector<string>* dictionary;   // values of a DICTIONARY_COLUMN; rows hold indices into it
+};
+
+// One row group, column by column
+struct ColumnBatch {
+    size_t rows;
+    vector<vector<int32_t>> ints;      // INT32, DATE and DICTIONARY columns
+    vector<vector<double>> doubles;    // DOUBLE columns
+
+    ColumnBatch() : rows(0) {}
+
+    // Keeps the capacity, so filling the next group allocates nothing
+    void reset(size_t columns) {
+        rows = 0;
+        ints.resize(columns);
+        doubles.resize(columns);
+        for (auto& column : ints) column.clear();
+        for (auto& column : doubles) column.clear();
+    }
+};
+
+// Just enough of a FlatBuffers encoder for Arrow metadata. Objects are laid
+// out front to back with every child after the object referring to it, since
+// FlatBuffers offsets must point forward.
+struct FlatObject {
+    enum Kind { TABLE, TABLE_VECTOR, STRUCT_VECTOR, STRING };
+
+    struct Field {
+        int id;
+        int size;          // 1, 2, 4 or 8 for a scalar, 0 for a child object
+        uint64_t value;
+        size_t child;
+    };
+
+    Kind kind;
+    vector<Field> fields;
+    vector<FlatObject> children;   // a table's child objects, or a table vector's items
+    string bytes;                  // a struct vector's packed structs, or a string's text
+    size_t count;
+
+    explicit FlatObject(Kind k = TABLE) : kind(k), count(0) {}
+
+    FlatObject& scalar(int id, int size, uint64_t value) {
+        fields.push_back({id, size, value, 0});
+        return *this;
+    }
+
+    FlatObject& child(int id, const FlatObject& object) {
+        fields.push_back({id, 0, 0, children.size()});
+        children.push_back(object);
+        return *this;
+    }
+
+    static FlatObject text(const string& value) {
+        FlatObject object(STRING);
+        object.bytes = value;
+        return object;
+    }
+
+    static FlatObject tables(const vector<FlatObject>& items) {
+        FlatObject object(TABLE_VECTOR);
+        object.children = items;
+        return object;
+    }
+
+    // Structs of 8-byte aligned fields, already packed
+    static FlatObject structs(const string& packed, size_t count) {
+        FlatObject object(STRUCT_VECTOR);
+        object.bytes = packed;
+        object.count = count;
+        return object;
+    }
+};
+
+struct FlatWriter {
+    string out;
+
+    void pad(size_t alignment) {
+        while (out.size() % alignment) out.push_back(0);
+    }
+
+    template <class T>
+    void put(T value) {
+        out.append((const char*)&value, sizeof(T));
+    }
+
+    // Offsets are relative to where they are stored
+    void patch(size_t at, size_t target) {
+        uint32_t offset = (uint32_t)(target - at);
+        memcpy(&out[at], &offset, 4);
+    }
+
+    size_t write(const FlatObject& object) {
+        if (object.kind == FlatObject::STRING) {
+            pad(4);
+            size_t at = out.size();
+            put<uint32_t>(object.bytes.size());
+            out += object.bytes;
+            out.push_back(0);
+            return at;
+        }
+        if (object.kind == FlatObject::STRUCT_VECTOR) {
+            // The structs after the length must start 8-aligned
+            pad(4);
+            if (out.size() % 8 == 0) put<uint32_t>(0);
+            size_t at = out.size();
+            put<uint32_t>(object.count);
+            out += object.bytes;
+            return at;
+        }
+        if (object.kind == FlatObject::TABLE_VECTOR) {
+            pad(4);
+            size_t at = out.size();
+            put<uint32_t>(object.children.size());
+            size_t slots = out.size();
+            out.append(object.children.size() * 4, 0);
+            for (size_t i = 0; i < object.children.size(); i++) {
+                patch(slots + i * 4, write(object.children[i]));
+            }
+            return at;
+        }
+
+        // Inline fields go largest first after the vtable offset, each aligned to its size
+        vector<size_t> order(object.fields.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = i;
+        auto sizeOf = [&](size_t i) { return object.fields[i].size ? object.fields[i].size : 4; };
+        stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizeOf(a) > sizeOf(b); });
+        int maxId = -1;
+        vector<size_t> position(object.fields.size());
+        size_t inlineSize = 4;
+        for (size_t i : order) {
+            size_t size = sizeOf(i);
+            inlineSize = (inlineSize + size - 1) / size * size;
+            position[i] = inlineSize;
+            inlineSize += size;
+            maxId = max(maxId, object.fields[i].id);
+        }
+
+        pad(2);
+        size_t vtable = out.size();
+        put<uint16_t>(4 + 2 * (maxId + 1));
+        put<uint16_t>(inlineSize);
+        vector<uint16_t> slots(maxId + 1, 0);
+        for (size_t i = 0; i < object.fields.size(); i++) slots[object.fields[i].id] = position[i];
+        for (auto slot : slots) put<uint16_t>(slot);
+
+        pad(8);
+        size_t table = out.size();
+        put<int32_t>(table - vtable);
+        out.append(inlineSize - 4, 0);
+        for (size_t i = 0; i < object.fields.size(); i++) {
+            if (object.fields[i].size) memcpy(&out[table + position[i]], &object.fields[i].value, object.fields[i].size);
+        }
+        for (size_t i = 0; i < object.fields.size(); i++) {
+            if (!object.fields[i].size) patch(table + position[i], write(object.children[object.fields[i].child]));
+        }
+        return table;
+    }
+
+    // A finished buffer: the root offset, then the objects, padded to 8 bytes
+    static string finish(const FlatObject& root) {
+        FlatWriter writer;
+        writer.put<uint32_t>(0);
+        writer.patch(0, writer.write(root));
+        writer.pad(8);
+        return writer.out;
+    }
+};
+
+// Arrow IPC file format: magic, schema message, dictionary batches, record
+// batches, then a footer indexing them. Column data is written straight from
+// the batch vectors.
+struct ArrowFileWriter {
+    // Flatbuffers enum and union values from the Arrow format
+    static const int METADATA_V5 = 4;
+    static const int HEADER_SCHEMA = 1, HEADER_DICTIONARY_BATCH = 2, HEADER_RECORD_BATCH = 3;
+    static const int TYPE_INT = 2, TYPE_FLOATING_POINT = 3, TYPE_UTF8 = 5, TYPE_DATE = 8;
+
+    struct Block {
+        int64_t offset;
+        int32_t metadataLength;
+        int64_t bodyLength;
+    };
+
+    ofstream file;
+    vector<ColumnSpec> columns;
+    vector<Block> dictionaryBlocks;
+    vector<Block> batchBlocks;
+    int64_t position;
+
+    ArrowFileWriter() : position(0) {}
+
+    static FlatObject intType(int bits) {
+        return FlatObject().scalar(0, 4, bits).scalar(1, 1, 1);
+    }
+
+    FlatObject schema() const {
+        vector<FlatObject> fields;
+        int64_t dictionaryId = 0;
+        for (const auto& column : columns) {
+            FlatObject field;
+            field.child(0, FlatObject::text(column.name)).scalar(1, 1, 0);
+            if (column.kind == INT32_COLUMN) {
+                field.scalar(2, 1, TYPE_INT).child(3, intType(32));
+            } else if (column.kind == DATE_COLUMN) {
+                field.scalar(2, 1, TYPE_DATE).child(3, FlatObject().scalar(0, 2, 0));   // days
+            } else if (column.kind == DOUBLE_COLUMN) {
+                field.scalar(2, 1, TYPE_FLOATING_POINT).child(3, FlatObject().scalar(0, 2, 2));   // double
+            } else {
+                FlatObject encoding;
+                encoding.scalar(0, 8, dictionaryId++).child(1, intType(32)).scalar(2, 1, 0);
+                field.scalar(2, 1, TYPE_UTF8).child(3, FlatObject()).child(4, encoding);
+            }
+            field.child(5, FlatObject::tables({}));
+            fields.push_back(field);
+        }
+        return FlatObject().scalar(0, 2, 0).child(1, FlatObject::tables(fields));
+    }
+
+    static FlatObject message(int headerType, const FlatObject& header, int64_t bodyLength) {
+        return FlatObject().scalar(0, 2, METADATA_V5).scalar(1, 1, headerType).child(2, header).scalar(3, 8, bodyLength);
+    }
+
+    static string packBlocks(const vector<Block>& blocks) {
+        string packed;
+        for (const auto& block : blocks) {
+            int32_t padding = 0;
+            packed.append((const char*)&block.offset, 8);
+            packed.append((const char*)&block.metadataLength, 4);
+            packed.append((const char*)&padding, 4);
+            packed.append((const char*)&block.bodyLength, 8);
+        }
+        return packed;
+    }
+
+    static void appendPair(string& packed, int64_t a, int64_t b) {
+        packed.append((const char*)&a, 8);
+        packed.append((const char*)&b, 8);
+    }
+
+    static int64_t padded(int64_t length) {
+        return (length + 7) / 8 * 8;
+    }
+
+    void writeBytes(const void* data, size_t length) {
+        file.write((const char*)data, length);
+        position += length;
+    }
+
+    void writePadding(int64_t length) {
+        static const char zeros[8] = {0};
+        writeBytes(zeros, padded(length) - length);
+    }
+
+    // Continuation marker, metadata length, metadata; returns the block for the footer
+    Block writeMessage(const FlatObject& metadata, int64_t bodyLength) {
+        string bytes = FlatWriter::finish(metadata);
+        Block block{position, (int32_t)(8 + bytes.size()), bodyLength};
+        uint32_t continuation = 0xFFFFFFFF;
+        int32_t length = bytes.size();
+        writeBytes(&continuation, 4);
+        writeBytes(&length, 4);
+        writeBytes(bytes.data(), bytes.size());
+        return block;
+    }
+
+    FlatObject recordBatch(int64_t rows, const string& nodes, size_t nodeCount, const string& buffers, size_t bufferCount) {
+        return FlatObject().scalar(0, 8, rows)
+                           .child(1, FlatObject::structs(nodes, nodeCount))
+                           .child(2, FlatObject::structs(buffers, bufferCount));
+    }
+
+    // Each dictionary is one Utf8 column: validity, offsets, characters
+    bool writeDictionary(int64_t id, const vector<string>& values) {
+        vector<int32_t> offsets(values.size() + 1, 0);
+        for (size_t i = 0; i < values.size(); i++) {
+            if ((int64_t)offsets[i] + (int64_t)values[i].size() > INT32_MAX) return false;
+            offsets[i + 1] = offsets[i] + values[i].size();
+        }
+        int64_t offsetBytes = offsets.size() * 4, characters = offsets.back();
+        string nodes, buffers;
+        appendPair(nodes, values.size(), 0);
+        appendPair(buffers, 0, 0);
+        appendPair(buffers, 0, offsetBytes);
+        appendPair(buffers, padded(offsetBytes), characters);
+        int64_t bodyLength = padded(offsetBytes) + padded(characters);
+
+        FlatObject batch = FlatObject().scalar(0, 8, id).child(1, recordBatch(values.size(), nodes, 1, buffers, 3)).scalar(2, 1, 0);
+        dictionaryBlocks.push_back(writeMessage(message(HEADER_DICTIONARY_BATCH, batch, bodyLength), bodyLength));
+        writeBytes(offsets.data(), offsetBytes);
+        writePadding(offsetBytes);
+        for (const auto& value : values) writeBytes(value.data(), value.size());
+        writePadding(characters);
+        return file.good();
+    }
+
+    bool begin(const string& filename, const vector<ColumnSpec>& spec) {
+        columns = spec;
+        file.open(filename, ios::binary);
+        if (!file.is_open()) return false;
+        writeBytes("ARROW1\0\0", 8);
+        writeMessage(message(HEADER_SCHEMA, schema(), 0), 0);
+        int64_t id = 0;
+        for (const auto& column : columns) {
+            if (column.kind == DICTIONARY_COLUMN && !writeDictionary(id++, *column.dictionary)) return false;
+        }
+        return file.good();
+    }
+
+    // Columns have no nulls, so every validity buffer is empty
+    bool write(const ColumnBatch& batch) {
+        if (batch.rows == 0) return true;
+        string nodes, buffers;
+        int64_t offset = 0;
+        for (size_t c = 0; c < columns.size(); c++) {
+            int64_t length = batch.rows * (columns[c].kind == DOUBLE_COLUMN ? 8 : 4);
+            appendPair(nodes, batch.rows, 0);
+            appendPair(buffers, offset, 0);
+            appendPair(buffers, offset, length);
+            offset += padded(length);
+        }
+        batchBlocks.push_back(writeMessage(message(HEADER_RECORD_BATCH,
+            recordBatch(batch.rows, nodes, columns.size(), buffers, columns.size() * 2), offset), offset));
+        for (size_t c = 0; c < columns.size(); c++) {
+            int64_t length;
+            if (columns[c].kind == DOUBLE_COLUMN) {
+                length = batch.rows * 8;
+                writeBytes(batch.doubles[c].data(), length);
+            } else {
+                length = batch.rows * 4;
+                writeBytes(batch.ints[c].data(), length);
+            }
+            writePadding(length);
+        }
+        return file.good();
+    }
+
+    bool finish() {
+        uint32_t endOfStream[2] = {0xFFFFFFFF, 0};
+        writeBytes(endOfStream, 8);
+        FlatObject footer;
+        footer.scalar(0, 2, METADATA_V5)
+              .child(1, schema())
+              .child(2, FlatObject::structs(packBlocks(dictionaryBlocks), dictionaryBlocks.size()))
+              .child(3, FlatObject::structs(packBlocks(batchBlocks), batchBlocks.size()));
+        string bytes = FlatWriter::finish(footer);
+        int32_t length = bytes.size();
+        writeBytes(bytes.data(), bytes.size());
+        writeBytes(&length, 4);
+        writeBytes("ARROW1", 6);
+        file.close();
+        return !file.fail();
+    }
+};
+
+// Thrift compact protocol, as used by Parquet metadata
+struct ThriftWriter {
+    enum { BOOL_TRUE = 1, BOOL_FALSE = 2, I32 = 5, I64 = 6, BINARY = 8, LIST = 9, STRUCT = 12 };
+
+    string out;
+    vector<int> lastIds;
+
+    ThriftWriter() : lastIds(1, 0) {}
+
+    void varint(uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back((char)(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((char)value);
+    }
+
+    void zigzag(int64_t value) {
+        varint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+    }
+
+    void field(int id, int type) {
+        int delta = id - lastIds.back();
+        if (delta > 0 && delta <= 15) {
+            out.push_back((char)(delta << 4 | type));
+        } else {
+            out.push_back((char)type);
+            zigzag(id);
+        }
+        lastIds.back() = id;
+    }
+
+    void i32(int id, int32_t value) {
+        field(id, I32);
+        zigzag(value);
+    }
+
+    void i64(int id, int64_t value) {
+        field(id, I64);
+        zigzag(value);
+    }
+
+    void binary(int id, const string& value) {
+        field(id, BINARY);
+        varint(value.size());
+        out += value;
+    }
+
+    void beginStruct(int id) {
+        field(id, STRUCT);
+        lastIds.push_back(0);
+    }
+
+    // Also ends a list element or the top-level struct
+    void endStruct() {
+        out.push_back(0);
+        if (lastIds.size() > 1) lastIds.pop_back();
+    }
+
+    void beginList(int id, int elementType, size_t size) {
+        field(id, LIST);
+        if (size < 15) {
+            out.push_back((char)(size << 4 | elementType));
+        } else {
+            out.push_back((char)(0xF0 | elementType));
+            varint(size);
+        }
+    }
+
+    void beginElement() {
+        lastIds.push_back(0);
+    }
+};
+
+// Parquet with one dictionary page and one data page per column chunk.
+// Dictionaries are rebuilt per row group from the values that group uses,
+// and the indices are written with the RLE/bit-packing hybrid encoding.
+struct ParquetFileWriter {
+    // Parquet enum values
+    static const int TYPE_INT32 = 1, TYPE_DOUBLE = 5, TYPE_BYTE_ARRAY = 6;
+    static const int ENCODING_PLAIN = 0, ENCODING_RLE = 3, ENCODING_RLE_DICTIONARY = 8;
+    static const int PAGE_DATA = 0, PAGE_DICTIONARY = 2;
+    static const int CONVERTED_UTF8 = 0, CONVERTED_DATE = 6;
+
+    struct ChunkInfo {
+        int64_t dataPageOffset;
+        int64_t dictionaryPageOffset;   // -1 without a dictionary
+        int64_t size;
+        string minValue, maxValue;      // plain encoded, for columns without a dictionary
+    };
+
+    struct RowGroupInfo {
+        int64_t rows;
+        vector<ChunkInfo> chunks;
+    };
+
+    ofstream file;
+    vector<ColumnSpec> columns;
+    vector<RowGroupInfo> rowGroups;
+    int64_t position;
+    vector<int32_t> localIndex;       // dictionary index -> index in this group's dictionary, or -1
+    vector<int32_t> used;             // dictionary indices this group uses, in first-use order
+    vector<int32_t> localValues;
+    string page;
+
+    ParquetFileWriter() : position(0) {}
+
+    static int physicalType(ColumnKind kind) {
+        return kind == DOUBLE_COLUMN ? TYPE_DOUBLE : kind == DICTIONARY_COLUMN ? TYPE_BYTE_ARRAY : TYPE_INT32;
+    }
+
+    void writeBytes(const string& bytes) {
+        file.write(bytes.data(), bytes.size());
+        position += bytes.size();
+    }
+
+    void writePage(int type, int32_t values, const string& data, int encoding) {
+        ThriftWriter header;
+        header.i32(1, type);
+        header.i32(2, data.size());
+        header.i32(3, data.size());
+        if (type == PAGE_DICTIONARY) {
+            header.beginStruct(7);
+            header.i32(1, values);
+            header.i32(2, ENCODING_PLAIN);
+            header.endStruct();
+        } else {
+            header.beginStruct(5);
+            header.i32(1, values);
+            header.i32(2, encoding);
+            header.i32(3, ENCODING_RLE);
+            header.i32(4, ENCODING_RLE);
+            header.endStruct();
+        }
+        header.endStruct();
+        writeBytes(header.out);
+        writeBytes(data);
+    }
+
+    static void varint(string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back((char)(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((char)value);
+    }
+
+    // Runs of 8 or more equal values become RLE runs; everything else is
+    // bit-packed in groups of 8, the last group padded with zeros
+    static void encodeHybrid(const vector<int32_t>& values, int bitWidth, string& out) {
+        size_t n = values.size(), i = 0;
+        auto runAt = [&](size_t at, size_t limit) {
+            size_t run = 1;
+            while (at + run < n && run < limit && values[at + run] == values[at]) run++;
+            return run;
+        };
+        while (i < n) {
+            size_t run = runAt(i, n);
+            if (run >= 8) {
+                varint(out, run << 1);
+                for (int b = 0; b < (bitWidth + 7) / 8; b++) out.push_back((char)(values[i] >> (8 * b)));
+                i += run;
+                continue;
+            }
+            size_t start = i, groups = 0;
+            while (i < n && (groups == 0 || runAt(i, 8) < 8)) {
+                i = min(n, i + 8);
+                groups++;
+            }
+            varint(out, groups << 1 | 1);
+            uint64_t bits = 0;
+            int pending = 0;
+            for (size_t v = start; v < start + groups * 8; v++) {
+                bits |= (uint64_t)(v < n ? values[v] : 0) << pending;
+                pending += bitWidth;
+                while (pending >= 8) {
+                    out.push_back((char)(bits & 0xff));
+                    bits >>= 8;
+                    pending -= 8;
+                }
+            }
+        }
+    }
+
+    bool begin(const string& filename, const vector<ColumnSpec>& spec) {
+        columns = spec;
+        file.open(filename, ios::binary);
+        if (!file.is_open()) return false;
+        writeBytes("PAR1");
+        return file.good();
+    }
+
+    template <class T>
+    static string plain(T value) {
+        return string((const char*)&value, sizeof(T));
+    }
+
+    bool write(const ColumnBatch& batch) {
+        if (batch.rows == 0) return true;
+        RowGroupInfo group;
+        group.rows = batch.rows;
+        for (size_t c = 0; c < columns.size(); c++) {
+            ChunkInfo chunk;
+            int64_t start = position;
+            chunk.dictionaryPageOffset = -1;
+            page.clear();
+            if (columns[c].kind == DICTIONARY_COLUMN) {
+                const vector<string>& dictionary = *columns[c].dictionary;
+                const vector<int32_t>& values = batch.ints[c];
+                if (localIndex.size() < dictionary.size()) localIndex.resize(dictionary.size(), -1);
+                used.clear();
+                localValues.resize(values.size());
+                for (size_t r = 0; r < values.size(); r++) {
+                    int32_t& local = localIndex[values[r]];
+                    if (local < 0) {
+                        local = used.size();
+                        used.push_back(values[r]);
+                    }
+                    localValues[r] = local;
+                }
+                for (auto index : used) {
+                    const string& value = dictionary[index];
+                    page += plain<int32_t>(value.size());
+                    page += value;
+                    localIndex[index] = -1;
+                }
+                chunk.dictionaryPageOffset = position;
+                writePage(PAGE_DICTIONARY, used.size(), page, ENCODING_PLAIN);
+
+                int bitWidth = 1;
+                while (bitWidth < 32 && (size_t(1) << bitWidth) < used.size()) bitWidth++;
+                page.assign(1, (char)bitWidth);
+                encodeHybrid(localValues, bitWidth, page);
+                chunk.dataPageOffset = position;
+                writePage(PAGE_DATA, batch.rows, page, ENCODING_RLE_DICTIONARY);
+            } else if (columns[c].kind == DOUBLE_COLUMN) {
+                const vector<double>& values = batch.doubles[c];
+                page.assign((const char*)values.data(), values.size() * 8);
+                auto range = minmax_element(values.begin(), values.end());
+                chunk.minValue = plain(*range.first);
+                chunk.maxValue = plain(*range.second);
+                chunk.dataPageOffset = position;
+                writePage(PAGE_DATA, batch.rows, page, ENCODING_PLAIN);
+            } else {
+                const vector<int32_t>& values = batch.ints[c];
+                page.assign((const char*)values.data(), values.size() * 4);
+                auto range = minmax_element(values.begin(), values.end());
+                chunk.minValue = plain(*range.first);
+                chunk.maxValue = plain(*range.second);
+                chunk.dataPageOffset = position;
+                writePage(PAGE_DATA, batch.rows, page, ENCODING_PLAIN);
+            }
+            chunk.size = position - start;
+            group.chunks.push_back(chunk);
+        }
+        rowGroups.push_back(group);
+        return file.good();
+    }
+
+    bool finish() {
+        ThriftWriter meta;
+        int64_t totalRows = 0;
+        for (const auto& group : rowGroups) totalRows += group.rows;
+        meta.i32(1, 1);
+        meta.beginList(2, ThriftWriter::STRUCT, columns.size() + 1);
+        meta.beginElement();
+        meta.binary(4, "schema");
+        meta.i32(5, columns.size());
+        meta.endStruct();
+        for (const auto& column : columns) {
+            meta.beginElement();
+            meta.i32(1, physicalType(column.kind));
+            meta.i32(3, 0);   // required
+            meta.binary(4, column.name);
+            if (column.kind == DICTIONARY_COLUMN) meta.i32(6, CONVERTED_UTF8);
+            if (column.kind == DATE_COLUMN) meta.i32(6, CONVERTED_DATE);
+            meta.endStruct();
+        }
+        meta.i64(3, totalRows);
+        meta.beginList(4, ThriftWriter::STRUCT, rowGroups.size());
+        for (const auto& group : rowGroups) {
+            int64_t bytes = 0;
+            for (const auto& chunk : group.chunks) bytes += chunk.size;
+            meta.beginElement();
+            meta.beginList(1, ThriftWriter::STRUCT, columns.size());
+            for (size_t c = 0; c < columns.size(); c++) {
+                const ChunkInfo& chunk = group.chunks[c];
+                bool dictionary = chunk.dictionaryPageOffset >= 0;
+                meta.beginElement();
+                meta.i64(2, dictionary ? chunk.dictionaryPageOffset : chunk.dataPageOffset);
+                meta.beginStruct(3);
+                meta.i32(1, physicalType(columns[c].kind));
+                meta.beginList(2, ThriftWriter::I32, dictionary ? 3 : 2);
+                meta.zigzag(ENCODING_PLAIN);
+                meta.zigzag(ENCODING_RLE);
+                if (dictionary) meta.zigzag(ENCODING_RLE_DICTIONARY);
+                meta.beginList(3, ThriftWriter::BINARY, 1);
+                meta.varint(columns[c].name.size());
+                meta.out += columns[c].name;
+                meta.i32(4, 0);   // uncompressed
+                meta.i64(5, group.rows);
+                meta.i64(6, chunk.size);
+                meta.i64(7, chunk.size);
+                meta.i64(9, chunk.dataPageOffset);
+                if (dictionary) {
+                    meta.i64(11, chunk.dictionaryPageOffset);
+                } else {
+                    meta.beginStruct(12);
+                    meta.i64(3, 0);
+                    meta.binary(5, chunk.maxValue);
+                    meta.binary(6, chunk.minValue);
+                    meta.endStruct();
+                }
+                meta.endStruct();
+                meta.endStruct();
+            }
+            meta.i64(2, bytes);
+            meta.i64(3, group.rows);
+            meta.endStruct();
+        }
+        meta.binary(6, "finance_manager");
+        // Readers ignore min/max statistics unless told the sort order
+        meta.beginList(7, ThriftWriter::STRUCT, columns.size());
+        for (size_t c = 0; c < columns.size(); c++) {
+            meta.beginElement();
+            meta.beginStruct(1);
+            meta.endStruct();
+            meta.endStruct();
+        }
+        meta.endStruct();
+
+        writeBytes(meta.out);
+        int32_t length = meta.out.size();
+        writeBytes(string((const char*)&length, 4));
+        writeBytes("PAR1");
+        file.close();
+        return !file.fail();
+    }
+};
+
+struct ColumnarExporter {
+    FinanceManager& manager;
+    size_t rowsPerGroup;
+    vector<string> transactionTypes;
+    vector<string> productTypes;
+    vector<string> currencyCodes;
+    vector<string> categoryNames;
+
+    ColumnarExporter(FinanceManager& m, size_t rows = 1 << 20)
+        : manager(m), rowsPerGroup(max<size_t>(1, min<size_t>(rows, 1 << 24))) {
+        transactionTypes = {"Expenditure", "Income"};
+        productTypes = {FD::NAME, SIP::NAME};
+        currencyCodes = currencies().snapshot();
+        if (currencyCodes[0].empty()) currencyCodes[0] = "BASE";
+        categoryNames = categories().snapshot().names;
+    }
+
+    vector<ColumnSpec> transactionColumns() const {
+        return {
+            {"date", DATE_COLUMN, nullptr},
+            {"type", DICTIONARY_COLUMN, &transactionTypes},
+            {"amount", DOUBLE_COLUMN, nullptr},
+            {"currency", DICTIONARY_COLUMN, &currencyCodes},
+            {"category", DICTIONARY_COLUMN, &categoryNames},
+            {"description", DICTIONARY_COLUMN, &manager.descriptionSuggestions},
+        };
+    }
+
+    vector<ColumnSpec> investmentColumns() const {
+        return {
+            {"type", DICTIONARY_COLUMN, &productTypes},
+            {"amount", DOUBLE_COLUMN, nullptr},
+            {"duration_years", INT32_COLUMN, nullptr},
+            {"start_date", DATE_COLUMN, nullptr},
+            {"maturity_date", DATE_COLUMN, nullptr},
+            {"monthly", DOUBLE_COLUMN, nullptr},
+            {"maturity_amount", DOUBLE_COLUMN, nullptr},
+            {"currency", DICTIONARY_COLUMN, &currencyCodes},
+        };
+    }
+
+    // Archived rows first, decoded block by block without touching the block
+    // cache, then the live rows.
+    // Descriptions use the manager's description ids as dictionary indices.
+    template <class Writer>
+    bool writeTransactions(Writer& writer, const string& filename) {
+        FINANCE_TIME_SCOPE("export_transactions");
+        vector<int32_t> coldDescriptions(manager.coldStore.dictionary.size());
+        for (size_t id = 0; id < coldDescriptions.size(); id++) {
+            coldDescriptions[id] = manager.internDescription(manager.coldStore.dictionary[id]);
+        }
+        if (!writer.begin(filename, transactionColumns())) {
+            return false;
+        }
+
+        ColumnBatch batch;
+        batch.reset(6);
+        bool ok = true;
+        auto add = [&](int day, bool income, double amount, int currency, int category, int32_t description) {
+            batch.ints[0].push_back(day);
+            batch.ints[1].push_back(income ? 1 : 0);
+            batch.doubles[2].push_back(amount);
+            batch.ints[3].push_back(currency);
+            batch.ints[4].push_back(category);
+            batch.ints[5].push_back(description);
+            if (++batch.rows == rowsPerGroup) {
+                ok = ok && writer.write(batch);
+                batch.reset(6);
+            }
+        };
+        vector<ColdRow> rows;
+        for (const auto& block : manager.coldStore.blocks) {
+            manager.coldStore.decodeInto(block, rows);
+            for (const auto& row : rows) {
+                add(row.dayNumber, row.income, row.amount, row.currency, row.category, coldDescriptions[row.descriptionId]);
+            }
+        }
+        for (auto t : manager.transactions) {
+            add(t->date.dayNumber(), t->type == "Income", t->amount, t->currency, t->category, t->descriptionId);
+        }
+        ok = ok && writer.write(batch);
+        FINANCE_COUNT("records_exported", manager.transactionCount());
+        return writer.finish() && ok;
+    }
+
+    template <class Writer>
+    bool writeInvestments(Writer& writer, const string& filename) {
+        if (!writer.begin(filename, investmentColumns())) {
+            return false;
+        }
+        ColumnBatch batch;
+        batch.reset(8);
+        bool ok = true;
+        for (const auto& i : manager.investments) {
+            batch.ints[0].push_back(i.product.index());
+            batch.doubles[1].push_back(i.amount);
+            batch.ints[2].push_back(i.duration);
+            batch.ints[3].push_back(i.startDate.dayNumber());
+            batch.ints[4].push_back(i.maturityDay());
+            batch.doubles[5].push_back(i.monthly());
+            batch.doubles[6].push_back(i.maturityAmount());
+            batch.ints[7].push_back(i.currency);
+            if (++batch.rows == rowsPerGroup) {
+                ok = ok && writer.write(batch);
+                batch.reset(8);
+            }
+        }
+        ok = ok && writer.write(batch);
+        return writer.finish() && ok;
+    }
+
+    // Writes <prefix>_transactions and <prefix>_investments, as .arrow or .parquet
+    bool exportLedger(const string& prefix, bool parquet) {
+        string extension = parquet ? ".parquet" : ".arrow";
+        if (parquet) {
+            ParquetFileWriter transactions, investments;
+            return writeTransactions(transactions, prefix + "_transactions" + extension)
+                && writeInvestments(investments, prefix + "_investments" + extension);
+        }
+        ArrowFileWriter transactions, investments;
+        return writeTransactions(transactions, prefix + "_transactions" + extension)
+            && writeInvestments(investments, prefix + "_investments" + extension);
+    }
+};
+
+#endif
@@ -0,0 +1,52 @@
+#include "columnar_export.h"
+
+#include <cstdlib>
+
+int main(int argc, char** argv) {
+    string dataFile = "default_finance_data.txt";
+    string prefix;
+    bool parquet = false;
+    size_t rowsPerGroup = 1 << 20;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--in" && i + 1 < argc) {
+            dataFile = argv[++i];
+        } else if (arg == "--format" && i + 1 < argc && (string(argv[i + 1]) == "arrow" || string(argv[i + 1]) == "parquet")) {
+            parquet = string(argv[++i]) == "parquet";
+        } else if (arg == "--rows-per-group" && i + 1 < argc) {
+            rowsPerGroup = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--out" && i + 1 < argc) {
+            prefix = argv[++i];
+        } else {
+            cerr << "usage: " << argv[0] << " [--in <username>_finance_data.txt] [--format arrow|parquet]"
+                 << " [--rows-per-group N] [--out <prefix>]" << endl;
+            return 1;
+        }
+    }
+    if (prefix.empty()) {
+        prefix = dataFile.substr(0, dataFile.rfind(".txt"));
+    }
+
+    FinanceManager manager;
+    double balance = 0;
+    auto start = steady_clock::now();
+    if (!manager.loadFromFile(dataFile, balance)) {
+        cerr << "Error reading " << dataFile << endl;
+        return 1;
+    }
+    double loadSeconds = duration<double>(steady_clock::now() - start).count();
+
+    start = steady_clock::now();
+    ColumnarExporter exporter(manager, rowsPerGroup);
+    if (!exporter.exportLedger(prefix, parquet)) {
+        cerr << "Error writing " << prefix << "_*" << (parquet ? ".parquet" : ".arrow") << endl;
+        return 1;
+    }
+    double seconds = duration<double>(steady_clock::now() - start).count();
+
+    cerr << "Exported " << manager.transactionCount() << " transactions and " << manager.investments.size()
+         << " investments to " << prefix << "_*" << (parquet ? ".parquet" : ".arrow") << " in " << fixed
+         << setprecision(2) << seconds << "s (loading took " << loadSeconds << "s)" << endl;
+    return 0;
+}
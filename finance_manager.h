@@ -0,0 +1,5866 @@
+#ifndef FINANCE_MANAGER_H
+#define FINANCE_MANAGER_H
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <limits>
+#include <climits>
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include <algorithm>
+#include <regex>
+#include <sstream>
+#include <cctype>
+#include <unordered_map>
+#include <map>
+#include <cstring>
+#include <cstdio>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <variant>
+#include <optional>
+#include <unordered_set>
+#include <random>
+#include <filesystem>
+
+#include "metrics.h"
+
+using namespace std;
+using namespace std::chrono;
+
+struct Date {
+    int day, month, year;
+
+    Date() {
+        auto now = chrono::system_clock::now();
+        time_t now_time = chrono::system_clock::to_time_t(now);
+        // localtime shares one buffer between threads
+        tm now_tm;
+#ifdef _WIN32
+        localtime_s(&now_tm, &now_time);
+#else
+        localtime_r(&now_time, &now_tm);
+#endif
+        
+        day = now_tm.tm_mday;
+        month = now_tm.tm_mon + 1;
+        year = now_tm.tm_year + 1900;
+    }
+    
+    Date(int d, int m, int y) : day(d), month(m), year(y) {}
+    
+    string toString() const {
+        return to_string(day) + "/" + to_string(month) + "/" + to_string(year);
+    }
+    
+    // Sortable yyyymmdd number
+    int key() const {
+        return year * 10000 + month * 100 + day;
+    }
+    
+    // Days since 1 January 1970 (proleptic Gregorian calendar)
+    int dayNumber() const {
+        int y = year - (month <= 2 ? 1 : 0);
+        int era = (y >= 0 ? y : y - 399) / 400;
+        int yearOfEra = y - era * 400;
+        int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+        int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+        return era * 146097 + dayOfEra - 719468;
+    }
+    
+    static Date fromDayNumber(int days) {
+        days += 719468;
+        int era = (days >= 0 ? days : days - 146096) / 146097;
+        int dayOfEra = days - era * 146097;
+        int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+        int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+        int mp = (5 * dayOfYear + 2) / 153;
+        int d = dayOfYear - (153 * mp + 2) / 5 + 1;
+        int m = mp < 10 ? mp + 3 : mp - 9;
+        return Date(d, m, yearOfEra + era * 400 + (m <= 2 ? 1 : 0));
+    }
+    
+    // 0 = Monday ... 6 = Sunday
+    int weekday() const {
+        int days = dayNumber();
+        return ((days % 7) + 7 + 3) % 7;
+    }
+    
+    static int daysInMonth(int month, int year) {
+        static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+        if (month < 1 || month > 12) return 30;
+        bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+        return month == 2 && leap ? 29 : days[month - 1];
+    }
+};
+
+inline ostream& operator<<(ostream& os, const Date& date) {
+    os << date.toString();
+    return os;
+}
+
+inline ofstream& operator<<(ofstream& ofs, const Date& date) {
+    ofs << date.day << " " << date.month << " " << date.year;
+    return ofs;
+}
+
+inline ifstream& operator>>(ifstream& ifs, Date& date) {
+    ifs >> date.day >> date.month >> date.year;
+    return ifs;
+}
+
+// Built-in categories keep their historical ids; user categories are
+// registered at runtime and get the next free id.
+enum BuiltinCategory {
+    INCOME,
+    FOOD,
+    HOUSING,
+    TRANSPORTATION,
+    ENTERTAINMENT,
+    UTILITIES,
+    HEALTHCARE,
+    EDUCATION,
+    OTHER
+};
+
+typedef int CategoryType;
+
+// Default for expenses recorded without a category; addTransaction classifies them
+const CategoryType UNCATEGORIZED = -2;
+
+// Categories form a tree. Ids are dense and a child is always registered after
+// its parent, so totals can be rolled up with one reverse pass over the ids.
+// Names are full paths such as "Food:Groceries" and never contain spaces,
+// which keeps them safe in the whitespace separated data file.
+struct CategoryTree {
+    vector<string> names;
+    vector<string> labels;
+    vector<int> parents;
+    vector<vector<int>> children;
+
+    bool valid(int id) const {
+        return id >= 0 && id < (int)names.size();
+    }
+
+    const string& name(int id) const {
+        static const string unknown = "Unknown";
+        return valid(id) ? names[id] : unknown;
+    }
+
+    int depth(int id) const {
+        int d = 0;
+        while (valid(id) && parents[id] != -1) {
+            id = parents[id];
+            d++;
+        }
+        return d;
+    }
+
+    bool isWithin(int id, int ancestor) const {
+        while (valid(id)) {
+            if (id == ancestor) return true;
+            id = parents[id];
+        }
+        return false;
+    }
+
+    // A category followed by all of its sub-categories
+    vector<int> subtree(int id) const {
+        vector<int> ids;
+        if (!valid(id)) return ids;
+        ids.push_back(id);
+        for (size_t i = 0; i < ids.size(); i++) {
+            ids.insert(ids.end(), children[ids[i]].begin(), children[ids[i]].end());
+        }
+        return ids;
+    }
+
+    // Adds every category's total into its parent's, children first
+    void rollUp(vector<double>& totals) const {
+        totals.resize(names.size(), 0.0);
+        for (int id = names.size() - 1; id >= 0; id--) {
+            if (parents[id] != -1) totals[parents[id]] += totals[id];
+        }
+    }
+
+    // Ids in display order: every parent directly followed by its subtree
+    vector<int> preorder() const {
+        vector<int> order;
+        vector<int> stack;
+        for (int id = names.size() - 1; id >= 0; id--) {
+            if (parents[id] == -1) stack.push_back(id);
+        }
+        while (!stack.empty()) {
+            int id = stack.back();
+            stack.pop_back();
+            order.push_back(id);
+            for (auto it = children[id].rbegin(); it != children[id].rend(); ++it) {
+                stack.push_back(*it);
+            }
+        }
+        return order;
+    }
+};
+
+// The tree shared by every ledger. Lookups take the lock shared and only
+// registering a category takes it exclusively, so several ledgers can be
+// loaded and reported on different threads at once. Reports that walk the
+// whole tree work on a snapshot() instead of holding the lock.
+struct CategoryRegistry {
+    CategoryTree tree;
+    unordered_map<string, int> ids;
+    mutable shared_mutex lock;
+
+    CategoryRegistry() {
+        const char* builtins[] = {"Income", "Food", "Housing", "Transportation", "Entertainment",
+                                  "Utilities", "Healthcare", "Education", "Other"};
+        for (auto name : builtins) {
+            add(name);
+        }
+    }
+
+    size_t size() const {
+        shared_lock<shared_mutex> guard(lock);
+        return tree.names.size();
+    }
+
+    bool valid(int id) const {
+        shared_lock<shared_mutex> guard(lock);
+        return tree.valid(id);
+    }
+
+    int find(const string& path) const {
+        shared_lock<shared_mutex> guard(lock);
+        auto it = ids.find(path);
+        return it == ids.end() ? -1 : it->second;
+    }
+
+    string name(int id) const {
+        shared_lock<shared_mutex> guard(lock);
+        return tree.name(id);
+    }
+
+    int depth(int id) const {
+        shared_lock<shared_mutex> guard(lock);
+        return tree.depth(id);
+    }
+
+    bool isWithin(int id, int ancestor) const {
+        shared_lock<shared_mutex> guard(lock);
+        return tree.isWithin(id, ancestor);
+    }
+
+    vector<int> subtree(int id) const {
+        shared_lock<shared_mutex> guard(lock);
+        return tree.subtree(id);
+    }
+
+    CategoryTree snapshot() const {
+        shared_lock<shared_mutex> guard(lock);
+        return tree;
+    }
+
+    int add(const string& label, int parent = -1) {
+        unique_lock<shared_mutex> guard(lock);
+        return insert(label, parent);
+    }
+
+    // Looks up a full path, creating any missing levels on the way
+    int intern(const string& path) {
+        int id = find(path);
+        if (id != -1) return id;
+
+        unique_lock<shared_mutex> guard(lock);
+        int parent = -1;
+        size_t start = 0;
+        while (start <= path.size()) {
+            size_t end = path.find(':', start);
+            if (end == string::npos) end = path.size();
+            int next = insert(path.substr(start, end - start), parent);
+            if (next != -1) parent = next;
+            start = end + 1;
+        }
+        return parent;
+    }
+
+    // Callers hold the lock exclusively
+    int insert(string label, int parent) {
+        replace(label.begin(), label.end(), ' ', '_');
+        replace(label.begin(), label.end(), ':', '_');
+        if (label.empty()) return -1;
+        if (!tree.valid(parent)) parent = -1;
+
+        string path = parent == -1 ? label : tree.names[parent] + ":" + label;
+        auto existing = ids.find(path);
+        if (existing != ids.end()) return existing->second;
+
+        int id = tree.names.size();
+        tree.names.push_back(path);
+        tree.labels.push_back(label);
+        tree.parents.push_back(parent);
+        tree.children.push_back(vector<int>());
+        if (parent != -1) tree.children[parent].push_back(id);
+        ids[path] = id;
+        return id;
+    }
+};
+
+inline CategoryRegistry& categories() {
+    static CategoryRegistry registry;
+    return registry;
+}
+
+inline string categoryToString(CategoryType cat) {
+    return categories().name(cat);
+}
+
+inline CategoryType stringToCategory(const string& str) {
+    if (str.empty()) return OTHER;
+    return categories().intern(str);
+}
+
+// Currency codes get small ids. Id 0 is the base currency that balances and
+// reports are shown in; amounts stored without a code are in it.
+struct CurrencyRegistry {
+    vector<string> codes;
+    unordered_map<string, int> ids;
+    mutable shared_mutex lock;   // shared for lookups, exclusive to add a code or change the base, as for categories
+
+    CurrencyRegistry() {
+        codes.push_back("");
+    }
+
+    int intern(const string& code) {
+        {
+            shared_lock<shared_mutex> guard(lock);
+            if (code.empty() || code == codes[0]) return 0;
+            auto found = ids.find(code);
+            if (found != ids.end()) return found->second;
+        }
+        unique_lock<shared_mutex> guard(lock);
+        if (code == codes[0]) return 0;
+        auto found = ids.find(code);
+        if (found != ids.end()) return found->second;
+        int id = codes.size();
+        codes.push_back(code);
+        ids.emplace(code, id);
+        return id;
+    }
+
+    void setBase(const string& code) {
+        unique_lock<shared_mutex> guard(lock);
+        codes[0] = code;
+    }
+
+    string code(int id) const {
+        shared_lock<shared_mutex> guard(lock);
+        return id >= 0 && id < (int)codes.size() ? codes[id] : string();
+    }
+
+    size_t size() const {
+        shared_lock<shared_mutex> guard(lock);
+        return codes.size();
+    }
+
+    vector<string> snapshot() const {
+        shared_lock<shared_mutex> guard(lock);
+        return codes;
+    }
+};
+
+inline CurrencyRegistry& currencies() {
+    static CurrencyRegistry registry;
+    return registry;
+}
+
+// Daily exchange rates into the base currency. Each currency's quotes are
+// expanded into a dense array from its first to its last quoted day, with
+// gaps carried forward from the previous quote, so a (currency, day) lookup
+// is one clamped array index. Days before the first quote use the first
+// quote and days after the last use the last.
+struct FxTable {
+    struct Series {
+        int firstDay;
+        vector<double> rates;
+    };
+
+    vector<Series> series;   // by currency id; empty rates means no quotes (rate 1)
+
+    FxTable() {
+        series.push_back({0, vector<double>(1, 1.0)});
+    }
+
+    // Lines are "BASE <code>" or "<code> <day> <month> <year> <rate>", where
+    // one unit of <code> is worth <rate> units of the base currency
+    bool loadFromFile(const string& filename) {
+        ifstream file(filename);
+        if (!file.is_open()) {
+            return false;
+        }
+        vector<vector<pair<int, double>>> quotes;
+        string code;
+        while (file >> code) {
+            if (code == "BASE") {
+                file >> code;
+                currencies().setBase(code);
+                continue;
+            }
+            int day, month, year;
+            double rate;
+            if (!(file >> day >> month >> year >> rate)) break;
+            int id = currencies().intern(code);
+            if (id == 0) continue;
+            if (id >= (int)quotes.size()) quotes.resize(id + 1);
+            quotes[id].push_back({Date(day, month, year).dayNumber(), rate});
+        }
+        
+        series.resize(max(series.size(), quotes.size()));
+        for (size_t id = 1; id < quotes.size(); id++) {
+            if (quotes[id].empty()) continue;
+            sort(quotes[id].begin(), quotes[id].end());
+            Series& s = series[id];
+            s.firstDay = quotes[id].front().first;
+            s.rates.assign(quotes[id].back().first - s.firstDay + 1, 0.0);
+            size_t next = 0;
+            double rate = quotes[id].front().second;
+            for (size_t d = 0; d < s.rates.size(); d++) {
+                while (next < quotes[id].size() && quotes[id][next].first == s.firstDay + (int)d) {
+                    rate = quotes[id][next++].second;
+                }
+                s.rates[d] = rate;
+            }
+        }
+        return true;
+    }
+
+    double rate(int currency, int day) const {
+        if (currency <= 0 || currency >= (int)series.size() || series[currency].rates.empty()) return 1.0;
+        const Series& s = series[currency];
+        long index = min(max(day - s.firstDay, 0), (int)s.rates.size() - 1);
+        return s.rates[index];
+    }
+
+    // Converts a batch of amounts in place, one tight pass over the columns
+    void toBase(vector<double>& amounts, const vector<int>& currency, const vector<int>& days) const {
+        if (series.size() == 1) {
+            return;
+        }
+        for (size_t i = 0; i < amounts.size(); i++) {
+            amounts[i] *= rate(currency[i], days[i]);
+        }
+    }
+};
+
+// Assigns a category to a description. Keyword rules are compiled into one
+// Aho-Corasick automaton (a full DFA over a small alphabet), regex rules are
+// tried next and a naive Bayes model trained on labeled descriptions is the
+// last resort.
+struct Categorizer {
+    static const int ALPHABET = 37; // a-z, 0-9, everything else
+
+    struct Node {
+        int next[ALPHABET];
+        int fail;
+        int category;    // best keyword ending here, -1 if none
+        int matchLength;
+    };
+
+    vector<pair<string, CategoryType>> keywordRules;
+    vector<pair<regex, CategoryType>> regexRules;
+    vector<Node> nodes;
+    bool compiled;
+
+    unordered_map<string, vector<int>> tokenCounts;
+    vector<int> documentCounts;
+    vector<int> tokenTotals;
+    int trainedDocuments;
+
+    Categorizer() : compiled(false), trainedDocuments(0) {}
+
+    static int symbol(char c) {
+        unsigned char u = static_cast<unsigned char>(c);
+        if (u >= 'a' && u <= 'z') return u - 'a';
+        if (u >= 'A' && u <= 'Z') return u - 'A';
+        if (u >= '0' && u <= '9') return 26 + (u - '0');
+        return 36;
+    }
+
+    void addKeywordRule(const string& keyword, CategoryType category) {
+        if (keyword.empty()) return;
+        keywordRules.push_back(make_pair(keyword, category));
+        compiled = false;
+    }
+
+    bool addRegexRule(const string& pattern, CategoryType category) {
+        try {
+            regexRules.push_back(make_pair(regex(pattern, regex::icase | regex::optimize), category));
+            return true;
+        } catch (const regex_error&) {
+            return false;
+        }
+    }
+
+    void addDefaultRules() {
+        const char* food[] = {"grocer", "restaurant", "cafe", "coffee", "pizza", "burger", "bakery", "supermarket", "lunch", "dinner", "breakfast"};
+        const char* housing[] = {"rent", "mortgage", "landlord", "furniture", "repair"};
+        const char* transport[] = {"uber", "taxi", "fuel", "petrol", "gasoline", "parking", "train", "airline", "flight", "bus ticket"};
+        const char* entertainment[] = {"netflix", "spotify", "cinema", "movie", "concert", "game", "theatre"};
+        const char* utilities[] = {"electric", "water bill", "internet", "phone bill", "mobile", "telecom", "gas bill"};
+        const char* healthcare[] = {"pharmacy", "hospital", "clinic", "doctor", "dental", "medicine", "insurance"};
+        const char* education[] = {"tuition", "school", "university", "college", "course", "textbook", "exam fee"};
+
+        for (auto k : food) addKeywordRule(k, FOOD);
+        for (auto k : housing) addKeywordRule(k, HOUSING);
+        for (auto k : transport) addKeywordRule(k, TRANSPORTATION);
+        for (auto k : entertainment) addKeywordRule(k, ENTERTAINMENT);
+        for (auto k : utilities) addKeywordRule(k, UTILITIES);
+        for (auto k : healthcare) addKeywordRule(k, HEALTHCARE);
+        for (auto k : education) addKeywordRule(k, EDUCATION);
+    }
+
+    // Rule file lines: "K <Category> <keyword>" or "R <Category> <regex>".
+    // The pattern is the rest of the line, so it may contain spaces.
+    bool loadRules(const string& filename) {
+        ifstream file(filename);
+        if (!file.is_open()) {
+            return false;
+        }
+
+        string line;
+        while (getline(file, line)) {
+            istringstream in(line);
+            string kind, categoryStr, pattern;
+            if (!(in >> kind >> categoryStr)) continue;
+            in >> ws;
+            getline(in, pattern);
+            if (pattern.empty()) continue;
+
+            CategoryType category = stringToCategory(categoryStr);
+            if (kind == "K") {
+                addKeywordRule(pattern, category);
+            } else if (kind == "R") {
+                addRegexRule(pattern, category);
+            }
+        }
+        return true;
+    }
+
+    void compile() {
+        nodes.assign(1, Node());
+        fill(nodes[0].next, nodes[0].next + ALPHABET, -1);
+        nodes[0].fail = 0;
+        nodes[0].category = -1;
+        nodes[0].matchLength = 0;
+
+        for (const auto& rule : keywordRules) {
+            int state = 0;
+            for (char c : rule.first) {
+                int s = symbol(c);
+                if (nodes[state].next[s] == -1) {
+                    Node node;
+                    fill(node.next, node.next + ALPHABET, -1);
+                    node.fail = 0;
+                    node.category = -1;
+                    node.matchLength = 0;
+                    nodes[state].next[s] = nodes.size();
+                    nodes.push_back(node);
+                }
+                state = nodes[state].next[s];
+            }
+            // Later rules override earlier ones, so user rules beat the defaults
+            nodes[state].category = rule.second;
+            nodes[state].matchLength = rule.first.size();
+        }
+
+        // Breadth-first pass fills in failure links and turns the trie into a DFA
+        vector<int> queue;
+        for (int s = 0; s < ALPHABET; s++) {
+            int child = nodes[0].next[s];
+            if (child == -1) {
+                nodes[0].next[s] = 0;
+            } else {
+                nodes[child].fail = 0;
+                queue.push_back(child);
+            }
+        }
+        for (size_t head = 0; head < queue.size(); head++) {
+            int state = queue[head];
+            Node& fallback = nodes[nodes[state].fail];
+            if (fallback.matchLength > nodes[state].matchLength) {
+                nodes[state].category = fallback.category;
+                nodes[state].matchLength = fallback.matchLength;
+            }
+            for (int s = 0; s < ALPHABET; s++) {
+                int child = nodes[state].next[s];
+                if (child == -1) {
+                    nodes[state].next[s] = nodes[nodes[state].fail].next[s];
+                } else {
+                    nodes[child].fail = nodes[nodes[state].fail].next[s];
+                    queue.push_back(child);
+                }
+            }
+        }
+
+        compiled = true;
+    }
+
+    static void tokenize(const string& text, vector<string>& tokens) {
+        tokens.clear();
+        string current;
+        for (char c : text) {
+            if (isalnum(static_cast<unsigned char>(c))) {
+                current += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+            } else if (!current.empty()) {
+                tokens.push_back(current);
+                current.clear();
+            }
+        }
+        if (!current.empty()) {
+            tokens.push_back(current);
+        }
+    }
+
+    // Only descriptions the user actually labeled are worth learning from
+    void learn(const string& description, CategoryType category) {
+        if (category < 0 || category == OTHER || categories().isWithin(category, INCOME)) return;
+
+        vector<string> tokens;
+        tokenize(description, tokens);
+        if (tokens.empty()) return;
+
+        if (category >= (int)documentCounts.size()) {
+            documentCounts.resize(category + 1, 0);
+            tokenTotals.resize(category + 1, 0);
+        }
+        documentCounts[category]++;
+        trainedDocuments++;
+        for (const auto& token : tokens) {
+            vector<int>& counts = tokenCounts[token];
+            if (category >= (int)counts.size()) counts.resize(category + 1, 0);
+            counts[category]++;
+            tokenTotals[category]++;
+        }
+    }
+
+    CategoryType classifyLearned(const string& description, CategoryType fallback) {
+        if (trainedDocuments == 0) return fallback;
+
+        vector<string> tokens;
+        tokenize(description, tokens);
+
+        vector<const vector<int>*> known;
+        for (const auto& token : tokens) {
+            auto it = tokenCounts.find(token);
+            if (it != tokenCounts.end()) known.push_back(&it->second);
+        }
+        if (known.empty()) return fallback;
+
+        double vocabulary = tokenCounts.size();
+        double bestScore = 0;
+        int best = -1;
+        for (int c = 0; c < (int)documentCounts.size(); c++) {
+            if (documentCounts[c] == 0) continue;
+            double score = log(double(documentCounts[c]) / trainedDocuments);
+            for (auto counts : known) {
+                int count = c < (int)counts->size() ? (*counts)[c] : 0;
+                score += log((count + 1.0) / (tokenTotals[c] + vocabulary));
+            }
+            if (best == -1 || score > bestScore) {
+                best = c;
+                bestScore = score;
+            }
+        }
+        return best == -1 ? fallback : best;
+    }
+
+    CategoryType classify(const string& description, CategoryType fallback = OTHER) {
+        if (!compiled) compile();
+
+        int state = 0;
+        int best = -1;
+        int bestLength = 0;
+        for (char c : description) {
+            state = nodes[state].next[symbol(c)];
+            if (nodes[state].matchLength > bestLength) {
+                best = nodes[state].category;
+                bestLength = nodes[state].matchLength;
+            }
+        }
+        if (best != -1) return best;
+
+        for (const auto& rule : regexRules) {
+            if (regex_search(description, rule.first)) return rule.second;
+        }
+
+        return classifyLearned(description, fallback);
+    }
+};
+
+struct UpcomingPayment {
+    Date dueDate;
+    string description;
+    double amount;
+    bool isInvestment;
+    bool isPredicted;   // forecast from a recurring pattern; never saved
+    
+    UpcomingPayment(const Date& date, const string& desc, double amt, bool inv = false)
+        : dueDate(date), description(desc), amount(amt), isInvestment(inv), isPredicted(false) {}
+};
+
+// Builds console output in memory so a whole page can be written with one
+// flush. Numbers and dates are formatted by hand instead of through iostream
+// manipulators; fields are right aligned like setw.
+struct OutputBuffer {
+    string data;
+
+    void append(const string& text) {
+        data += text;
+    }
+
+    void append(const char* text) {
+        data += text;
+    }
+
+    void append(char c) {
+        data += c;
+    }
+
+    void appendField(const char* text, size_t length, int width) {
+        if ((int)length < width) data.append(width - length, ' ');
+        data.append(text, length);
+    }
+
+    void appendField(const string& text, int width) {
+        appendField(text.data(), text.size(), width);
+    }
+
+    // Writes digits backwards from the end of buf and returns where they start
+    static char* formatUnsigned(unsigned long long value, char* end) {
+        do {
+            *--end = char('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        return end;
+    }
+
+    static size_t formatInt(long long value, char* buf) {
+        char digits[24];
+        char* end = digits + sizeof(digits);
+        unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+        char* start = formatUnsigned(magnitude, end);
+        if (value < 0) *--start = '-';
+        size_t length = end - start;
+        memcpy(buf, start, length);
+        return length;
+    }
+
+    static size_t formatFixed(double value, int precision, char* buf) {
+        static const double scales[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+        if (precision < 0 || precision > 6 || !(fabs(value) < 1e15)) {
+            return snprintf(buf, 48, "%.*f", precision, value);
+        }
+
+        bool negative = value < 0;
+        unsigned long long scaled = (unsigned long long)llround(fabs(value) * scales[precision]);
+        unsigned long long whole = scaled / (unsigned long long)scales[precision];
+        unsigned long long fraction = scaled % (unsigned long long)scales[precision];
+
+        char digits[48];
+        char* end = digits + sizeof(digits);
+        char* start = end;
+        for (int i = 0; i < precision; i++) {
+            *--start = char('0' + fraction % 10);
+            fraction /= 10;
+        }
+        if (precision > 0) *--start = '.';
+        start = formatUnsigned(whole, start);
+        if (negative && scaled != 0) *--start = '-';
+
+        size_t length = end - start;
+        memcpy(buf, start, length);
+        return length;
+    }
+
+    void appendInt(long long value, int width = 0) {
+        char buf[24];
+        appendField(buf, formatInt(value, buf), width);
+    }
+
+    void appendFixed(double value, int precision = 2, int width = 0) {
+        char buf[48];
+        appendField(buf, formatFixed(value, precision, buf), width);
+    }
+
+    // Same d/m/yyyy layout as Date::toString
+    void appendDate(const Date& date, int width = 0) {
+        char buf[48];
+        size_t length = formatInt(date.day, buf);
+        buf[length++] = '/';
+        length += formatInt(date.month, buf + length);
+        buf[length++] = '/';
+        length += formatInt(date.year, buf + length);
+        appendField(buf, length, width);
+    }
+
+    void newline() {
+        data += '\n';
+    }
+
+    void flush(ostream& os) {
+        os.write(data.data(), data.size());
+        os.flush();
+        data.clear();
+    }
+};
+
+// Shows a long listing one page at a time. Rows are produced on demand from
+// the cursor position, so only the visible page is ever formatted.
+struct Pager {
+    size_t pageSize;
+
+    Pager(size_t size = 50) : pageSize(size) {}
+
+    template <class RowFormatter>
+    void show(const string& header, size_t rowCount, RowFormatter formatRow) {
+        size_t cursor = 0;
+        while (true) {
+            OutputBuffer out;
+            out.append(header);
+            size_t end = min(cursor + pageSize, rowCount);
+            for (size_t row = cursor; row < end; row++) {
+                formatRow(row, out);
+            }
+
+            if (rowCount <= pageSize) {
+                out.flush(cout);
+                return;
+            }
+
+            out.append("\nRows ");
+            out.appendInt(cursor + 1);
+            out.append('-');
+            out.appendInt(end);
+            out.append(" of ");
+            out.appendInt(rowCount);
+            out.append(". [n]ext, [p]revious, [q]uit: ");
+            out.flush(cout);
+
+            string command;
+            if (!(cin >> command) || command[0] == 'q' || command[0] == 'Q') {
+                return;
+            }
+            if (command[0] == 'p' || command[0] == 'P') {
+                cursor = cursor >= pageSize ? cursor - pageSize : 0;
+            } else if (end >= rowCount) {
+                return;
+            } else {
+                cursor = end;
+            }
+        }
+    }
+};
+
+struct Transaction {
+    double amount;
+    string description;
+    Date date;
+    CategoryType category;
+    string type;
+    int currency;   // id in currencies(), 0 for the base currency
+    unsigned descriptionId;   // set when the manager starts tracking the row
+    unsigned long long recordId;   // stable id across synced replicas, 0 until sync is enabled
+    bool autoCategorized;   // category was guessed by the categorizer, not chosen
+    
+    Transaction(double amt, const string &des, CategoryType cat = OTHER, string t = "Transaction") {
+        amount = amt;
+        description = des;
+        date = Date();
+        category = cat;
+        type = t;
+        currency = 0;
+        descriptionId = 0;
+        recordId = 0;
+        autoCategorized = false;
+    }
+    
+    // date is initialized directly; default-constructing it first would query the clock
+    Transaction(double amt, const string &des, const Date& dt, CategoryType cat = OTHER, string t = "Transaction")
+        : amount(amt), description(des), date(dt), category(cat), type(t), currency(0), descriptionId(0), recordId(0),
+          autoCategorized(false) {}
+
+    void format(OutputBuffer& out) const {
+        out.appendField(type, 15);
+        out.appendDate(date, 12);
+        if (currency) {
+            out.appendFixed(amount, 2, 11);
+            out.appendField(currencies().code(currency), 4);
+        } else {
+            out.appendFixed(amount, 2, 15);
+        }
+        out.appendField(categoryToString(category), 15);
+        out.appendField(description, 20);
+        out.newline();
+    }
+
+    void display() {
+        OutputBuffer out;
+        format(out);
+        out.flush(cout);
+    }
+
+    static string header(bool withIndex = false) {
+        OutputBuffer out;
+        if (withIndex) out.appendField("Index", 5);
+        out.appendField("Type", 15);
+        out.appendField("Date", 12);
+        out.appendField("Amount", 15);
+        out.appendField("Category", 15);
+        out.appendField("Description", 20);
+        out.newline();
+        out.append(string(withIndex ? 82 : 77, '-'));
+        out.newline();
+        return out.data;
+    }
+};
+
+struct Income : Transaction {
+    Income(double amt, const string& des, CategoryType cat = INCOME) 
+        : Transaction(amt, des, cat, "Income") {}
+    
+    Income(double amt, const string& des, const Date& dt, CategoryType cat = INCOME) 
+        : Transaction(amt, des, dt, cat, "Income") {}
+};
+
+struct Expenditure : Transaction {
+    Expenditure(double amt, const string &des, CategoryType cat = UNCATEGORIZED) 
+        : Transaction(amt, des, cat, "Expenditure") {}
+    
+    Expenditure(double amt, const string &des, const Date& dt, CategoryType cat = UNCATEGORIZED) 
+        : Transaction(amt, des, dt, cat, "Expenditure") {}
+};
+
+// Compile-time rate table: an annual rate in basis points, compounded
+// PERIODS times a year
+template <int BASIS_POINTS, int PERIODS>
+struct CompoundRate {
+    static constexpr double ANNUAL = BASIS_POINTS / 10000.0;
+    static constexpr double PER_PERIOD = ANNUAL / PERIODS;
+
+    static double grow(double amount, double years) {
+        return amount * pow(1 + PER_PERIOD, PERIODS * years);
+    }
+};
+
+// Investment products are plain value types with their rates fixed at compile
+// time. A product holds only the fields it needs; adding one means adding an
+// alternative to InvestmentProduct and a branch to productIndex.
+struct FD {
+    typedef CompoundRate<710, 1> Rate;
+    static constexpr const char* NAME = "FD";
+
+    double maturity(double amount, int years) const {
+        return Rate::grow(amount, years);
+    }
+};
+
+struct SIP {
+    typedef CompoundRate<960, 12> Rate;
+    static constexpr const char* NAME = "SIP";
+
+    double monthly;
+
+    // Monthly contributions are added at face value
+    double maturity(double amount, int years) const {
+        return Rate::grow(amount, years) + monthly * 12 * years;
+    }
+};
+
+typedef variant<FD, SIP> InvestmentProduct;
+
+// Alternative index for a product name, or -1
+inline int productIndex(const string& name) {
+    if (name == FD::NAME) return 0;
+    if (name == SIP::NAME) return 1;
+    return -1;
+}
+
+struct Investment {
+    double amount;
+    int duration;
+    Date startDate;
+    int currency;   // id in currencies(), 0 for the base currency
+    InvestmentProduct product;
+    unsigned long long recordId;   // as for transactions
+    
+    Investment(double amt, int dur, const InvestmentProduct& p)
+        : amount(amt), duration(dur), startDate(), currency(0), product(p), recordId(0) {}
+    
+    Investment(double amt, int dur, const Date& dt, const InvestmentProduct& p)
+        : amount(amt), duration(dur), startDate(dt), currency(0), product(p), recordId(0) {}
+
+    const char* type() const {
+        return visit([](const auto& p) { return p.NAME; }, product);
+    }
+
+    // Only SIPs have a monthly amount
+    double monthly() const {
+        const SIP* sip = get_if<SIP>(&product);
+        return sip ? sip->monthly : 0.0;
+    }
+
+    // Day number of the day the investment matures; 29 February moves to the 28th
+    int maturityDay() const {
+        int year = startDate.year + duration;
+        return Date(min(startDate.day, Date::daysInMonth(startDate.month, year)), startDate.month, year).dayNumber();
+    }
+
+    double maturityAmount() const {
+        return visit([this](const auto& p) { return p.maturity(amount, duration); }, product);
+    }
+
+    // Interest earned on the amount invested between two day numbers, spread
+    // smoothly between compounding dates. SIP contributions earn nothing, as
+    // in maturity().
+    double interestBetween(int fromDay, int toDay) const {
+        int start = startDate.dayNumber();
+        int end = maturityDay();
+        fromDay = max(fromDay, start);
+        toDay = min(toDay, end);
+        if (toDay <= fromDay) return 0.0;
+        double yearsPerDay = (double)duration / (end - start);
+        return visit([&](const auto& p) {
+            typedef typename decay_t<decltype(p)>::Rate Rate;
+            return Rate::grow(amount, (toDay - start) * yearsPerDay) - Rate::grow(amount, (fromDay - start) * yearsPerDay);
+        }, product);
+    }
+
+    void format(OutputBuffer& out) const {
+        const char* name = type();
+        out.appendField(name, strlen(name), 15);
+        if (currency) {
+            out.appendFixed(amount, 2, 11);
+            out.appendField(currencies().code(currency), 4);
+        } else {
+            out.appendFixed(amount, 2, 15);
+        }
+        out.appendInt(duration, 15);
+        out.appendDate(startDate, 15);
+        if (const SIP* sip = get_if<SIP>(&product)) {
+            out.appendFixed(sip->monthly, 2, 20);
+        }
+        out.newline();
+    }
+
+    void display() const {
+        OutputBuffer out;
+        format(out);
+        out.flush(cout);
+    }
+
+    static string header(bool withIndex = false) {
+        OutputBuffer out;
+        if (withIndex) out.appendField("Index", 5);
+        out.appendField("Type", 15);
+        out.appendField("Amount", 15);
+        out.appendField("Duration", 15);
+        out.appendField("Start Date", 15);
+        out.appendField("Monthly amount", 20);
+        out.newline();
+        out.append(string(withIndex ? 85 : 80, '-'));
+        out.newline();
+        return out.data;
+    }
+};
+
+// Daily totals stored in a Fenwick tree, so the sum over any span of days is
+// O(log n) and a back-dated value is an O(log n) update. The covered span
+// grows on demand around the days actually used.
+struct FenwickSeries {
+    int base;             // day number of slot 0
+    vector<double> tree;  // 1-based
+
+    FenwickSeries() : base(0) {}
+
+    size_t capacity() const {
+        return tree.empty() ? 0 : tree.size() - 1;
+    }
+
+    void clear() {
+        tree.clear();
+        base = 0;
+    }
+
+    void grow(int day) {
+        if (tree.empty()) {
+            base = day - 32;
+            tree.assign(257, 0.0);
+            return;
+        }
+
+        int end = base + (int)capacity();
+        int newBase = min(base, day - (int)capacity() / 2);
+        int newEnd = max(end, day + (int)capacity() / 2 + 1);
+
+        // Unroll the tree back into plain daily values, shift them, rebuild
+        vector<double> raw(tree);
+        for (size_t i = capacity(); i >= 1; i--) {
+            size_t parent = i + (i & (0 - i));
+            if (parent <= capacity()) raw[parent] -= raw[i];
+        }
+
+        vector<double> rebuilt(newEnd - newBase + 1, 0.0);
+        for (size_t i = 1; i <= capacity(); i++) {
+            rebuilt[base - newBase + i] = raw[i];
+        }
+        size_t size = rebuilt.size() - 1;
+        for (size_t i = 1; i <= size; i++) {
+            size_t parent = i + (i & (0 - i));
+            if (parent <= size) rebuilt[parent] += rebuilt[i];
+        }
+
+        tree.swap(rebuilt);
+        base = newBase;
+    }
+
+    void add(int day, double value) {
+        if (tree.empty() || day < base || day >= base + (int)capacity()) {
+            grow(day);
+        }
+        for (size_t i = day - base + 1; i <= capacity(); i += i & (0 - i)) {
+            tree[i] += value;
+        }
+    }
+
+    // Sum of every day up to and including `day`
+    double prefix(int day) const {
+        if (tree.empty() || day < base) return 0.0;
+        size_t i = min((size_t)(day - base + 1), capacity());
+        double sum = 0.0;
+        for (; i > 0; i -= i & (0 - i)) {
+            sum += tree[i];
+        }
+        return sum;
+    }
+
+    double range(int from, int to) const {
+        if (to < from) return 0.0;
+        return prefix(to) - prefix(from - 1);
+    }
+};
+
+// Income and expense totals per day, overall and per category, kept up to
+// date as transactions come and go. Weekly, monthly and rolling-window
+// figures are range sums over the daily series.
+struct SpendingAnalytics {
+    FenwickSeries income;
+    FenwickSeries expense;
+    vector<FenwickSeries> expenseByCategory;
+
+    void clear() {
+        income.clear();
+        expense.clear();
+        expenseByCategory.clear();
+    }
+
+    // sign is +1 when a transaction is added and -1 when it is removed, times
+    // the rate that converts its amount to the base currency
+    void record(const Transaction& t, double sign) {
+        int day = t.date.dayNumber();
+        if (t.type == "Income") {
+            income.add(day, sign * t.amount);
+        } else if (t.type == "Expenditure") {
+            expense.add(day, sign * t.amount);
+            if (t.category >= 0) {
+                if (t.category >= (int)expenseByCategory.size()) expenseByCategory.resize(t.category + 1);
+                expenseByCategory[t.category].add(day, sign * t.amount);
+            }
+        }
+    }
+
+    // category -1 means all expenses; a category includes its sub-categories
+    double expenseBetween(int fromDay, int toDay, int category = -1) const {
+        if (category < 0) return expense.range(fromDay, toDay);
+
+        double sum = 0.0;
+        for (int id : categories().subtree(category)) {
+            if (id < (int)expenseByCategory.size()) sum += expenseByCategory[id].range(fromDay, toDay);
+        }
+        return sum;
+    }
+
+    double incomeBetween(int fromDay, int toDay) const {
+        return income.range(fromDay, toDay);
+    }
+
+    double rollingExpense(const Date& end, int windowDays, int category = -1) const {
+        int last = end.dayNumber();
+        return expenseBetween(last - windowDays + 1, last, category);
+    }
+
+    double rollingIncome(const Date& end, int windowDays) const {
+        int last = end.dayNumber();
+        return incomeBetween(last - windowDays + 1, last);
+    }
+
+    double rollingExpenseAverage(const Date& end, int windowDays, int category = -1) const {
+        return windowDays > 0 ? rollingExpense(end, windowDays, category) / windowDays : 0.0;
+    }
+
+    double monthlyExpense(int month, int year, int category = -1) const {
+        return expenseBetween(Date(1, month, year).dayNumber(), Date(Date::daysInMonth(month, year), month, year).dayNumber(), category);
+    }
+
+    double monthlyIncome(int month, int year) const {
+        return incomeBetween(Date(1, month, year).dayNumber(), Date(Date::daysInMonth(month, year), month, year).dayNumber());
+    }
+
+    // Monday-to-Sunday week containing `date`
+    double weeklyExpense(const Date& date, int category = -1) const {
+        int day = date.dayNumber();
+        int monday = day - date.weekday();
+        return expenseBetween(monday, monday + 6, category);
+    }
+
+    double expenseYearOverYear(int month, int year, int category = -1) const {
+        return monthlyExpense(month, year, category) - monthlyExpense(month, year - 1, category);
+    }
+
+    double incomeYearOverYear(int month, int year) const {
+        return monthlyIncome(month, year) - monthlyIncome(month, year - 1);
+    }
+};
+
+// Mergeable sketch of a distribution (Dunning's t-digest). Values are
+// clustered into centroids that are small near both tails and large in the
+// middle, so extreme quantiles stay accurate with a few hundred centroids
+// however many values were added.
+struct TDigest {
+    static const int COMPRESSION = 100;
+
+    struct Centroid {
+        double mean;
+        double weight;
+    };
+
+    vector<Centroid> centroids;   // sorted by mean
+    vector<Centroid> buffer;      // added since the last compress
+    double total;
+    double minValue, maxValue;
+
+    TDigest() : total(0), minValue(0), maxValue(0) {}
+
+    void add(double value, double weight = 1) {
+        if (total == 0 || value < minValue) minValue = value;
+        if (total == 0 || value > maxValue) maxValue = value;
+        buffer.push_back({value, weight});
+        total += weight;
+        if (buffer.size() >= 4 * COMPRESSION) compress();
+    }
+
+    void merge(const TDigest& other) {
+        if (other.total == 0) return;
+        if (total == 0 || other.minValue < minValue) minValue = other.minValue;
+        if (total == 0 || other.maxValue > maxValue) maxValue = other.maxValue;
+        buffer.insert(buffer.end(), other.centroids.begin(), other.centroids.end());
+        buffer.insert(buffer.end(), other.buffer.begin(), other.buffer.end());
+        total += other.total;
+        if (buffer.size() >= 4 * COMPRESSION) compress();
+    }
+
+    // A centroid at quantile q may hold up to 4 * total * q * (1 - q) / COMPRESSION values
+    void compress() {
+        if (buffer.empty()) return;
+        buffer.insert(buffer.end(), centroids.begin(), centroids.end());
+        sort(buffer.begin(), buffer.end(), [](const Centroid& a, const Centroid& b) { return a.mean < b.mean; });
+        centroids.clear();
+        Centroid current = buffer[0];
+        double before = 0;
+        for (size_t i = 1; i < buffer.size(); i++) {
+            const Centroid& next = buffer[i];
+            double weight = current.weight + next.weight;
+            double q = (before + weight / 2) / total;
+            if (weight <= 4 * total * q * (1 - q) / COMPRESSION) {
+                current.mean += (next.mean - current.mean) * next.weight / weight;
+                current.weight = weight;
+            } else {
+                centroids.push_back(current);
+                before += current.weight;
+                current = next;
+            }
+        }
+        centroids.push_back(current);
+        buffer.clear();
+    }
+
+    // Interpolates between centroid centres, and towards the exact minimum
+    // and maximum beyond the outermost ones
+    double quantile(double q) {
+        compress();
+        if (centroids.empty()) return 0;
+        q = min(max(q, 0.0), 1.0);
+        double rank = q * total;
+        double center = centroids[0].weight / 2;
+        if (rank <= center) {
+            return minValue + (centroids[0].mean - minValue) * (center > 0 ? rank / center : 0);
+        }
+        for (size_t i = 0; i + 1 < centroids.size(); i++) {
+            double nextCenter = center + (centroids[i].weight + centroids[i + 1].weight) / 2;
+            if (rank <= nextCenter) {
+                double t = (rank - center) / (nextCenter - center);
+                return centroids[i].mean + (centroids[i + 1].mean - centroids[i].mean) * t;
+            }
+            center = nextCenter;
+        }
+        double tail = total - center;
+        const Centroid& last = centroids.back();
+        return last.mean + (maxValue - last.mean) * (tail > 0 ? (rank - center) / tail : 1);
+    }
+};
+
+// One t-digest of expense amounts per month and category, so approximate
+// quantiles over any run of months are a merge of a few small digests. A
+// digest cannot forget a value, so removing an expense marks its digest
+// stale and it is rebuilt from the ledger the next time it is read.
+struct ExpenseDigests {
+    struct Cell {
+        TDigest digest;
+        bool stale;
+
+        Cell() : stale(false) {}
+    };
+
+    map<long long, Cell> cells;   // by month index, then category
+
+    static int monthIndex(const Date& date) {
+        return date.year * 12 + date.month - 1;
+    }
+
+    static long long keyFor(int month, int category) {
+        return ((long long)month << 20) | category;
+    }
+
+    void clear() {
+        cells.clear();
+    }
+
+    // A stale digest is rebuilt later from the ledger, which already holds the row
+    void record(const Transaction& t, double amount) {
+        if (t.type != "Expenditure" || t.category < 0) return;
+        Cell& cell = cells[keyFor(monthIndex(t.date), t.category)];
+        if (!cell.stale) cell.digest.add(amount);
+    }
+
+    void forget(const Transaction& t) {
+        if (t.type != "Expenditure" || t.category < 0) return;
+        auto found = cells.find(keyFor(monthIndex(t.date), t.category));
+        if (found != cells.end()) found->second.stale = true;
+    }
+
+    // Merged digest of months [fromMonth, toMonth] for a category and its
+    // sub-categories, or for everything when category is -1.
+    // rebuild(month, category, digest) refills a stale digest.
+    template <class Rebuild>
+    TDigest merged(int fromMonth, int toMonth, int category, Rebuild rebuild) {
+        vector<char> included;
+        if (category != -1) {
+            for (int id : categories().subtree(category)) {
+                if (id >= (int)included.size()) included.resize(id + 1, 0);
+                included[id] = 1;
+            }
+        }
+        TDigest result;
+        for (auto it = cells.lower_bound(keyFor(fromMonth, 0)); it != cells.end() && (it->first >> 20) <= toMonth; ++it) {
+            int month = (int)(it->first >> 20);
+            int cellCategory = (int)(it->first & 0xfffff);
+            if (category != -1 && (cellCategory >= (int)included.size() || !included[cellCategory])) continue;
+            Cell& cell = it->second;
+            if (cell.stale) {
+                cell.digest = TDigest();
+                rebuild(month, cellCategory, cell.digest);
+                cell.stale = false;
+            }
+            result.merge(cell.digest);
+        }
+        return result;
+    }
+};
+
+enum BudgetPeriod {
+    WEEKLY,
+    MONTHLY,
+    YEARLY
+};
+
+struct Budget {
+    int category;                // -1 for all spending; a category includes its sub-categories
+    BudgetPeriod period;
+    double limit;
+    vector<double> thresholds;   // ascending fractions of the limit, e.g. 0.8 and 1.0
+};
+
+struct BudgetAlert {
+    int budget;
+    int period;                  // period index, see BudgetEngine::periodOf
+    double threshold;
+    double spent;
+    double limit;
+};
+
+// Spending against every budget, kept as a running total per (budget, period)
+// so each expense costs one hash update per budget covering its category and
+// nothing is rescanned. Crossing a threshold queues an alert, and calls
+// onAlert if set, once per budget, period and threshold.
+struct BudgetEngine {
+    struct Total {
+        double spent;
+        size_t alerted;          // thresholds already reported this period
+    };
+
+    vector<Budget> budgets;
+    vector<unordered_map<int, Total>> totals;   // by budget, then period index
+    vector<vector<int>> covering;               // budgets that count each category
+    deque<BudgetAlert> alerts;
+    function<void(const BudgetAlert&)> onAlert;
+    bool silent;                                // set while replaying history
+
+    BudgetEngine() : silent(false) {}
+
+    // Weeks start on Monday; months and years are calendar ones
+    static int periodOf(BudgetPeriod period, const Date& date) {
+        if (period == WEEKLY) return (date.dayNumber() - date.weekday() + 3) / 7;
+        if (period == MONTHLY) return date.year * 12 + date.month - 1;
+        return date.year;
+    }
+
+    static Date periodStart(BudgetPeriod period, int index) {
+        if (period == WEEKLY) return Date::fromDayNumber(index * 7 - 3);
+        if (period == MONTHLY) return Date(1, index % 12 + 1, index / 12);
+        return Date(1, 1, index);
+    }
+
+    static const char* periodName(BudgetPeriod period) {
+        return period == WEEKLY ? "Weekly" : (period == MONTHLY ? "Monthly" : "Yearly");
+    }
+
+    void add(const Budget& budget) {
+        budgets.push_back(budget);
+        sort(budgets.back().thresholds.begin(), budgets.back().thresholds.end());
+        totals.emplace_back();
+        covering.clear();
+    }
+
+    void remove(size_t index) {
+        if (index >= budgets.size()) return;
+        budgets.erase(budgets.begin() + index);
+        totals.erase(totals.begin() + index);
+        covering.clear();
+    }
+
+    // Totals are rebuilt by replaying the ledger; the budgets stay
+    void clearTotals() {
+        for (auto& byPeriod : totals) byPeriod.clear();
+    }
+
+    // Only rebuilt when budgets change or new categories appear
+    const vector<int>& coveringFor(int category) {
+        const CategoryRegistry& registry = categories();
+        size_t count = registry.size();
+        if (covering.size() != count) {
+            covering.assign(count, vector<int>());
+            for (int b = 0; b < (int)budgets.size(); b++) {
+                if (budgets[b].category == -1) {
+                    for (auto& budgetIds : covering) budgetIds.push_back(b);
+                    continue;
+                }
+                for (int id : registry.subtree(budgets[b].category)) {
+                    if (id < (int)count) covering[id].push_back(b);
+                }
+            }
+        }
+        static const vector<int> none;
+        return category >= 0 && category < (int)covering.size() ? covering[category] : none;
+    }
+
+    // amount is in the base currency and negative when an expense is removed
+    void record(const Transaction& t, double amount) {
+        if (t.type != "Expenditure" || budgets.empty()) {
+            return;
+        }
+        for (int b : coveringFor(t.category)) {
+            const Budget& budget = budgets[b];
+            int period = periodOf(budget.period, t.date);
+            Total& total = totals[b].emplace(period, Total{0.0, 0}).first->second;
+            total.spent += amount;
+            while (total.alerted < budget.thresholds.size() &&
+                   total.spent >= budget.thresholds[total.alerted] * budget.limit) {
+                // Replayed history counts as already reported
+                if (!silent) raise({b, period, budget.thresholds[total.alerted], total.spent, budget.limit});
+                total.alerted++;
+            }
+        }
+    }
+
+    void raise(const BudgetAlert& alert) {
+        alerts.push_back(alert);
+        if (onAlert) onAlert(alert);
+    }
+
+    double spent(size_t budget, const Date& date) const {
+        if (budget >= budgets.size()) return 0.0;
+        auto found = totals[budget].find(periodOf(budgets[budget].period, date));
+        return found == totals[budget].end() ? 0.0 : found->second.spent;
+    }
+
+    // Lines are "<W|M|Y> <limit> <threshold count> <thresholds...> <category or *>"
+    bool loadFromFile(const string& filename) {
+        ifstream file(filename);
+        if (!file.is_open()) {
+            return false;
+        }
+        string line;
+        while (getline(file, line)) {
+            istringstream in(line);
+            string period, categoryStr;
+            Budget budget;
+            size_t count;
+            if (!(in >> period >> budget.limit >> count)) continue;
+            budget.thresholds.resize(count);
+            for (auto& threshold : budget.thresholds) in >> threshold;
+            if (!(in >> categoryStr)) continue;
+            budget.period = period == "W" ? WEEKLY : (period == "Y" ? YEARLY : MONTHLY);
+            budget.category = categoryStr == "*" ? -1 : stringToCategory(categoryStr);
+            add(budget);
+        }
+        return true;
+    }
+
+    bool saveToFile(const string& filename) const {
+        ofstream file(filename);
+        if (!file.is_open()) {
+            return false;
+        }
+        file.precision(15);
+        for (const auto& budget : budgets) {
+            file << "WMY"[budget.period] << " " << budget.limit << " " << budget.thresholds.size();
+            for (double threshold : budget.thresholds) file << " " << threshold;
+            file << " " << (budget.category == -1 ? string("*") : categoryToString(budget.category)) << "\n";
+        }
+        return !file.fail();
+    }
+};
+
+enum AnomalyKind {
+    UNUSUAL_AMOUNT,
+    NEW_MERCHANT,
+    FREQUENCY_SPIKE
+};
+
+struct AnomalyFlag {
+    AnomalyKind kind;
+    string description;
+    Date date;
+    CategoryType category;
+    double amount;     // in the base currency
+    double typical;    // usual amount, or usual rows per day for a spike
+    double count;      // rows that day, for a spike
+    bool wholeCategory;   // a spike across the category rather than the merchant
+};
+
+// Running statistics of one stream of amounts, O(1) per value. The mean and
+// variance are exponentially weighted. The median and MAD are robust running
+// estimates: once warmed up, each value moves them by at most a few MADs, so
+// one outlier barely shifts what counts as typical.
+struct AmountStats {
+    static constexpr unsigned WARMUP = 5;
+
+    double mean, variance;
+    double median, mad;
+    unsigned count;
+
+    AmountStats() : mean(0), variance(0), median(0), mad(0), count(0) {}
+
+    void add(double x, double alpha) {
+        if (count++ == 0) {
+            mean = median = x;
+            return;
+        }
+        double diff = x - mean;
+        double step = alpha * diff;
+        mean += step;
+        variance = (1 - alpha) * (variance + diff * step);
+
+        double rate = max(alpha, 1.0 / count);
+        double limit = count <= WARMUP ? HUGE_VAL : 3 * scale();
+        median += rate * max(-limit, min(x - median, limit));
+        mad += rate * (min(fabs(x - median), limit) - mad);
+    }
+
+    // Robust standard deviation, at least 5% of the median so a stream of
+    // identical amounts does not flag every small price change
+    double scale() const {
+        return max(1.4826 * mad, max(0.05 * fabs(median), 0.01));
+    }
+
+    double robustScore(double x) const {
+        return (x - median) / scale();
+    }
+
+    double ewmaScore(double x) const {
+        return variance > 0 ? (x - mean) / sqrt(variance) : HUGE_VAL;
+    }
+};
+
+// How many rows a stream has on the days it has any: an exponentially
+// weighted count per active day, and the count so far on the latest day.
+// Rows dated before the latest day count towards nothing.
+struct RateStats {
+    int lastDay;
+    unsigned today;
+    unsigned days;
+    double perDay;
+
+    RateStats() : lastDay(0), today(0), days(0), perDay(1) {}
+
+    // Rows on the stream's latest day, or 0 for an older row
+    unsigned add(int day, double alpha) {
+        if (days == 0 || day > lastDay) {
+            if (days > 1) perDay += alpha * (today - perDay);
+            else if (days == 1) perDay = today;
+            days++;
+            lastDay = day;
+            today = 1;
+            return 1;
+        }
+        return day == lastDay ? ++today : 0;
+    }
+};
+
+// Watches expenses as they are recorded and queues a flag for an amount far
+// above what its merchant (or, for a merchant with little history, its
+// category) usually charges, for a first charge from a merchant well above
+// its category's usual amounts, and for a merchant or category with far more
+// rows in a day than usual. Statistics are kept per description id and per
+// category in flat vectors, so an insert costs two lookups and a few
+// arithmetic operations. Only new rows are observed, and replayed history
+// trains silently.
+struct AnomalyDetector {
+    struct Stream {
+        AmountStats amounts;
+        RateStats rate;
+    };
+
+    static constexpr double ALPHA = 0.05;              // weight of the newest value, about the last 20
+    static constexpr unsigned MIN_HISTORY = 10;        // rows before a stream's amounts are trusted
+    static constexpr double AMOUNT_SCORE = 6.0;        // robust deviations above the median
+    static constexpr double EWMA_SCORE = 3.0;          // and standard deviations above the mean
+    static constexpr double NEW_MERCHANT_SCORE = 3.0;  // against the category, for a first charge
+    static constexpr double NEW_MERCHANT_RATIO = 2.0;  // and at least this multiple of its median
+    static constexpr unsigned SPIKE_MIN_ROWS = 3;
+    static constexpr double SPIKE_FACTOR = 3.0;        // times the usual rows per active day
+    static constexpr unsigned SPIKE_MIN_DAYS = 5;
+    static constexpr size_t MAX_FLAGS = 1000;          // oldest flags are dropped past this
+
+    vector<Stream> byDescription;   // by description id
+    vector<Stream> byCategory;      // by category id
+    Stream expenses;                // every expense, for categories without history
+    deque<AnomalyFlag> flags;
+    function<void(const AnomalyFlag&)> onFlag;
+    bool silent;                    // set while replaying history
+
+    AnomalyDetector() : silent(false) {}
+
+    void clear() {
+        byDescription.clear();
+        byCategory.clear();
+        expenses = Stream();
+    }
+
+    static Stream& streamFor(vector<Stream>& streams, size_t id) {
+        if (id >= streams.size()) streams.resize(id + 1);
+        return streams[id];
+    }
+
+    // amount is in the base currency
+    void observe(const Transaction& t, unsigned descriptionId, double amount) {
+        if (t.type != "Expenditure" || amount <= 0) {
+            return;
+        }
+        Stream& merchant = streamFor(byDescription, descriptionId);
+        Stream& category = streamFor(byCategory, t.category < 0 ? OTHER : t.category);
+        int day = t.date.dayNumber();
+
+        if (!silent) {
+            const Stream& reference = category.amounts.count >= MIN_HISTORY ? category : expenses;
+            if (merchant.amounts.count >= MIN_HISTORY) {
+                checkAmount(t, amount, merchant.amounts);
+            } else if (merchant.amounts.count == 0) {
+                const AmountStats& usual = reference.amounts;
+                if (usual.count >= MIN_HISTORY && usual.robustScore(amount) >= NEW_MERCHANT_SCORE &&
+                    amount >= NEW_MERCHANT_RATIO * usual.median) {
+                    raise({NEW_MERCHANT, t.description, t.date, t.category, amount, usual.median, 1, false});
+                }
+            } else {
+                checkAmount(t, amount, reference.amounts);
+            }
+        }
+
+        merchant.amounts.add(amount, ALPHA);
+        category.amounts.add(amount, ALPHA);
+        expenses.amounts.add(amount, ALPHA);
+        checkRate(t, amount, merchant.rate, merchant.rate.add(day, ALPHA), false);
+        checkRate(t, amount, category.rate, category.rate.add(day, ALPHA), true);
+    }
+
+    void checkAmount(const Transaction& t, double amount, const AmountStats& usual) {
+        if (usual.count >= MIN_HISTORY && usual.robustScore(amount) >= AMOUNT_SCORE &&
+            usual.ewmaScore(amount) >= EWMA_SCORE) {
+            raise({UNUSUAL_AMOUNT, t.description, t.date, t.category, amount, usual.median, 1, false});
+        }
+    }
+
+    // Flags once, on the row that reaches the day's limit
+    void checkRate(const Transaction& t, double amount, const RateStats& rate, unsigned today, bool wholeCategory) {
+        if (silent || rate.days < SPIKE_MIN_DAYS) return;
+        unsigned limit = max(SPIKE_MIN_ROWS, (unsigned)ceil(SPIKE_FACTOR * rate.perDay));
+        if (today == limit) {
+            raise({FREQUENCY_SPIKE, t.description, t.date, t.category, amount, rate.perDay, (double)today, wholeCategory});
+        }
+    }
+
+    void raise(const AnomalyFlag& flag) {
+        flags.push_back(flag);
+        if (flags.size() > MAX_FLAGS) flags.pop_front();
+        if (onFlag) onFlag(flag);
+    }
+};
+
+// Finds transactions that repeat weekly, monthly or yearly. Rows are grouped
+// by interned description, direction and an amount band about 10% wide
+// through one hash lookup, and each group keeps only its latest dates, so an
+// insert is O(1) and a whole ledger is a single streaming pass.
+struct RecurrenceDetector {
+    static const int HISTORY = 12;
+
+    struct Pattern {
+        unsigned descriptionId;
+        bool income;
+        bool recurring;
+        unsigned char matches[3];   // gaps that fit each BudgetPeriod
+        int count;
+        int days[HISTORY];          // latest dates, oldest first
+        float amounts[HISTORY];
+        BudgetPeriod period;
+    };
+
+    vector<Pattern> patterns;
+    unordered_map<unsigned long long, unsigned> byKey;
+
+    void clear() {
+        patterns.clear();
+        byKey.clear();
+    }
+
+    static unsigned long long keyFor(unsigned descriptionId, bool income, double amount) {
+        // Neighbouring bands are 10% apart, so small price changes stay in one group
+        long long band = amount > 0.01 ? (long long)floor(log(amount) / log(1.1)) + 1000 : 0;
+        return ((unsigned long long)descriptionId << 32) | ((unsigned long long)band << 1) | (income ? 1 : 0);
+    }
+
+    void add(unsigned descriptionId, bool income, int day, double amount) {
+        unsigned long long key = keyFor(descriptionId, income, amount);
+        auto found = byKey.find(key);
+        if (found == byKey.end()) {
+            found = byKey.emplace(key, (unsigned)patterns.size()).first;
+            Pattern pattern;
+            pattern.descriptionId = descriptionId;
+            pattern.income = income;
+            pattern.recurring = false;
+            pattern.matches[0] = pattern.matches[1] = pattern.matches[2] = 0;
+            pattern.count = 0;
+            pattern.period = MONTHLY;
+            patterns.push_back(pattern);
+        }
+        Pattern& p = patterns[found->second];
+        if (p.count == HISTORY) {
+            if (day <= p.days[0]) return;
+            // Forget the oldest date to make room
+            countGap(p, p.days[1] - p.days[0], -1);
+            memmove(p.days, p.days + 1, (HISTORY - 1) * sizeof(int));
+            memmove(p.amounts, p.amounts + 1, (HISTORY - 1) * sizeof(float));
+            p.count--;
+        }
+        int at = p.count;
+        while (at > 0 && p.days[at - 1] > day) {
+            p.days[at] = p.days[at - 1];
+            p.amounts[at] = p.amounts[at - 1];
+            at--;
+        }
+        p.days[at] = day;
+        p.amounts[at] = (float)amount;
+        p.count++;
+        // Rows mostly arrive in date order, adding one gap at the end
+        if (at == p.count - 1) {
+            if (at > 0) countGap(p, day - p.days[at - 1], 1);
+        } else {
+            recount(p);
+        }
+        classify(p);
+    }
+
+    void remove(unsigned descriptionId, bool income, int day, double amount) {
+        auto found = byKey.find(keyFor(descriptionId, income, amount));
+        if (found == byKey.end()) return;
+        Pattern& p = patterns[found->second];
+        for (int i = 0; i < p.count; i++) {
+            if (p.days[i] == day && p.amounts[i] == (float)amount) {
+                for (int j = i + 1; j < p.count; j++) {
+                    p.days[j - 1] = p.days[j];
+                    p.amounts[j - 1] = p.amounts[j];
+                }
+                p.count--;
+                recount(p);
+                classify(p);
+                return;
+            }
+        }
+    }
+
+    // Gap in days that each period allows, with some slack for weekends and short months
+    static void countGap(Pattern& p, int gap, int delta) {
+        if (gap >= 6 && gap <= 8) p.matches[WEEKLY] += delta;
+        else if (gap >= 27 && gap <= 34) p.matches[MONTHLY] += delta;
+        else if (gap >= 358 && gap <= 372) p.matches[YEARLY] += delta;
+    }
+
+    static void recount(Pattern& p) {
+        p.matches[0] = p.matches[1] = p.matches[2] = 0;
+        for (int i = 1; i < p.count; i++) {
+            countGap(p, p.days[i] - p.days[i - 1], 1);
+        }
+    }
+
+    // Recurring when three quarters of the gaps, and at least two, fit one period
+    static void classify(Pattern& p) {
+        int best = max(p.matches[WEEKLY], max(p.matches[MONTHLY], p.matches[YEARLY]));
+        p.period = best == p.matches[MONTHLY] ? MONTHLY : (best == p.matches[WEEKLY] ? WEEKLY : YEARLY);
+        p.recurring = best >= 2 && best * 4 >= (p.count - 1) * 3;
+    }
+
+    static Date nextDate(const Pattern& p) {
+        Date last = Date::fromDayNumber(p.days[p.count - 1]);
+        if (p.period == WEEKLY) return Date::fromDayNumber(p.days[p.count - 1] + 7);
+        if (p.period == YEARLY) return Date(min(last.day, Date::daysInMonth(last.month, last.year + 1)), last.month, last.year + 1);
+        int month = last.month % 12 + 1;
+        int year = last.year + (last.month == 12 ? 1 : 0);
+        return Date(min(last.day, Date::daysInMonth(month, year)), month, year);
+    }
+
+    // How late an occurrence may be before the pattern counts as stopped
+    static int graceDays(BudgetPeriod period) {
+        return period == WEEKLY ? 3 : (period == MONTHLY ? 7 : 14);
+    }
+};
+
+// Running balance by day. Each leaf holds one day's net change and every node
+// keeps its total plus the lowest running total reached inside it, so the
+// balance on a day, the lowest balance over a range and the first overdraft
+// are O(log days), and a back-dated change is a single O(log days) update.
+struct BalanceTimeline {
+    struct Node {
+        double sum;         // net change over the node's days
+        double minPrefix;   // lowest running total after any of its days
+    };
+
+    double opening;         // balance before the first recorded day
+    int base;               // day number of leaf 0
+    size_t leaves;          // power of two, 0 while empty
+    vector<Node> tree;      // 1-based; leaves start at index `leaves`
+
+    BalanceTimeline() : opening(0), base(0), leaves(0) {}
+
+    static Node combine(const Node& left, const Node& right) {
+        return {left.sum + right.sum, min(left.minPrefix, left.sum + right.minPrefix)};
+    }
+
+    // The opening balance is kept
+    void clear() {
+        tree.clear();
+        leaves = 0;
+        base = 0;
+    }
+
+    // Widens the range to include day, leaving room to grow mostly forwards
+    void cover(int day) {
+        if (leaves && day >= base && day < base + (int)leaves) return;
+        int first = leaves ? min(base, day) : day;
+        int last = leaves ? max(base + (int)leaves - 1, day) : day;
+        size_t span = last - first + 1;
+        size_t size = 64;
+        while (size < span * 2) size <<= 1;
+
+        int newBase = first - (int)(size - span) / 4;
+        vector<Node> grown(size * 2, Node{0, 0});
+        for (size_t i = 0; i < leaves; i++) {
+            grown[size + (base - newBase) + i] = tree[leaves + i];
+        }
+        for (size_t i = size - 1; i > 0; i--) {
+            grown[i] = combine(grown[2 * i], grown[2 * i + 1]);
+        }
+        tree.swap(grown);
+        leaves = size;
+        base = newBase;
+    }
+
+    void add(const Date& date, double delta) {
+        int day = date.dayNumber();
+        cover(day);
+        size_t i = leaves + (day - base);
+        tree[i].sum += delta;
+        tree[i].minPrefix = tree[i].sum;
+        for (i >>= 1; i > 0; i >>= 1) {
+            tree[i] = combine(tree[2 * i], tree[2 * i + 1]);
+        }
+    }
+
+    // Leaves first..last inclusive
+    Node query(size_t first, size_t last) const {
+        const double none = numeric_limits<double>::infinity();
+        Node left = {0, none}, right = {0, none};
+        for (size_t l = first + leaves, r = last + leaves + 1; l < r; l >>= 1, r >>= 1) {
+            if (l & 1) left = combine(left, tree[l++]);
+            if (r & 1) right = combine(tree[--r], right);
+        }
+        return combine(left, right);
+    }
+
+    double closingBalance() const {
+        return leaves ? opening + tree[1].sum : opening;
+    }
+
+    // Balance at the end of date
+    double balanceOn(const Date& date) const {
+        int day = date.dayNumber();
+        if (!leaves || day < base) return opening;
+        if (day >= base + (int)leaves) return closingBalance();
+        return opening + query(0, day - base).sum;
+    }
+
+    // Lowest end-of-day balance between from and to inclusive
+    double minBalance(const Date& from, const Date& to) const {
+        int first = from.dayNumber(), last = to.dayNumber();
+        if (first > last) swap(first, last);
+        if (!leaves) return opening;
+        double lowest = numeric_limits<double>::infinity();
+        if (first < base) lowest = opening;
+        if (last >= base + (int)leaves) lowest = min(lowest, closingBalance());
+        int l = max(first, base) - base;
+        int r = min(last, base + (int)leaves - 1) - base;
+        if (l <= r) {
+            double before = opening + (l > 0 ? query(0, l - 1).sum : 0);
+            lowest = min(lowest, before + query(l, r).minPrefix);
+        }
+        return lowest;
+    }
+
+    // First day on or after from that ends with a negative balance
+    bool firstOverdraft(const Date& from, Date& when) const {
+        int day = from.dayNumber();
+        if (!leaves || day >= base + (int)leaves) {
+            if (closingBalance() >= 0) return false;
+            when = from;
+            return true;
+        }
+        if (day < base) {
+            if (opening < 0) {
+                when = from;
+                return true;
+            }
+            day = base;
+        }
+        long found = findNegative(1, 0, leaves - 1, day - base, opening);
+        if (found < 0) return false;
+        when = Date::fromDayNumber(base + (int)found);
+        return true;
+    }
+
+    // Leftmost leaf at or after start whose running balance is negative;
+    // before is the balance going into leaf lo
+    long findNegative(size_t node, size_t lo, size_t hi, size_t start, double before) const {
+        if (hi < start) return -1;
+        if (lo >= start && before + tree[node].minPrefix >= 0) return -1;
+        if (lo == hi) return before + tree[node].sum < 0 ? (long)lo : -1;
+        size_t mid = (lo + hi) / 2;
+        long found = findNegative(2 * node, lo, mid, start, before);
+        if (found >= 0) return found;
+        return findNegative(2 * node + 1, mid + 1, hi, start, before + tree[2 * node].sum);
+    }
+};
+
+// Approximate substring matching with Myers' bit-parallel algorithm. Bit i
+// of each vector holds the score change at pattern row i, so one text
+// character is a dozen word operations however long the pattern. Patterns
+// longer than 64 characters are cut to their first 64. Case is ignored.
+struct FuzzyMatcher {
+    static const int MAX_LENGTH = 64;
+
+    uint64_t peq[256];   // bit i set where pattern[i] is the character
+    int length;
+
+    explicit FuzzyMatcher(const string& pattern) {
+        memset(peq, 0, sizeof(peq));
+        length = pattern.size() < MAX_LENGTH ? (int)pattern.size() : MAX_LENGTH;
+        for (int i = 0; i < length; i++) {
+            peq[(unsigned char)tolower((unsigned char)pattern[i])] |= 1ULL << i;
+        }
+        for (int c = 'A'; c <= 'Z'; c++) {
+            peq[c] = peq[tolower(c)];
+        }
+    }
+
+    // Fewest edits that turn the pattern into some substring of text, or
+    // maxDistance + 1 when that is more than maxDistance
+    int distance(const string& text, int maxDistance) const {
+        if (length == 0) return 0;
+        if ((int)text.size() < length - maxDistance) return maxDistance + 1;
+        uint64_t pv = ~0ULL, mv = 0;
+        uint64_t last = 1ULL << (length - 1);
+        int score = length, best = length;
+        for (unsigned char c : text) {
+            uint64_t eq = peq[c];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+            if (ph & last) score++;
+            else if (mh & last) score--;
+            // A match may start anywhere in the text, so row 0 never changes
+            ph <<= 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+            best = min(best, score);
+        }
+        return min(best, maxDistance + 1);
+    }
+
+    // How many typos a search for this many characters tolerates by default
+    static int defaultDistance(size_t length) {
+        return min<int>(3, (int)length / 4);
+    }
+};
+
+// A filter over transactions. Leaves test a single field and ALL_OF/ANY_OF
+// combine child filters, so criteria can be nested freely.
+struct TransactionFilter {
+    enum Kind { ALL_OF, ANY_OF, DATE_RANGE, AMOUNT_RANGE, CATEGORY_SET, TEXT, TYPE };
+
+    Kind kind;
+    vector<TransactionFilter> children;
+    int fromKey, toKey;
+    double minAmount, maxAmount;
+    vector<char> categoryMask;
+    string text;
+
+    TransactionFilter(Kind k = ALL_OF) : kind(k), fromKey(0), toKey(0), minAmount(0), maxAmount(0) {}
+
+    static TransactionFilter dateRange(const Date& from, const Date& to) {
+        TransactionFilter f(DATE_RANGE);
+        f.fromKey = from.key();
+        f.toKey = to.key();
+        return f;
+    }
+
+    static TransactionFilter amountRange(double minAmount, double maxAmount) {
+        TransactionFilter f(AMOUNT_RANGE);
+        f.minAmount = minAmount;
+        f.maxAmount = maxAmount;
+        return f;
+    }
+
+    // Sub-categories of every listed category match as well
+    static TransactionFilter inCategories(const vector<CategoryType>& list) {
+        TransactionFilter f(CATEGORY_SET);
+        for (CategoryType category : list) {
+            for (int id : categories().subtree(category)) {
+                if (id >= (int)f.categoryMask.size()) f.categoryMask.resize(id + 1, 0);
+                f.categoryMask[id] = 1;
+            }
+        }
+        return f;
+    }
+
+    static TransactionFilter textContains(const string& text) {
+        TransactionFilter f(TEXT);
+        f.text = text;
+        return f;
+    }
+
+    static TransactionFilter typeIs(const string& type) {
+        TransactionFilter f(TYPE);
+        f.text = type;
+        return f;
+    }
+
+    static TransactionFilter allOf(const vector<TransactionFilter>& filters) {
+        TransactionFilter f(ALL_OF);
+        f.children = filters;
+        return f;
+    }
+
+    static TransactionFilter anyOf(const vector<TransactionFilter>& filters) {
+        TransactionFilter f(ANY_OF);
+        f.children = filters;
+        return f;
+    }
+
+    bool matches(const Transaction* t) const {
+        switch (kind) {
+            case ALL_OF:
+                for (const auto& child : children) {
+                    if (!child.matches(t)) return false;
+                }
+                return true;
+            case ANY_OF:
+                for (const auto& child : children) {
+                    if (child.matches(t)) return true;
+                }
+                return false;
+            case DATE_RANGE: {
+                int key = t->date.key();
+                return key >= fromKey && key <= toKey;
+            }
+            case AMOUNT_RANGE:
+                return t->amount >= minAmount && t->amount <= maxAmount;
+            case CATEGORY_SET:
+                return t->category >= 0 && t->category < (int)categoryMask.size() && categoryMask[t->category];
+            case TEXT:
+                return t->description.find(text) != string::npos;
+            case TYPE:
+                return t->type == text;
+        }
+        return false;
+    }
+};
+
+// Secondary orderings of the ledger used by the query planner. Appends that
+// keep an ordering sorted are applied in place; anything else marks the index
+// dirty and it is rebuilt on the next query.
+struct TransactionIndex {
+    vector<Transaction*> byDate;
+    vector<Transaction*> byAmount;
+    vector<vector<Transaction*>> byCategory;
+    vector<vector<Transaction*>> byDescription;   // by description id
+    bool dirty;
+
+    TransactionIndex() : dirty(true) {}
+
+    void markDirty() {
+        dirty = true;
+    }
+
+    void insert(Transaction* t) {
+        if (dirty) return;
+        if (t->category < 0) {
+            dirty = true;
+            return;
+        }
+        if (!byDate.empty() && t->date.key() < byDate.back()->date.key()) {
+            dirty = true;
+            return;
+        }
+        if (!byAmount.empty() && t->amount < byAmount.back()->amount) {
+            dirty = true;
+            return;
+        }
+        byDate.push_back(t);
+        byAmount.push_back(t);
+        if (t->category >= (int)byCategory.size()) byCategory.resize(t->category + 1);
+        byCategory[t->category].push_back(t);
+        if (t->descriptionId >= byDescription.size()) byDescription.resize(t->descriptionId + 1);
+        byDescription[t->descriptionId].push_back(t);
+    }
+
+    void rebuild(const vector<Transaction*>& transactions) {
+        byDate = transactions;
+        stable_sort(byDate.begin(), byDate.end(),
+                    [](Transaction* a, Transaction* b) { return a->date.key() < b->date.key(); });
+        byAmount = transactions;
+        stable_sort(byAmount.begin(), byAmount.end(),
+                    [](Transaction* a, Transaction* b) { return a->amount < b->amount; });
+        byCategory.assign(categories().size(), vector<Transaction*>());
+        byDescription.clear();
+        for (auto t : transactions) {
+            if (t->descriptionId >= byDescription.size()) byDescription.resize(t->descriptionId + 1);
+            byDescription[t->descriptionId].push_back(t);
+            if (t->category < 0) continue;
+            if (t->category >= (int)byCategory.size()) byCategory.resize(t->category + 1);
+            byCategory[t->category].push_back(t);
+        }
+        dirty = false;
+    }
+};
+
+// Investment positions sorted by amount, by maturity day and by start day,
+// plus a max-maturity tree over the start order for "active on" queries.
+// Adding or updating one investment patches the sorted lists in place; a
+// delete shifts every later position, so it marks the index dirty and the
+// next query rebuilds it.
+struct InvestmentIndex {
+    vector<unsigned> byAmount;
+    vector<unsigned> byMaturity;
+    vector<unsigned> byStart;
+    vector<vector<unsigned>> byType;   // by product index
+    vector<int> startDays;             // parallel to byStart
+    vector<int> maxMaturity;           // implicit tree over byStart, leaves at [leaves, 2 * leaves)
+    size_t leaves;
+    bool treeDirty;
+    bool dirty;
+
+    InvestmentIndex() : leaves(0), treeDirty(true), dirty(true) {}
+
+    void markDirty() {
+        dirty = true;
+    }
+
+    template <class Key>
+    static void insertSorted(vector<unsigned>& list, unsigned position, Key key) {
+        auto at = upper_bound(list.begin(), list.end(), key(position),
+                              [&](double value, unsigned other) { return value < key(other); });
+        list.insert(at, position);
+    }
+
+    template <class Key>
+    static void eraseSorted(vector<unsigned>& list, unsigned position, Key key) {
+        auto at = lower_bound(list.begin(), list.end(), key(position),
+                              [&](unsigned other, double value) { return key(other) < value; });
+        while (at != list.end() && *at != position) ++at;
+        if (at != list.end()) list.erase(at);
+    }
+
+    void insert(const vector<Investment>& investments, unsigned position) {
+        if (dirty) return;
+        auto amount = [&](unsigned p) { return investments[p].amount; };
+        auto maturity = [&](unsigned p) { return (double)investments[p].maturityDay(); };
+        auto start = [&](unsigned p) { return (double)investments[p].startDate.dayNumber(); };
+        insertSorted(byAmount, position, amount);
+        insertSorted(byMaturity, position, maturity);
+        insertSorted(byStart, position, start);
+        size_t type = investments[position].product.index();
+        if (type >= byType.size()) byType.resize(type + 1);
+        byType[type].insert(upper_bound(byType[type].begin(), byType[type].end(), position), position);
+        treeDirty = true;
+    }
+
+    void erase(const vector<Investment>& investments, unsigned position) {
+        if (dirty) return;
+        auto amount = [&](unsigned p) { return investments[p].amount; };
+        auto maturity = [&](unsigned p) { return (double)investments[p].maturityDay(); };
+        auto start = [&](unsigned p) { return (double)investments[p].startDate.dayNumber(); };
+        eraseSorted(byAmount, position, amount);
+        eraseSorted(byMaturity, position, maturity);
+        eraseSorted(byStart, position, start);
+        vector<unsigned>& sameType = byType[investments[position].product.index()];
+        sameType.erase(lower_bound(sameType.begin(), sameType.end(), position));
+        treeDirty = true;
+    }
+
+    void rebuild(const vector<Investment>& investments) {
+        byAmount.resize(investments.size());
+        for (size_t i = 0; i < investments.size(); i++) byAmount[i] = i;
+        byMaturity = byStart = byAmount;
+        stable_sort(byAmount.begin(), byAmount.end(),
+                    [&](unsigned a, unsigned b) { return investments[a].amount < investments[b].amount; });
+        stable_sort(byMaturity.begin(), byMaturity.end(),
+                    [&](unsigned a, unsigned b) { return investments[a].maturityDay() < investments[b].maturityDay(); });
+        stable_sort(byStart.begin(), byStart.end(),
+                    [&](unsigned a, unsigned b) { return investments[a].startDate.dayNumber() < investments[b].startDate.dayNumber(); });
+        byType.assign(variant_size<InvestmentProduct>::value, vector<unsigned>());
+        for (size_t i = 0; i < investments.size(); i++) {
+            byType[investments[i].product.index()].push_back(i);
+        }
+        dirty = false;
+        treeDirty = true;
+    }
+
+    void buildTree(const vector<Investment>& investments) {
+        leaves = 1;
+        while (leaves < byStart.size()) leaves *= 2;
+        startDays.resize(byStart.size());
+        maxMaturity.assign(2 * leaves, INT_MIN);
+        for (size_t i = 0; i < byStart.size(); i++) {
+            startDays[i] = investments[byStart[i]].startDate.dayNumber();
+            maxMaturity[leaves + i] = investments[byStart[i]].maturityDay();
+        }
+        for (size_t node = leaves - 1; node >= 1; node--) {
+            maxMaturity[node] = max(maxMaturity[2 * node], maxMaturity[2 * node + 1]);
+        }
+        treeDirty = false;
+    }
+
+    // Positions with from <= amount <= to, in amount order
+    template <class Fn>
+    void amountRange(const vector<Investment>& investments, double from, double to, Fn fn) const {
+        auto first = lower_bound(byAmount.begin(), byAmount.end(), from,
+                                 [&](unsigned p, double value) { return investments[p].amount < value; });
+        for (auto it = first; it != byAmount.end() && investments[*it].amount <= to; ++it) fn(*it);
+    }
+
+    // Positions maturing on a day in [fromDay, toDay], earliest first
+    template <class Fn>
+    void maturingBetween(const vector<Investment>& investments, int fromDay, int toDay, Fn fn) const {
+        auto first = lower_bound(byMaturity.begin(), byMaturity.end(), fromDay,
+                                 [&](unsigned p, int value) { return investments[p].maturityDay() < value; });
+        for (auto it = first; it != byMaturity.end() && investments[*it].maturityDay() <= toDay; ++it) fn(*it);
+    }
+
+    // Positions whose [start, maturity] span contains day: among the ones
+    // that started by then, descend only into subtrees maturing on or after it
+    template <class Fn>
+    void activeOn(int day, Fn fn) const {
+        size_t started = upper_bound(startDays.begin(), startDays.end(), day) - startDays.begin();
+        struct Span {
+            size_t node, first, width;
+        };
+        vector<Span> pending;
+        if (started > 0) pending.push_back({1, 0, leaves});
+        while (!pending.empty()) {
+            Span span = pending.back();
+            pending.pop_back();
+            if (span.first >= started || maxMaturity[span.node] < day) continue;
+            if (span.width == 1) {
+                fn(byStart[span.first]);
+                continue;
+            }
+            size_t half = span.width / 2;
+            pending.push_back({2 * span.node + 1, span.first + half, half});
+            pending.push_back({2 * span.node, span.first, half});
+        }
+    }
+};
+
+// Streams the transactions matching a filter without building a result
+// vector. Each source is a set of index ranges plus the filters a candidate
+// must pass; a candidate that also passes an earlier source was already
+// returned there and is skipped. A cursor is only valid until the ledger or
+// the filter it was created from changes.
+struct TransactionCursor {
+    struct Range {
+        Transaction* const* begin;
+        Transaction* const* end;
+    };
+
+    struct Source {
+        vector<Range> ranges;
+        vector<const TransactionFilter*> checks;
+    };
+
+    vector<Source> sources;
+    size_t cost;
+    bool indexed;
+    size_t sourcePos, rangePos;
+    Transaction* const* pos;
+    bool started;
+
+    TransactionCursor() : cost(0), indexed(false), sourcePos(0), rangePos(0), pos(nullptr), started(false) {}
+
+    static bool passes(const Source& source, const Transaction* t) {
+        for (auto check : source.checks) {
+            if (!check->matches(t)) return false;
+        }
+        return true;
+    }
+
+    bool accepts(size_t source, const Transaction* t) const {
+        if (!passes(sources[source], t)) return false;
+        for (size_t i = 0; i < source; i++) {
+            if (passes(sources[i], t)) return false;
+        }
+        return true;
+    }
+
+    Transaction* next() {
+        while (sourcePos < sources.size()) {
+            const Source& source = sources[sourcePos];
+            if (rangePos >= source.ranges.size()) {
+                sourcePos++;
+                rangePos = 0;
+                started = false;
+                continue;
+            }
+            const Range& range = source.ranges[rangePos];
+            if (!started) {
+                pos = range.begin;
+                started = true;
+            }
+            while (pos != range.end) {
+                Transaction* t = *pos++;
+                if (accepts(sourcePos, t)) return t;
+            }
+            rangePos++;
+            started = false;
+        }
+        return nullptr;
+    }
+};
+
+inline void appendVarint(string& out, unsigned long long value) {
+    while (value >= 0x80) {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+inline unsigned long long readVarint(const char*& p) {
+    unsigned long long value = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        value |= (unsigned long long)(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    value |= (unsigned long long)(*p++) << shift;
+    return value;
+}
+
+// Maps signed values to unsigned so small negatives stay short
+inline unsigned long long zigzag(long long value) {
+    return ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+}
+
+inline long long unzigzag(unsigned long long value) {
+    return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+// Summary of a cold block, checked before the block is decoded
+struct ZoneMap {
+    int minKey, maxKey;
+    double minAmount, maxAmount;
+    unsigned long long categoryBits;  // bit (id % 64) set for every category present
+    bool hasIncome, hasExpense;
+
+    ZoneMap() : minKey(0), maxKey(0), minAmount(0), maxAmount(0), categoryBits(0), hasIncome(false), hasExpense(false) {}
+
+    void merge(const ZoneMap& other) {
+        if (!hasIncome && !hasExpense) {
+            *this = other;
+            return;
+        }
+        minKey = min(minKey, other.minKey);
+        maxKey = max(maxKey, other.maxKey);
+        minAmount = min(minAmount, other.minAmount);
+        maxAmount = max(maxAmount, other.maxAmount);
+        categoryBits |= other.categoryBits;
+        hasIncome = hasIncome || other.hasIncome;
+        hasExpense = hasExpense || other.hasExpense;
+    }
+
+    // False only when no row in the block can match
+    bool mayMatch(const TransactionFilter& filter) const {
+        switch (filter.kind) {
+            case TransactionFilter::ALL_OF:
+                for (const auto& child : filter.children) {
+                    if (!mayMatch(child)) return false;
+                }
+                return true;
+            case TransactionFilter::ANY_OF:
+                for (const auto& child : filter.children) {
+                    if (mayMatch(child)) return true;
+                }
+                return false;
+            case TransactionFilter::DATE_RANGE:
+                return maxKey >= filter.fromKey && minKey <= filter.toKey;
+            case TransactionFilter::AMOUNT_RANGE:
+                return maxAmount >= filter.minAmount && minAmount <= filter.maxAmount;
+            case TransactionFilter::CATEGORY_SET:
+                for (size_t id = 0; id < filter.categoryMask.size(); id++) {
+                    if (filter.categoryMask[id] && (categoryBits >> (id % 64) & 1)) return true;
+                }
+                return false;
+            case TransactionFilter::TYPE:
+                return (filter.text == "Income" && hasIncome) || (filter.text == "Expenditure" && hasExpense);
+            default:
+                return true;
+        }
+    }
+};
+
+// One decoded cold row
+struct ColdRow {
+    int dayNumber;
+    double amount;
+    unsigned descriptionId;
+    CategoryType category;
+    bool income;
+    bool autoCategorized;
+    int currency;
+};
+
+// Up to BLOCK_ROWS date-ordered transactions, stored column by column:
+// day-number deltas, amounts (whole cents when every amount allows it,
+// otherwise raw doubles), description dictionary ids, then category, type,
+// currency and whether the category was guessed packed into one varint.
+struct ColdBlock {
+    size_t rows;
+    ZoneMap zone;
+    bool exactCents;
+    string data;
+    string file;   // suffix of the saved file, empty until written
+
+    ColdBlock() : rows(0), exactCents(true) {}
+};
+
+// Immutable compressed storage for transactions from closed months. Blocks
+// stay encoded until a query gets past their zone map; the most recently
+// decoded blocks are kept in a small cache.
+struct ColdStore {
+    static const size_t BLOCK_ROWS = 4096;
+    static const size_t CACHE_BLOCKS = 16;
+    static constexpr unsigned long long GUESSED_BIT = 1ULL << 31;   // category ids stay far below 2^30
+
+    vector<ColdBlock> blocks;
+    ZoneMap summary;   // covers every block, so queries on recent data skip the tier at once
+    vector<string> dictionary;
+    unordered_map<string, unsigned> dictionaryIds;
+    string dictionaryFile;         // suffix of the saved dictionary
+    size_t savedDictionarySize;
+
+    vector<vector<ColdRow>> cache;
+    vector<size_t> cacheOwner;
+    vector<unsigned long long> cacheUsed;
+    unsigned long long cacheClock;
+
+    // Rows are handed to callbacks through these, so nothing is allocated per row
+    Income incomeRow;
+    Expenditure expenseRow;
+
+    ColdStore() : savedDictionarySize(0), cacheClock(0),
+        incomeRow(0, "", Date(1, 1, 1970)), expenseRow(0, "", Date(1, 1, 1970)) {}
+
+    size_t rowCount() const {
+        size_t rows = 0;
+        for (const auto& block : blocks) rows += block.rows;
+        return rows;
+    }
+
+    void clear() {
+        blocks.clear();
+        summary = ZoneMap();
+        dictionary.clear();
+        dictionaryIds.clear();
+        dictionaryFile.clear();
+        savedDictionarySize = 0;
+        cache.clear();
+        cacheOwner.clear();
+        cacheUsed.clear();
+    }
+
+    unsigned intern(const string& description) {
+        auto found = dictionaryIds.find(description);
+        if (found != dictionaryIds.end()) return found->second;
+        unsigned id = dictionary.size();
+        dictionary.push_back(description);
+        dictionaryIds.emplace(description, id);
+        return id;
+    }
+
+    // rows must be sorted by date
+    void freeze(const vector<Transaction*>& rows) {
+        for (size_t first = 0; first < rows.size(); first += BLOCK_ROWS) {
+            size_t last = min(rows.size(), first + BLOCK_ROWS);
+            ColdBlock block;
+            block.rows = last - first;
+            block.zone.minKey = rows[first]->date.key();
+            block.zone.maxKey = rows[last - 1]->date.key();
+            block.zone.minAmount = block.zone.maxAmount = rows[first]->amount;
+            for (size_t i = first; i < last; i++) {
+                const Transaction* t = rows[i];
+                block.zone.minAmount = min(block.zone.minAmount, t->amount);
+                block.zone.maxAmount = max(block.zone.maxAmount, t->amount);
+                block.zone.categoryBits |= 1ULL << (t->category % 64);
+                if (t->type == "Income") block.zone.hasIncome = true;
+                else block.zone.hasExpense = true;
+                if (llround(t->amount * 100) / 100.0 != t->amount) block.exactCents = false;
+            }
+
+            int previousDay = 0;
+            for (size_t i = first; i < last; i++) {
+                int day = rows[i]->date.dayNumber();
+                appendVarint(block.data, zigzag(day - previousDay));
+                previousDay = day;
+            }
+            for (size_t i = first; i < last; i++) {
+                if (block.exactCents) {
+                    appendVarint(block.data, zigzag(llround(rows[i]->amount * 100)));
+                } else {
+                    block.data.append((const char*)&rows[i]->amount, sizeof(double));
+                }
+            }
+            for (size_t i = first; i < last; i++) {
+                appendVarint(block.data, intern(rows[i]->description));
+            }
+            for (size_t i = first; i < last; i++) {
+                // The guessed bit sits above the category, clear in blocks written before it existed
+                appendVarint(block.data, ((unsigned long long)rows[i]->currency << 32) |
+                                         (rows[i]->autoCategorized ? GUESSED_BIT : 0) |
+                                         ((unsigned long long)rows[i]->category << 1) | (rows[i]->type == "Income" ? 1 : 0));
+            }
+            block.data.shrink_to_fit();
+            addBlock(block);
+        }
+    }
+
+    void addBlock(const ColdBlock& block) {
+        summary.merge(block.zone);
+        blocks.push_back(block);
+    }
+
+    void decodeInto(const ColdBlock& block, vector<ColdRow>& rows) const {
+        rows.resize(block.rows);
+        const char* p = block.data.data();
+        int day = 0;
+        for (auto& row : rows) {
+            day += (int)unzigzag(readVarint(p));
+            row.dayNumber = day;
+        }
+        for (auto& row : rows) {
+            if (block.exactCents) {
+                row.amount = unzigzag(readVarint(p)) / 100.0;
+            } else {
+                memcpy(&row.amount, p, sizeof(double));
+                p += sizeof(double);
+            }
+        }
+        for (auto& row : rows) {
+            row.descriptionId = (unsigned)readVarint(p);
+        }
+        for (auto& row : rows) {
+            unsigned long long packed = readVarint(p);
+            row.category = (CategoryType)((packed & (GUESSED_BIT - 1)) >> 1);
+            row.income = packed & 1;
+            row.autoCategorized = (packed & GUESSED_BIT) != 0;
+            row.currency = (int)(packed >> 32);
+        }
+    }
+
+    // Valid until the next call
+    const vector<ColdRow>& decode(size_t index) {
+        cacheClock++;
+        for (size_t slot = 0; slot < cacheOwner.size(); slot++) {
+            if (cacheOwner[slot] == index) {
+                cacheUsed[slot] = cacheClock;
+                return cache[slot];
+            }
+        }
+        size_t slot = cache.size();
+        if (slot < CACHE_BLOCKS) {
+            cache.emplace_back();
+            cacheOwner.push_back(index);
+            cacheUsed.push_back(cacheClock);
+        } else {
+            slot = min_element(cacheUsed.begin(), cacheUsed.end()) - cacheUsed.begin();
+            cacheOwner[slot] = index;
+            cacheUsed[slot] = cacheClock;
+        }
+        decodeInto(blocks[index], cache[slot]);
+        FINANCE_COUNT("cold_blocks_decoded", 1);
+        return cache[slot];
+    }
+
+    // The returned object is reused for the next row
+    const Transaction& materialize(const ColdRow& row) {
+        Transaction& t = row.income ? (Transaction&)incomeRow : (Transaction&)expenseRow;
+        t.amount = row.amount;
+        t.description = dictionary[row.descriptionId];
+        t.date = Date::fromDayNumber(row.dayNumber);
+        t.category = row.category;
+        t.autoCategorized = row.autoCategorized;
+        t.currency = row.currency;
+        return t;
+    }
+
+    // Calls fn for every cold row that matches, skipping blocks the zone maps rule out
+    template <class Fn>
+    void scan(const TransactionFilter& filter, Fn fn) {
+        if (blocks.empty() || !summary.mayMatch(filter)) {
+            return;
+        }
+        for (size_t b = 0; b < blocks.size(); b++) {
+            if (!blocks[b].zone.mayMatch(filter)) {
+                FINANCE_COUNT("cold_blocks_skipped", 1);
+                continue;
+            }
+            for (const auto& row : decode(b)) {
+                const Transaction& t = materialize(row);
+                if (filter.matches(&t)) fn(t);
+            }
+        }
+    }
+
+    // Calls fn(row, distance) for every cold row whose description has a
+    // distance of 0 or more; descriptions have no zone map, so every block is read
+    template <class Fn>
+    void scanDescriptions(const vector<int>& distances, Fn fn) {
+        for (size_t b = 0; b < blocks.size(); b++) {
+            for (const auto& row : decode(b)) {
+                if (row.descriptionId < distances.size() && distances[row.descriptionId] >= 0) {
+                    fn(materialize(row), distances[row.descriptionId]);
+                }
+            }
+        }
+    }
+
+    template <class Fn>
+    void forEach(Fn fn) {
+        for (size_t b = 0; b < blocks.size(); b++) {
+            for (const auto& row : decode(b)) {
+                fn(materialize(row));
+            }
+        }
+    }
+
+    size_t memoryUsage() const {
+        size_t bytes = blocks.capacity() * sizeof(ColdBlock);
+        for (const auto& block : blocks) bytes += block.data.capacity();
+        bytes += dictionary.capacity() * sizeof(string);
+        for (const auto& description : dictionary) {
+            // The string itself plus its hash map entry
+            bytes += (description.capacity() > 15 ? description.capacity() + 1 : 0) * 2 + sizeof(string) + 32;
+        }
+        for (const auto& rows : cache) bytes += rows.capacity() * sizeof(ColdRow);
+        return bytes;
+    }
+
+    size_t unsavedBlocks() const {
+        size_t count = 0;
+        for (const auto& block : blocks) {
+            if (block.file.empty()) count++;
+        }
+        return count + (dictionary.size() != savedDictionarySize ? 1 : 0);
+    }
+
+    // The saved files are gone or belong to someone else, so write everything again
+    void forgetFiles() {
+        for (auto& block : blocks) block.file.clear();
+        dictionaryFile.clear();
+        savedDictionarySize = 0;
+    }
+
+    string renderBlock(const ColdBlock& block) const {
+        ostringstream out;
+        out.precision(17);
+        out << block.rows << " " << block.zone.minKey << " " << block.zone.maxKey << " "
+            << block.zone.minAmount << " " << block.zone.maxAmount << " " << block.zone.categoryBits << " "
+            << block.zone.hasIncome << " " << block.zone.hasExpense << " " << block.exactCents << " " << block.data.size() << "\n";
+        out.write(block.data.data(), block.data.size());
+        return out.str();
+    }
+
+    bool readBlock(istream& in, ColdBlock& block) {
+        size_t size;
+        in >> block.rows >> block.zone.minKey >> block.zone.maxKey >> block.zone.minAmount >> block.zone.maxAmount
+           >> block.zone.categoryBits >> block.zone.hasIncome >> block.zone.hasExpense >> block.exactCents >> size;
+        in.ignore();
+        if (in.fail()) return false;
+        block.data.resize(size);
+        in.read(&block.data[0], size);
+        return (size_t)in.gcount() == size;
+    }
+
+    string renderDictionary() const {
+        string out;
+        for (const auto& description : dictionary) {
+            out += description;
+            out += '\n';
+        }
+        return out;
+    }
+
+    void readDictionary(istream& in, size_t count) {
+        string description;
+        for (size_t i = 0; i < count && getline(in, description); i++) {
+            intern(description);
+        }
+    }
+};
+
+// One file of a snapshot, already serialized
+struct SnapshotFile {
+    string suffix;
+    string contents;
+};
+
+// Everything one save puts on disk, serialized up front so another thread can
+// write it while the ledger keeps changing
+struct SnapshotBatch {
+    string filename;
+    vector<SnapshotFile> files;
+    string manifest;
+    vector<string> superseded;   // deleted once the new manifest is in place
+    size_t records;
+
+    SnapshotBatch() : records(0) {}
+
+    static bool replaceFile(const string& from, const string& to) {
+        if (rename(from.c_str(), to.c_str()) == 0) {
+            return true;
+        }
+        // Windows refuses to rename over an existing file
+        remove(to.c_str());
+        return rename(from.c_str(), to.c_str()) == 0;
+    }
+
+    // The manifest is replaced by rename, so a crash mid-write leaves the
+    // previous snapshot intact
+    bool write() const {
+        FINANCE_TIME_SCOPE("snapshot_write");
+        size_t written = 0;
+        bool ok = true;
+        for (; written < files.size() && ok; written++) {
+            ofstream file(filename + "." + files[written].suffix, ios::binary);
+            file.write(files[written].contents.data(), files[written].contents.size());
+            file.close();
+            ok = !file.fail();
+        }
+        
+        string manifestName = filename + ".manifest";
+        if (ok) {
+            ofstream file(manifestName + ".tmp", ios::binary);
+            file << manifest;
+            file.close();
+            ok = !file.fail() && replaceFile(manifestName + ".tmp", manifestName);
+        }
+        
+        if (!ok) {
+            for (size_t i = 0; i < written; i++) {
+                remove((filename + "." + files[i].suffix).c_str());
+            }
+            return false;
+        }
+        
+        for (const auto& suffix : superseded) {
+            remove((filename + "." + suffix).c_str());
+        }
+        // A plain data file from before segmented saves is now out of date
+        remove(filename.c_str());
+        FINANCE_COUNT("segments_written", files.size());
+        FINANCE_COUNT("records_saved", records);
+        return true;
+    }
+};
+
+// Splits a record list into fixed-size runs of rows and remembers which runs
+// changed since the last save. Each saved run lives in its own file, so a save
+// only rewrites the runs that changed and reuses the rest.
+struct SegmentTracker {
+    static constexpr size_t SEGMENT_ROWS = 4096;
+
+    vector<bool> dirty;     // per segment, grows as rows are marked
+    vector<string> files;   // file suffix holding each saved segment
+    size_t changes;         // edits since the last snapshot
+
+    SegmentTracker() : changes(0) {}
+
+    static size_t segmentsFor(size_t rows) {
+        return (rows + SEGMENT_ROWS - 1) / SEGMENT_ROWS;
+    }
+
+    void markRow(size_t row) {
+        size_t segment = row / SEGMENT_ROWS;
+        if (segment >= dirty.size()) dirty.resize(segment + 1, true);
+        dirty[segment] = true;
+        changes++;
+    }
+
+    // Deleting a row shifts every row after it into a different position
+    void markFrom(size_t row) {
+        size_t segment = row / SEGMENT_ROWS;
+        if (segment >= dirty.size()) dirty.resize(segment + 1, true);
+        fill(dirty.begin() + segment, dirty.end(), true);
+        changes++;
+    }
+
+    void markAll() {
+        fill(dirty.begin(), dirty.end(), true);
+        changes++;
+    }
+
+    bool needsWrite(size_t segment) const {
+        return segment >= files.size() || files[segment].empty() || segment >= dirty.size() || dirty[segment];
+    }
+
+    // Serializes the segments that changed under new suffixes <kind><segment>.<generation>.
+    // nextFiles receives the suffix of every segment after the save.
+    template <class WriteRows>
+    void renderChanged(char kind, size_t rows, unsigned long long generation, WriteRows writeRows,
+                       vector<string>& nextFiles, vector<SnapshotFile>& rendered) const {
+        size_t count = segmentsFor(rows);
+        nextFiles.assign(count, "");
+        for (size_t segment = 0; segment < count; segment++) {
+            if (!needsWrite(segment)) {
+                nextFiles[segment] = files[segment];
+                continue;
+            }
+            ostringstream out;
+            out.precision(15);
+            size_t first = segment * SEGMENT_ROWS;
+            writeRows(out, first, min(rows, first + SEGMENT_ROWS));
+            nextFiles[segment] = kind + to_string(segment) + "." + to_string(generation);
+            rendered.push_back({nextFiles[segment], out.str()});
+        }
+    }
+
+    // Adopts the files of a committed save; files no longer referenced are returned
+    void commit(const vector<string>& nextFiles, vector<string>& superseded) {
+        for (const auto& old : files) {
+            if (!old.empty() && find(nextFiles.begin(), nextFiles.end(), old) == nextFiles.end()) {
+                superseded.push_back(old);
+            }
+        }
+        files = nextFiles;
+        dirty.assign(files.size(), false);
+    }
+
+    void reset() {
+        dirty.clear();
+        files.clear();
+        changes = 0;
+    }
+};
+
+// One line of an imported bank statement; amount is positive for money in
+struct StatementLine {
+    Date date;
+    double amount;
+    string description;
+};
+
+// A statement for one account, read from a text file with one line per
+// entry: "<day> <month> <year> <amount> <description>", money out negative
+struct Statement {
+    string account;
+    vector<StatementLine> lines;
+
+    bool loadFromFile(const string& filename) {
+        ifstream file(filename);
+        if (!file.is_open()) {
+            return false;
+        }
+        account = filename;
+        lines.clear();
+        string text;
+        while (getline(file, text)) {
+            istringstream in(text);
+            int day, month, year;
+            StatementLine line;
+            if (!(in >> day >> month >> year >> line.amount)) continue;
+            in >> ws;
+            getline(in, line.description);
+            line.date = Date(day, month, year);
+            lines.push_back(line);
+        }
+        return true;
+    }
+};
+
+// How one statement lined up with the ledger
+struct Reconciliation {
+    string account;
+    vector<pair<size_t, Transaction*>> matched;   // statement line, ledger row
+    vector<size_t> slots;                         // each matched row's place in the Reconciler
+    vector<size_t> unmatchedLines;
+    vector<size_t> duplicateLines;   // same date, amount and text as an earlier line
+};
+
+struct ReconciliationReport {
+    vector<Reconciliation> statements;
+    vector<Transaction*> unmatchedRows;   // live rows in the statements' date span that none matched
+};
+
+// Matches statement lines to ledger rows of the same signed amount in cents
+// dated within toleranceDays. Rows are sorted by amount and then date, and a
+// hash of amounts points at each amount's run, so a line only looks at rows
+// of its own amount near its own date. Among several candidates a close
+// description wins, then the nearer date. Claims are flags indexed by a
+// row's place in that order.
+struct Reconciler {
+    struct Candidate {
+        long long cents;
+        int day;
+        Transaction* row;
+    };
+
+    int toleranceDays;
+    vector<Candidate> rows;
+    unordered_map<long long, pair<size_t, size_t>> byCents;   // [first, last) in rows
+
+    static double signedAmount(const Transaction* t) {
+        return t->type == "Income" ? t->amount : -t->amount;
+    }
+
+    static long long centsOf(double amount) {
+        return llround(amount * 100);
+    }
+
+    Reconciler(const vector<Transaction*>& ledger, int tolerance) : toleranceDays(tolerance) {
+        rows.reserve(ledger.size());
+        for (auto t : ledger) {
+            rows.push_back({centsOf(signedAmount(t)), t->date.dayNumber(), t});
+        }
+        sort(rows.begin(), rows.end(), [](const Candidate& a, const Candidate& b) {
+            return a.cents != b.cents ? a.cents < b.cents : a.day < b.day;
+        });
+        for (size_t first = 0, last; first < rows.size(); first = last) {
+            for (last = first + 1; last < rows.size() && rows[last].cents == rows[first].cents; last++) {}
+            byCents[rows[first].cents] = {first, last};
+        }
+    }
+
+    // Equal ignoring case, or within the usual typo budget of each other
+    static bool similarDescriptions(const string& a, const string& b) {
+        const string& shorter = a.size() <= b.size() ? a : b;
+        const string& longer = a.size() <= b.size() ? b : a;
+        int allowed = FuzzyMatcher::defaultDistance(shorter.size());
+        if ((int)(longer.size() - shorter.size()) > allowed) return false;
+        return FuzzyMatcher(shorter).distance(longer, allowed) <= allowed;
+    }
+
+    // Place of the best unclaimed row for line, or rows.size() when none fits.
+    // Descriptions are only compared when there is a choice to make.
+    size_t matchLine(const StatementLine& line, const vector<char>& claimed) const {
+        auto run = byCents.find(centsOf(line.amount));
+        if (run == byCents.end()) return rows.size();
+        int day = line.date.dayNumber();
+        size_t first = lower_bound(rows.begin() + run->second.first, rows.begin() + run->second.second, day - toleranceDays,
+                                   [](const Candidate& c, int value) { return c.day < value; }) - rows.begin();
+        size_t last = first;
+        size_t free = 0;
+        while (last < run->second.second && rows[last].day <= day + toleranceDays) {
+            if (!claimed[last]) free++;
+            last++;
+        }
+        size_t best = rows.size();
+        int bestDistance = 0, bestDays = 0;
+        bool bestClose = false;
+        for (size_t i = first; i < last; i++) {
+            if (claimed[i]) continue;
+            int days = abs(rows[i].day - day);
+            int distance = 0;
+            bool close = true;
+            if (free > 1) {
+                const string& description = rows[i].row->description;
+                distance = FuzzyMatcher(description).distance(line.description, (int)description.size());
+                close = distance <= FuzzyMatcher::defaultDistance(description.size());
+            }
+            if (best == rows.size() || close > bestClose ||
+                (close == bestClose && (days < bestDays || (days == bestDays && distance < bestDistance)))) {
+                best = i;
+                bestClose = close;
+                bestDays = days;
+                bestDistance = distance;
+            }
+        }
+        return best;
+    }
+
+    void reconcile(const Statement& statement, Reconciliation& result) const {
+        result.account = statement.account;
+        const vector<StatementLine>& lines = statement.lines;
+        struct Key {
+            int day;
+            long long cents;
+            size_t line;
+        };
+        vector<Key> order(lines.size());
+        for (size_t i = 0; i < lines.size(); i++) {
+            order[i] = {lines[i].date.dayNumber(), centsOf(lines[i].amount), i};
+        }
+        sort(order.begin(), order.end(), [&](const Key& a, const Key& b) {
+            if (a.day != b.day) return a.day < b.day;
+            if (a.cents != b.cents) return a.cents < b.cents;
+            int text = lines[a.line].description.compare(lines[b.line].description);
+            return text != 0 ? text < 0 : a.line < b.line;
+        });
+        for (size_t i = 1; i < order.size(); i++) {
+            const Key& x = order[i - 1];
+            const Key& y = order[i];
+            if (x.day == y.day && x.cents == y.cents && lines[x.line].description == lines[y.line].description) {
+                result.duplicateLines.push_back(y.line);
+            }
+        }
+        sort(result.duplicateLines.begin(), result.duplicateLines.end());
+
+        vector<char> claimed(rows.size(), 0);
+        for (size_t i = 0; i < lines.size(); i++) {
+            size_t slot = matchLine(lines[i], claimed);
+            if (slot < rows.size()) {
+                claimed[slot] = 1;
+                result.matched.push_back({i, rows[slot].row});
+                result.slots.push_back(slot);
+            } else {
+                result.unmatchedLines.push_back(i);
+            }
+        }
+    }
+};
+
+// One reversible change to the ledger. A row an edit took out of the ledger
+// is kept here rather than deleted, so undo puts back the very same object.
+struct LedgerEdit {
+    enum Kind { ADD, DELETE, UPDATE };
+
+    Kind kind;
+    size_t position;                  // row the edit was made at
+    Transaction* before;              // transaction taken out, or null
+    Transaction* after;               // transaction put in, or null
+    optional<Investment> investmentBefore;
+    optional<Investment> investmentAfter;
+
+    LedgerEdit(Kind k, size_t pos, Transaction* b, Transaction* a) : kind(k), position(pos), before(b), after(a) {}
+
+    bool isInvestment() const {
+        return investmentBefore || investmentAfter;
+    }
+};
+
+// Undo/redo log of ledger edits. edits[0, applied) are in effect and the
+// rest were undone and can be redone. A version counts the edits in effect
+// since the ledger was loaded, so version v is the ledger after its first v
+// edits. An applied edit owns its before row and an undone edit its after
+// row; each is freed when its edit is forgotten.
+struct EditHistory {
+    deque<LedgerEdit> edits;
+    size_t applied;
+    size_t forgotten;   // edits dropped off the front to stay under limit
+    size_t limit;
+
+    EditHistory() : applied(0), forgotten(0), limit(1000) {}
+    EditHistory(const EditHistory&) = delete;
+    EditHistory& operator=(const EditHistory&) = delete;
+
+    ~EditHistory() {
+        clear();
+    }
+
+    size_t version() const {
+        return forgotten + applied;
+    }
+
+    size_t oldestVersion() const {
+        return forgotten;
+    }
+
+    size_t newestVersion() const {
+        return forgotten + edits.size();
+    }
+
+    bool canUndo() const {
+        return applied > 0;
+    }
+
+    bool canRedo() const {
+        return applied < edits.size();
+    }
+
+    // A new edit ends the redo branch
+    void record(const LedgerEdit& edit) {
+        discardRedo();
+        edits.push_back(edit);
+        applied++;
+        while (edits.size() > limit) {
+            forgetOldest();
+        }
+    }
+
+    void discardRedo() {
+        while (edits.size() > applied) {
+            delete edits.back().after;
+            edits.pop_back();
+        }
+    }
+
+    void forgetOldest() {
+        delete edits.front().before;
+        edits.pop_front();
+        applied--;
+        forgotten++;
+    }
+
+    void clear() {
+        discardRedo();
+        while (!edits.empty()) {
+            forgetOldest();
+        }
+        forgotten = 0;
+    }
+};
+
+// Hybrid logical clock time: wall-clock milliseconds, a counter that orders
+// events inside one millisecond or behind a clock that went backwards, and the
+// replica as the final tie-break, so no two replicas ever make equal stamps
+struct SyncStamp {
+    long long wall;
+    unsigned counter;
+    unsigned replica;
+
+    SyncStamp() : wall(0), counter(0), replica(0) {}
+    SyncStamp(long long w, unsigned c, unsigned r) : wall(w), counter(c), replica(r) {}
+
+    bool operator<(const SyncStamp& other) const {
+        if (wall != other.wall) return wall < other.wall;
+        if (counter != other.counter) return counter < other.counter;
+        return replica < other.replica;
+    }
+};
+
+struct HybridClock {
+    long long wall;
+    unsigned counter;
+
+    HybridClock() : wall(0), counter(0) {}
+
+    static long long physicalNow() {
+        return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+    }
+
+    SyncStamp tick(unsigned replica) {
+        long long now = physicalNow();
+        if (now > wall) {
+            wall = now;
+            counter = 0;
+        } else {
+            counter++;
+        }
+        return SyncStamp(wall, counter, replica);
+    }
+
+    // Moves past a stamp seen from another replica
+    void observe(const SyncStamp& remote) {
+        long long latest = max(max(wall, remote.wall), physicalNow());
+        if (latest == wall && latest == remote.wall) counter = max(counter, remote.counter) + 1;
+        else if (latest == wall) counter++;
+        else if (latest == remote.wall) counter = remote.counter + 1;
+        else counter = 0;
+        wall = latest;
+    }
+};
+
+// The latest write to one record. Whichever write has the later stamp wins;
+// a deletion is kept as a tombstone so an older write arriving late loses.
+struct SyncRecord {
+    SyncStamp stamp;
+    unsigned long long sequence;   // the write's number among its replica's writes
+    char kind;                     // 'T' transaction, 'I' investment
+    bool deleted;
+    long long coldRow;             // position in the cold store once archived, else -1
+
+    SyncRecord() : sequence(0), kind('T'), deleted(false), coldRow(-1) {}
+};
+
+// A write as sent to another replica; row is in the data file format, empty for deletions
+struct SyncOp {
+    unsigned long long record;
+    SyncStamp stamp;
+    unsigned long long sequence;
+    char kind;
+    bool deleted;
+    string row;
+};
+
+// Per-record sync state for one replica. Only the latest write of each record
+// is kept, which is all a merge needs, so the log never grows past the number
+// of records ever made. seen is the version vector: the highest write number
+// merged from each replica. Another replica's missing writes are the kept ones
+// numbered above its vector.
+//
+// Saves append the records changed since the last save as a new file; the
+// files are read back in order and compacted into one once there are too many.
+struct SyncLog {
+    static const size_t MAX_FILES = 8;
+
+    unsigned replica;              // 0 until sync is enabled
+    unsigned nextRecord;
+    unsigned long long sequence;   // this replica's writes so far
+    HybridClock clock;
+    map<unsigned, unsigned long long> seen;
+    unordered_map<unsigned long long, SyncRecord> records;
+    map<pair<unsigned, unsigned long long>, unsigned long long> byWrite;   // (replica, write number) -> record
+    unordered_map<unsigned long long, Transaction*> liveRows;
+    bool applying;                 // set while merging, so remote writes are not stamped again
+    bool changed;                  // since the state was last saved
+    unordered_set<unsigned long long> changedRecords;
+    vector<string> files;          // suffixes of the saved state, oldest first
+
+    SyncLog() : replica(0), nextRecord(0), sequence(0), applying(false), changed(false) {}
+
+    bool enabled() const {
+        return replica != 0;
+    }
+
+    void clear() {
+        replica = nextRecord = 0;
+        sequence = 0;
+        clock = HybridClock();
+        seen.clear();
+        records.clear();
+        byWrite.clear();
+        liveRows.clear();
+        applying = changed = false;
+        changedRecords.clear();
+        files.clear();
+    }
+
+    // Record ids start with the replica, so replicas never hand out the same one
+    unsigned long long newRecordId() {
+        return ((unsigned long long)replica << 32) | ++nextRecord;
+    }
+
+    void place(unsigned long long record, SyncRecord& entry, const SyncStamp& stamp, unsigned long long number) {
+        if (entry.sequence) byWrite.erase({entry.stamp.replica, entry.sequence});
+        entry.stamp = stamp;
+        entry.sequence = number;
+        byWrite[{stamp.replica, number}] = record;
+        changedRecords.insert(record);
+        changed = true;
+    }
+
+    // Stamps a local write; merges replay remote writes without stamping
+    void write(unsigned long long record, char kind, bool deleted) {
+        if (!enabled() || applying || !record) return;
+        SyncRecord& entry = records[record];
+        entry.kind = kind;
+        entry.deleted = deleted;
+        place(record, entry, clock.tick(replica), ++sequence);
+        seen[replica] = sequence;
+    }
+
+    // Takes a remote write if it is later than what we have. Archived records
+    // are final and ignore further writes.
+    bool accept(const SyncOp& op) {
+        clock.observe(op.stamp);
+        auto found = records.find(op.record);
+        if (found != records.end() && (!(found->second.stamp < op.stamp) || found->second.coldRow >= 0)) {
+            return false;
+        }
+        SyncRecord& entry = found != records.end() ? found->second : records[op.record];
+        entry.kind = op.kind;
+        entry.deleted = op.deleted;
+        place(op.record, entry, op.stamp, op.sequence);
+        return true;
+    }
+
+    void advance(const map<unsigned, unsigned long long>& other) {
+        for (const auto& entry : other) {
+            unsigned long long& mine = seen[entry.first];
+            if (entry.second > mine) {
+                mine = entry.second;
+                changed = true;
+            }
+        }
+    }
+
+    // Records holding a write the other vector has not seen
+    vector<unsigned long long> missingFrom(const map<unsigned, unsigned long long>& other) const {
+        vector<unsigned long long> result;
+        auto it = byWrite.begin();
+        while (it != byWrite.end()) {
+            unsigned from = it->first.first;
+            auto known = other.find(from);
+            unsigned long long after = known == other.end() ? 0 : known->second;
+            it = byWrite.lower_bound({from, after + 1});
+            for (; it != byWrite.end() && it->first.first == from; ++it) {
+                result.push_back(it->second);
+            }
+        }
+        return result;
+    }
+
+    static void writeVector(ostream& out, const map<unsigned, unsigned long long>& versions) {
+        out << "seen " << versions.size() << "\n";
+        for (const auto& entry : versions) {
+            out << entry.first << " " << entry.second << "\n";
+        }
+    }
+
+    static bool readVector(istream& in, map<unsigned, unsigned long long>& versions) {
+        string label;
+        size_t count;
+        if (!(in >> label >> count) || label != "seen") return false;
+        for (size_t i = 0; i < count; i++) {
+            unsigned from;
+            unsigned long long number;
+            if (!(in >> from >> number)) return false;
+            versions[from] = number;
+        }
+        return true;
+    }
+
+    // A delta: the sender, what it had seen when writing, then one write per line
+    static void writeDelta(ostream& out, unsigned from, const map<unsigned, unsigned long long>& senderSeen,
+                           const vector<SyncOp>& ops) {
+        out << "FINANCE-DELTA 1\n";
+        out << "from " << from << "\n";
+        writeVector(out, senderSeen);
+        out << "writes " << ops.size() << "\n";
+        for (const auto& op : ops) {
+            out << op.record << " " << op.stamp.wall << " " << op.stamp.counter << " " << op.stamp.replica << " "
+                << op.sequence << " " << op.kind << " " << (op.deleted ? 'D' : 'P');
+            if (!op.deleted) out << " " << op.row;
+            out << "\n";
+        }
+    }
+
+    static bool readDelta(istream& in, unsigned& from, map<unsigned, unsigned long long>& senderSeen,
+                          vector<SyncOp>& ops) {
+        string magic, label;
+        int version;
+        size_t count;
+        if (!(in >> magic >> version) || magic != "FINANCE-DELTA" || version != 1) return false;
+        if (!(in >> label >> from) || label != "from") return false;
+        if (!readVector(in, senderSeen)) return false;
+        if (!(in >> label >> count) || label != "writes") return false;
+        ops.resize(count);
+        for (auto& op : ops) {
+            char state;
+            if (!(in >> op.record >> op.stamp.wall >> op.stamp.counter >> op.stamp.replica >> op.sequence
+                     >> op.kind >> state)) {
+                return false;
+            }
+            op.deleted = state == 'D';
+            if (!op.deleted) {
+                in.get();
+                getline(in, op.row);
+            }
+        }
+        return true;
+    }
+
+    // Whether the next save should rewrite everything instead of appending
+    bool needsCompaction() const {
+        return files.empty() || files.size() >= MAX_FILES || changedRecords.size() * 4 > records.size();
+    }
+
+    static void writeRecord(ostream& out, unsigned long long id, const SyncRecord& r) {
+        out << id << " " << r.stamp.wall << " " << r.stamp.counter << " " << r.stamp.replica << " "
+            << r.sequence << " " << r.kind << " " << (r.deleted ? 'D' : r.coldRow >= 0 ? 'A' : 'L');
+        if (r.coldRow >= 0) out << " " << r.coldRow;
+        out << "\n";
+    }
+
+    // Every record, or only the changed ones. Live records keep their contents
+    // in the ledger rows, which carry their ids.
+    string render(bool everything) const {
+        ostringstream out;
+        out << "FINANCE-SYNC 1\n";
+        out << "replica " << replica << " " << nextRecord << " " << sequence << "\n";
+        out << "clock " << clock.wall << " " << clock.counter << "\n";
+        writeVector(out, seen);
+        if (everything) {
+            out << "records " << records.size() << "\n";
+            for (const auto& entry : records) writeRecord(out, entry.first, entry.second);
+        } else {
+            out << "records " << changedRecords.size() << "\n";
+            for (auto id : changedRecords) writeRecord(out, id, records.at(id));
+        }
+        return out.str();
+    }
+
+    void saved(const vector<string>& nextFiles) {
+        files = nextFiles;
+        changedRecords.clear();
+        changed = false;
+    }
+
+    // Files are read oldest first; later ones replace the header and any record they repeat
+    bool read(istream& in) {
+        string magic, label;
+        int version;
+        size_t count;
+        if (!(in >> magic >> version) || magic != "FINANCE-SYNC" || version != 1) return false;
+        if (!(in >> label >> replica >> nextRecord >> sequence) || label != "replica") return false;
+        if (!(in >> label >> clock.wall >> clock.counter) || label != "clock") return false;
+        if (!readVector(in, seen)) return false;
+        if (!(in >> label >> count) || label != "records") return false;
+        records.reserve(records.size() + count);
+        for (size_t i = 0; i < count; i++) {
+            unsigned long long id;
+            SyncRecord r;
+            char state;
+            if (!(in >> id >> r.stamp.wall >> r.stamp.counter >> r.stamp.replica >> r.sequence >> r.kind >> state)) {
+                return false;
+            }
+            r.deleted = state == 'D';
+            if (state == 'A' && !(in >> r.coldRow)) return false;
+            SyncRecord& entry = records[id];
+            if (entry.sequence) byWrite.erase({entry.stamp.replica, entry.sequence});
+            entry = r;
+            byWrite[{r.stamp.replica, r.sequence}] = id;
+        }
+        return true;
+    }
+};
+
+struct FinanceManager {
+    vector<Transaction*> transactions;
+    vector<Investment> investments;
+    vector<UpcomingPayment> upcomingPayments;
+    vector<string> descriptionSuggestions;           // indexed by description id
+    unordered_map<string, unsigned> descriptionIds;
+    Categorizer categorizer;
+    TransactionIndex transactionIndex;
+    InvestmentIndex investmentIndex;
+    SpendingAnalytics analytics;
+    ExpenseDigests expenseDigests;
+    BalanceTimeline balanceTimeline;
+    BudgetEngine budgets;
+    AnomalyDetector anomalies;
+    RecurrenceDetector recurrences;
+    FxTable fx;
+    int nextTransactionId;
+    SegmentTracker transactionSegments;
+    SegmentTracker investmentSegments;
+    string snapshotFile;          // name the segment files were last saved or loaded under
+    string snapshotUpcomingFile;
+    unsigned long long snapshotGeneration;
+    size_t upcomingChanges;
+    ColdStore coldStore;
+    EditHistory history;
+    SyncLog sync;
+    vector<Transaction*> coldResults;   // copies of cold rows returned by the last search
+    int hotMonths;                      // months kept as live rows when old ones are archived
+    
+    FinanceManager() : nextTransactionId(0), snapshotGeneration(0), upcomingChanges(0), hotMonths(12) {
+        categorizer.addDefaultRules();
+    }
+    
+    ~FinanceManager() {
+        for (auto t : transactions) {
+            delete t;
+        }
+        for (auto t : coldResults) {
+            delete t;
+        }
+    }
+
+    // An expense recorded without a category gets a guessed one; a chosen one is learned from
+    void categorize(Transaction* t) {
+        if (t->type != "Expenditure") return;
+        if (t->category == UNCATEGORIZED) {
+            t->category = categorizer.classify(t->description);
+            t->autoCategorized = true;
+        } else if (!t->autoCategorized) {
+            categorizer.learn(t->description, t->category);
+        }
+    }
+
+    void addTransaction(Transaction* t) {
+        categorize(t);
+        transactions.push_back(t);
+        transactionSegments.markRow(transactions.size() - 1);
+        track(t);
+        // Only rows entered now are checked; undo, redo and sync replays are not new spending
+        anomalies.observe(*t, t->descriptionId, t->amount * rateFor(*t));
+        syncTransactionWrite(t);
+        history.record(LedgerEdit(LedgerEdit::ADD, transactions.size() - 1, nullptr, t));
+        
+        nextTransactionId++;
+    }
+    
+    // New descriptions also become suggestions
+    unsigned internDescription(const string& description) {
+        auto found = descriptionIds.find(description);
+        if (found != descriptionIds.end()) return found->second;
+        unsigned id = descriptionSuggestions.size();
+        descriptionSuggestions.push_back(description);
+        descriptionIds.emplace(description, id);
+        return id;
+    }
+
+    // Converts to the base currency at the rate on the transaction date
+    double rateFor(const Transaction& t) const {
+        return fx.rate(t.currency, t.date.dayNumber());
+    }
+    
+    // Keeps the structures derived from the ledger in step with it
+    void track(Transaction* t) {
+        double rate = rateFor(*t);
+        t->descriptionId = internDescription(t->description);
+        transactionIndex.insert(t);
+        analytics.record(*t, rate);
+        expenseDigests.record(*t, t->amount * rate);
+        budgets.record(*t, t->amount * rate);
+        recurrences.add(t->descriptionId, t->type == "Income", t->date.dayNumber(), t->amount);
+        balanceTimeline.add(t->date, t->type == "Income" ? t->amount * rate : -t->amount * rate);
+    }
+    
+    void untrack(Transaction* t) {
+        double rate = rateFor(*t);
+        transactionIndex.markDirty();
+        analytics.record(*t, -rate);
+        expenseDigests.forget(*t);
+        budgets.record(*t, -t->amount * rate);
+        recurrences.remove(t->descriptionId, t->type == "Income", t->date.dayNumber(), t->amount);
+        balanceTimeline.add(t->date, t->type == "Income" ? -t->amount * rate : t->amount * rate);
+    }
+    
+    // Money put into an investment leaves the balance on its start date
+    void trackInvestment(const Investment& i, int sign) {
+        double rate = fx.rate(i.currency, i.startDate.dayNumber());
+        balanceTimeline.add(i.startDate, -sign * i.amount * rate);
+    }
+    
+    // Everything derived from amounts is rebuilt, e.g. after loading new FX rates
+    void retrackAll() {
+        transactionIndex.markDirty();
+        investmentIndex.markDirty();
+        analytics.clear();
+        expenseDigests.clear();
+        balanceTimeline.clear();
+        budgets.clearTotals();
+        budgets.silent = true;
+        anomalies.clear();
+        anomalies.silent = true;
+        recurrences.clear();
+        auto record = [this](const Transaction& t, unsigned descriptionId) {
+            double rate = rateFor(t);
+            analytics.record(t, rate);
+            expenseDigests.record(t, t.amount * rate);
+            budgets.record(t, t.amount * rate);
+            anomalies.observe(t, descriptionId, t.amount * rate);
+            recurrences.add(descriptionId, t.type == "Income", t.date.dayNumber(), t.amount);
+            balanceTimeline.add(t.date, t.type == "Income" ? t.amount * rate : -t.amount * rate);
+        };
+        // Archived rows are the oldest, so they go first and the detector's
+        // weighted statistics end up reflecting recent spending
+        coldStore.forEach([&](const Transaction& t) { record(t, internDescription(t.description)); });
+        for (auto t : transactions) {
+            t->descriptionId = internDescription(t->description);
+            record(*t, t->descriptionId);
+        }
+        budgets.silent = false;
+        anomalies.silent = false;
+        for (const auto& i : investments) {
+            trackInvestment(i, 1);
+        }
+    }
+    
+    // A new budget needs its totals from the whole ledger, once
+    void rebuildBudgetTotals() {
+        budgets.clearTotals();
+        budgets.silent = true;
+        auto record = [this](const Transaction& t) {
+            budgets.record(t, t.amount * rateFor(t));
+        };
+        for (auto t : transactions) {
+            record(*t);
+        }
+        coldStore.forEach(record);
+        budgets.silent = false;
+    }
+    
+    // Opening balance plus every transaction and investment on record
+    double currentBalance() const {
+        return balanceTimeline.closingBalance();
+    }
+    
+    size_t transactionCount() const {
+        return transactions.size() + coldStore.rowCount();
+    }
+    
+    // Moves transactions dated before cutoff out of the live list into
+    // compressed cold blocks. They still count towards analytics and reports
+    // and are still found by searches, but can no longer be edited by index.
+    size_t freezeBefore(const Date& cutoff) {
+        FINANCE_TIME_SCOPE("freeze");
+        int cutoffKey = cutoff.key();
+        vector<Transaction*> frozen, kept;
+        for (auto t : transactions) {
+            (t->date.key() < cutoffKey ? frozen : kept).push_back(t);
+        }
+        if (frozen.empty()) {
+            return 0;
+        }
+        stable_sort(frozen.begin(), frozen.end(), [](Transaction* a, Transaction* b) {
+            return a->date.key() < b->date.key();
+        });
+        // Frozen rows can no longer be edited, so neither can edits touching them be undone
+        history.clear();
+        archiveSyncRows(frozen, coldStore.rowCount());
+        coldStore.freeze(frozen);
+        for (auto t : frozen) {
+            delete t;
+        }
+        transactions = kept;
+        transactions.shrink_to_fit();
+        transactionSegments.markAll();
+        transactionIndex.markDirty();
+        return frozen.size();
+    }
+    
+    // Months before the last hotMonths, counting the current one, are closed
+    size_t freezeClosedMonths() {
+        if (hotMonths <= 0) {
+            return 0;
+        }
+        Date today;
+        int months = today.year * 12 + (today.month - 1) - (hotMonths - 1);
+        return freezeBefore(Date(1, months % 12 + 1, months / 12));
+    }
+    
+    // Copies the cold rows matching filter into results; the copies live until the next search
+    void appendColdMatches(const TransactionFilter& filter, vector<Transaction*>& results) {
+        clearColdResults();
+        coldStore.scan(filter, [&](const Transaction& t) {
+            results.push_back(keepColdCopy(t));
+        });
+    }
+    
+    void clearColdResults() {
+        for (auto t : coldResults) {
+            delete t;
+        }
+        coldResults.clear();
+    }
+    
+    Transaction* keepColdCopy(const Transaction& t) {
+        Transaction* copy = t.type == "Income" ? (Transaction*)new Income(t.amount, t.description, t.date, t.category)
+                                               : (Transaction*)new Expenditure(t.amount, t.description, t.date, t.category);
+        copy->currency = t.currency;
+        coldResults.push_back(copy);
+        return copy;
+    }
+    
+    // Live rows through the indexes, then cold rows
+    vector<Transaction*> find(const TransactionFilter& filter) {
+        vector<Transaction*> results = collect(query(filter));
+        appendColdMatches(filter, results);
+        return results;
+    }
+    
+    void addInvestment(const Investment& i) {
+        insertInvestmentAt(investments.size(), i);
+        LedgerEdit edit(LedgerEdit::ADD, investments.size() - 1, nullptr, nullptr);
+        edit.investmentAfter = investments.back();
+        history.record(edit);
+    }
+    
+    static size_t stringBytes(const string& s) {
+        // Short strings live inside the object itself
+        return s.capacity() > 15 ? s.capacity() + 1 : 0;
+    }
+    
+    // Approximate heap footprint of the ledger and the structures built on it
+    size_t memoryUsage() const {
+        size_t bytes = sizeof(*this);
+        bytes += transactions.capacity() * sizeof(Transaction*);
+        for (auto t : transactions) {
+            bytes += sizeof(Expenditure) + stringBytes(t->description) + stringBytes(t->type);
+        }
+        bytes += investments.capacity() * sizeof(Investment);
+        bytes += upcomingPayments.capacity() * sizeof(UpcomingPayment);
+        for (const auto& payment : upcomingPayments) {
+            bytes += stringBytes(payment.description);
+        }
+        bytes += descriptionSuggestions.capacity() * sizeof(string);
+        for (const auto& desc : descriptionSuggestions) {
+            // Once in the list and once as a hash map key
+            bytes += stringBytes(desc) * 2 + sizeof(pair<const string, unsigned>) + 2 * sizeof(void*);
+        }
+        bytes += recurrences.patterns.capacity() * sizeof(RecurrenceDetector::Pattern);
+        bytes += recurrences.byKey.size() * (sizeof(pair<const unsigned long long, unsigned>) + 2 * sizeof(void*));
+        bytes += indexMemoryUsage() + analyticsMemoryUsage() + coldStore.memoryUsage();
+        return bytes;
+    }
+    
+    size_t indexMemoryUsage() const {
+        size_t bytes = (transactionIndex.byDate.capacity() + transactionIndex.byAmount.capacity()) * sizeof(Transaction*);
+        bytes += transactionIndex.byCategory.capacity() * sizeof(vector<Transaction*>);
+        for (const auto& bucket : transactionIndex.byCategory) {
+            bytes += bucket.capacity() * sizeof(Transaction*);
+        }
+        bytes += transactionIndex.byDescription.capacity() * sizeof(vector<Transaction*>);
+        for (const auto& bucket : transactionIndex.byDescription) {
+            bytes += bucket.capacity() * sizeof(Transaction*);
+        }
+        const InvestmentIndex& inv = investmentIndex;
+        bytes += (inv.byAmount.capacity() + inv.byMaturity.capacity() + inv.byStart.capacity()) * sizeof(unsigned);
+        bytes += (inv.startDays.capacity() + inv.maxMaturity.capacity()) * sizeof(int);
+        for (const auto& bucket : inv.byType) {
+            bytes += bucket.capacity() * sizeof(unsigned);
+        }
+        return bytes;
+    }
+    
+    size_t analyticsMemoryUsage() const {
+        size_t bytes = (analytics.income.tree.capacity() + analytics.expense.tree.capacity()) * sizeof(double);
+        bytes += analytics.expenseByCategory.capacity() * sizeof(FenwickSeries);
+        for (const auto& series : analytics.expenseByCategory) {
+            bytes += series.tree.capacity() * sizeof(double);
+        }
+        bytes += balanceTimeline.tree.capacity() * sizeof(BalanceTimeline::Node);
+        for (const auto& byPeriod : budgets.totals) {
+            // Each hash node holds the entry plus a next pointer, and the table a bucket pointer
+            bytes += byPeriod.size() * (sizeof(pair<const int, BudgetEngine::Total>) + 2 * sizeof(void*));
+        }
+        return bytes;
+    }
+    
+    void updateMemoryGauges() const {
+        FINANCE_GAUGE_SET("ledger_memory_bytes", memoryUsage());
+        FINANCE_GAUGE_SET("index_memory_bytes", indexMemoryUsage());
+        FINANCE_GAUGE_SET("analytics_memory_bytes", analyticsMemoryUsage());
+        FINANCE_GAUGE_SET("transactions", transactions.size());
+        FINANCE_GAUGE_SET("investments", investments.size());
+        FINANCE_GAUGE_SET("cold_memory_bytes", coldStore.memoryUsage());
+        FINANCE_GAUGE_SET("cold_transactions", coldStore.rowCount());
+    }
+    
+    vector<Transaction*> searchTransactionsByDescription(const string& description) {
+        FINANCE_TIME_SCOPE("search_by_description");
+        vector<Transaction*> results;
+        for (auto t : transactions) {
+            if (t->description.find(description) != string::npos) {
+                results.push_back(t);
+            }
+        }
+        appendColdMatches(TransactionFilter::textContains(description), results);
+        return results;
+    }
+    
+    // Rows whose description contains text with at most maxDistance typos
+    // (by default one per four characters, up to three), closest match
+    // first and newest first among equally close ones. Only the distinct
+    // descriptions are compared; the index then lists their rows.
+    vector<Transaction*> searchTransactionsFuzzy(const string& text, int maxDistance = -1) {
+        FINANCE_TIME_SCOPE("search_fuzzy");
+        if (maxDistance < 0) maxDistance = FuzzyMatcher::defaultDistance(text.size());
+        FuzzyMatcher matcher(text);
+        if (transactionIndex.dirty) {
+            FINANCE_TIME_SCOPE("index_rebuild");
+            transactionIndex.rebuild(transactions);
+        }
+        
+        // Closest first, then newest; the date key is copied so sorting never follows the pointers
+        struct Match {
+            int distance;
+            int dateKey;
+            Transaction* t;
+            bool operator<(const Match& other) const {
+                if (distance != other.distance) return distance < other.distance;
+                return dateKey > other.dateKey;
+            }
+        };
+        vector<Match> ranked;
+        const vector<vector<Transaction*>>& byDescription = transactionIndex.byDescription;
+        for (size_t id = 0; id < byDescription.size(); id++) {
+            if (byDescription[id].empty()) continue;
+            int distance = matcher.distance(descriptionSuggestions[id], maxDistance);
+            if (distance > maxDistance) continue;
+            for (auto t : byDescription[id]) {
+                ranked.push_back({distance, t->date.key(), t});
+            }
+        }
+        
+        clearColdResults();
+        if (coldStore.rowCount() > 0) {
+            vector<int> distances(coldStore.dictionary.size());
+            for (size_t id = 0; id < distances.size(); id++) {
+                int distance = matcher.distance(coldStore.dictionary[id], maxDistance);
+                distances[id] = distance > maxDistance ? -1 : distance;
+            }
+            coldStore.scanDescriptions(distances, [&](const Transaction& t, int distance) {
+                ranked.push_back({distance, t.date.key(), keepColdCopy(t)});
+            });
+        }
+        
+        stable_sort(ranked.begin(), ranked.end());
+        vector<Transaction*> results;
+        results.reserve(ranked.size());
+        for (const auto& match : ranked) {
+            results.push_back(match.t);
+        }
+        FINANCE_COUNT("query_index_hits", 1);
+        return results;
+    }
+    
+    // Matches every statement against the live rows, one statement per
+    // worker thread. Statements are matched independently, so a row two of
+    // them claim goes to the earlier statement and the later line is matched
+    // again against the rows still free.
+    ReconciliationReport reconcile(const vector<Statement>& statements, int toleranceDays = 3, unsigned threads = 0) {
+        FINANCE_TIME_SCOPE("reconcile");
+        ReconciliationReport report;
+        report.statements.resize(statements.size());
+        if (statements.empty()) return report;
+        Reconciler reconciler(transactions, toleranceDays);
+        
+        if (threads == 0) threads = max(thread::hardware_concurrency(), 1u);
+        threads = (unsigned)min<size_t>(threads, statements.size());
+        atomic<size_t> next(0);
+        auto worker = [&]() {
+            for (size_t i = next++; i < statements.size(); i = next++) {
+                reconciler.reconcile(statements[i], report.statements[i]);
+            }
+        };
+        vector<thread> pool;
+        for (unsigned t = 1; t < threads; t++) pool.push_back(thread(worker));
+        worker();
+        for (auto& t : pool) t.join();
+        
+        vector<char> claimed(reconciler.rows.size(), 0);
+        size_t matched = 0;
+        int firstDay = INT_MAX, lastDay = INT_MIN;
+        for (size_t s = 0; s < statements.size(); s++) {
+            Reconciliation& result = report.statements[s];
+            vector<pair<size_t, size_t>> kept;   // line, slot
+            vector<size_t> retry;
+            for (size_t m = 0; m < result.matched.size(); m++) {
+                size_t slot = result.slots[m];
+                if (claimed[slot]) {
+                    retry.push_back(result.matched[m].first);
+                } else {
+                    claimed[slot] = 1;
+                    kept.push_back({result.matched[m].first, slot});
+                }
+            }
+            for (size_t line : retry) {
+                size_t slot = reconciler.matchLine(statements[s].lines[line], claimed);
+                if (slot < reconciler.rows.size()) {
+                    claimed[slot] = 1;
+                    kept.push_back({line, slot});
+                } else {
+                    result.unmatchedLines.push_back(line);
+                }
+            }
+            sort(kept.begin(), kept.end());
+            sort(result.unmatchedLines.begin(), result.unmatchedLines.end());
+            result.matched.clear();
+            result.slots.clear();
+            for (const auto& match : kept) {
+                result.matched.push_back({match.first, reconciler.rows[match.second].row});
+                result.slots.push_back(match.second);
+            }
+            matched += kept.size();
+            for (const auto& line : statements[s].lines) {
+                firstDay = min(firstDay, line.date.dayNumber());
+                lastDay = max(lastDay, line.date.dayNumber());
+            }
+        }
+        for (size_t slot = 0; slot < reconciler.rows.size(); slot++) {
+            int day = reconciler.rows[slot].day;
+            if (day >= firstDay && day <= lastDay && !claimed[slot]) report.unmatchedRows.push_back(reconciler.rows[slot].row);
+        }
+        sort(report.unmatchedRows.begin(), report.unmatchedRows.end(), [](Transaction* a, Transaction* b) {
+            return a->date.key() < b->date.key();
+        });
+        FINANCE_COUNT("statement_lines_matched", matched);
+        return report;
+    }
+    
+    // Adds statement lines to the ledger, e.g. the ones reconciliation left
+    // unmatched. Spaces become underscores, as saved descriptions cannot hold them.
+    size_t importStatementLines(const Statement& statement, const vector<size_t>& lines) {
+        size_t added = 0;
+        for (size_t i : lines) {
+            const StatementLine& line = statement.lines[i];
+            if (line.amount == 0) continue;
+            string description = line.description.empty() ? "Imported" : line.description;
+            replace(description.begin(), description.end(), ' ', '_');
+            if (line.amount > 0) addTransaction(new Income(line.amount, description, line.date));
+            else addTransaction(new Expenditure(-line.amount, description, line.date));
+            added++;
+        }
+        return added;
+    }
+    
+    // Pairs of live rows that look like one payment entered twice: same type
+    // and amount, dates within toleranceDays and similar descriptions
+    vector<pair<Transaction*, Transaction*>> findDuplicateRows(int toleranceDays = 1) {
+        FINANCE_TIME_SCOPE("find_duplicates");
+        Reconciler reconciler(transactions, toleranceDays);
+        vector<pair<Transaction*, Transaction*>> pairs;
+        const vector<Reconciler::Candidate>& rows = reconciler.rows;
+        for (size_t i = 0; i < rows.size(); i++) {
+            for (size_t j = i + 1; j < rows.size() && rows[j].cents == rows[i].cents && rows[j].day - rows[i].day <= toleranceDays; j++) {
+                if (rows[i].row->descriptionId == rows[j].row->descriptionId ||
+                    Reconciler::similarDescriptions(rows[i].row->description, rows[j].row->description)) {
+                    pairs.push_back({rows[i].row, rows[j].row});
+                }
+            }
+        }
+        sort(pairs.begin(), pairs.end(), [](const pair<Transaction*, Transaction*>& a, const pair<Transaction*, Transaction*>& b) {
+            return a.first->date.key() < b.first->date.key();
+        });
+        return pairs;
+    }
+    
+    // A live row t would duplicate, or null; checked before recording t
+    Transaction* looksLikeDuplicate(const Transaction& t, int toleranceDays = 1) {
+        if (transactionIndex.dirty) {
+            FINANCE_TIME_SCOPE("index_rebuild");
+            transactionIndex.rebuild(transactions);
+        }
+        const vector<Transaction*>& byAmount = transactionIndex.byAmount;
+        auto first = lower_bound(byAmount.begin(), byAmount.end(), t.amount,
+                                 [](Transaction* row, double amount) { return row->amount < amount; });
+        int day = t.date.dayNumber();
+        for (auto it = first; it != byAmount.end() && (*it)->amount == t.amount; ++it) {
+            Transaction* row = *it;
+            if (row->type == t.type && abs(row->date.dayNumber() - day) <= toleranceDays &&
+                Reconciler::similarDescriptions(row->description, t.description)) {
+                return row;
+            }
+        }
+        return nullptr;
+    }
+    
+    // The k expenses matching filter with the largest base-currency amounts,
+    // largest first, or the smallest ones, smallest first. A bounded heap
+    // keeps the best k seen so far, so nothing is sorted or reordered.
+    vector<Transaction*> topExpenses(size_t k, bool largest = true, const TransactionFilter& filter = TransactionFilter()) {
+        FINANCE_TIME_SCOPE("top_expenses");
+        if (k == 0) return vector<Transaction*>();
+        struct Ranked {
+            double amount;
+            Transaction* t;
+            bool cold;   // a copy owned by the heap until it is kept
+        };
+        auto better = [largest](const Ranked& a, const Ranked& b) {
+            return largest ? a.amount > b.amount : a.amount < b.amount;
+        };
+        vector<Ranked> heap;   // worst of the best k on top
+        auto admits = [&](double amount) {
+            return heap.size() < k || better(Ranked{amount, nullptr, false}, heap.front());
+        };
+        auto offer = [&](const Ranked& candidate) {
+            if (heap.size() == k) {
+                pop_heap(heap.begin(), heap.end(), better);
+                if (heap.back().cold) delete heap.back().t;
+                heap.pop_back();
+            }
+            heap.push_back(candidate);
+            push_heap(heap.begin(), heap.end(), better);
+        };
+        
+        vector<TransactionFilter> criteria = {filter, TransactionFilter::typeIs("Expenditure")};
+        TransactionFilter expenses = TransactionFilter::allOf(criteria);
+        bool baseOnly = currencies().size() == 1;
+        if (baseOnly) {
+            // Amounts are already comparable, so walk the amount index from the
+            // right end and stop at the k-th match
+            if (transactionIndex.dirty) {
+                FINANCE_TIME_SCOPE("index_rebuild");
+                transactionIndex.rebuild(transactions);
+            }
+            const vector<Transaction*>& byAmount = transactionIndex.byAmount;
+            for (size_t i = 0; i < byAmount.size() && heap.size() < k; i++) {
+                Transaction* t = byAmount[largest ? byAmount.size() - 1 - i : i];
+                if (expenses.matches(t)) offer({t->amount, t, false});
+            }
+            // Cold blocks that cannot beat the k-th amount are skipped by their zone maps
+            if (heap.size() == k) {
+                double bound = heap.front().amount;
+                criteria.push_back(largest ? TransactionFilter::amountRange(bound, numeric_limits<double>::max())
+                                           : TransactionFilter::amountRange(-numeric_limits<double>::max(), bound));
+                expenses = TransactionFilter::allOf(criteria);
+            }
+        } else {
+            TransactionCursor cursor = query(expenses);
+            while (Transaction* t = cursor.next()) {
+                double amount = t->amount * rateFor(*t);
+                if (admits(amount)) offer({amount, t, false});
+            }
+        }
+        clearColdResults();
+        coldStore.scan(expenses, [&](const Transaction& t) {
+            double amount = t.amount * rateFor(t);
+            if (!admits(amount)) return;
+            Transaction* copy = new Expenditure(t.amount, t.description, t.date, t.category);
+            copy->currency = t.currency;
+            offer({amount, copy, true});
+        });
+        
+        sort_heap(heap.begin(), heap.end(), better);
+        vector<Transaction*> results;
+        for (const auto& ranked : heap) {
+            if (ranked.cold) coldResults.push_back(ranked.t);
+            results.push_back(ranked.t);
+        }
+        return results;
+    }
+    
+    // Exact q-quantile (nearest rank) of the base-currency amounts of the
+    // expenses matching filter. nth_element selects it without a full sort.
+    double expenseQuantile(double q, const TransactionFilter& filter = TransactionFilter()) {
+        FINANCE_TIME_SCOPE("expense_quantile");
+        vector<TransactionFilter> criteria = {filter, TransactionFilter::typeIs("Expenditure")};
+        TransactionFilter expenses = TransactionFilter::allOf(criteria);
+        vector<double> amounts;
+        TransactionCursor cursor = query(expenses);
+        while (Transaction* t = cursor.next()) {
+            amounts.push_back(t->amount * rateFor(*t));
+        }
+        coldStore.scan(expenses, [&](const Transaction& t) {
+            amounts.push_back(t.amount * rateFor(t));
+        });
+        if (amounts.empty()) return 0;
+        size_t rank = (size_t)ceil(min(max(q, 0.0), 1.0) * amounts.size());
+        size_t nth = rank > 0 ? rank - 1 : 0;
+        nth_element(amounts.begin(), amounts.begin() + nth, amounts.end());
+        return amounts[nth];
+    }
+    
+    // Approximate q-quantile of expenses in the months from..to, for one
+    // category and its sub-categories or for all spending (-1), merged from
+    // the monthly digests without touching the rows
+    double estimateExpenseQuantile(double q, const Date& from, const Date& to, int category = -1) {
+        FINANCE_TIME_SCOPE("expense_quantile_estimate");
+        TDigest digest = expenseDigests.merged(ExpenseDigests::monthIndex(from), ExpenseDigests::monthIndex(to), category,
+                                               [this](int month, int cellCategory, TDigest& cell) {
+            rebuildDigest(month, cellCategory, cell);
+        });
+        return digest.quantile(q);
+    }
+    
+    void rebuildDigest(int month, int category, TDigest& digest) {
+        FINANCE_COUNT("digest_rebuilds", 1);
+        Date first(1, month % 12 + 1, month / 12);
+        Date last(Date::daysInMonth(first.month, first.year), first.month, first.year);
+        vector<TransactionFilter> criteria = {TransactionFilter::dateRange(first, last), TransactionFilter::typeIs("Expenditure")};
+        TransactionFilter filter = TransactionFilter::allOf(criteria);
+        TransactionCursor cursor = query(filter);
+        while (Transaction* t = cursor.next()) {
+            if (t->category == category) digest.add(t->amount * rateFor(*t));
+        }
+        coldStore.scan(filter, [&](const Transaction& t) {
+            if (t.category == category) digest.add(t.amount * rateFor(t));
+        });
+    }
+    
+    vector<Transaction*> searchTransactionsByDate(const Date& date) {
+        FINANCE_TIME_SCOPE("search_by_date");
+        return find(TransactionFilter::dateRange(date, date));
+    }
+    
+    vector<Transaction*> searchTransactionsByCategory(CategoryType category) {
+        FINANCE_TIME_SCOPE("search_by_category");
+        return find(TransactionFilter::inCategories(vector<CategoryType>(1, category)));
+    }
+    
+    TransactionCursor fullScan(const TransactionFilter& filter) {
+        TransactionCursor cursor;
+        TransactionCursor::Source source;
+        source.ranges.push_back({transactions.data(), transactions.data() + transactions.size()});
+        source.checks.push_back(&filter);
+        cursor.sources.push_back(source);
+        cursor.cost = transactions.size();
+        cursor.indexed = false;
+        return cursor;
+    }
+    
+    static TransactionCursor indexRange(const TransactionFilter& filter, const vector<Transaction*>& ordered, size_t first, size_t last) {
+        TransactionCursor cursor;
+        TransactionCursor::Source source;
+        if (last < first) last = first;
+        source.ranges.push_back({ordered.data() + first, ordered.data() + last});
+        source.checks.push_back(&filter);
+        cursor.sources.push_back(source);
+        cursor.cost = last - first;
+        cursor.indexed = true;
+        return cursor;
+    }
+    
+    // Chooses the candidate source with the smallest estimated row count.
+    // Range sizes come straight from binary searches on the sorted indexes.
+    TransactionCursor plan(const TransactionFilter& filter) {
+        switch (filter.kind) {
+            case TransactionFilter::DATE_RANGE: {
+                const vector<Transaction*>& byDate = transactionIndex.byDate;
+                size_t first = lower_bound(byDate.begin(), byDate.end(), filter.fromKey,
+                    [](Transaction* t, int key) { return t->date.key() < key; }) - byDate.begin();
+                size_t last = upper_bound(byDate.begin(), byDate.end(), filter.toKey,
+                    [](int key, Transaction* t) { return key < t->date.key(); }) - byDate.begin();
+                return indexRange(filter, byDate, first, last);
+            }
+            case TransactionFilter::AMOUNT_RANGE: {
+                const vector<Transaction*>& byAmount = transactionIndex.byAmount;
+                size_t first = lower_bound(byAmount.begin(), byAmount.end(), filter.minAmount,
+                    [](Transaction* t, double amount) { return t->amount < amount; }) - byAmount.begin();
+                size_t last = upper_bound(byAmount.begin(), byAmount.end(), filter.maxAmount,
+                    [](double amount, Transaction* t) { return amount < t->amount; }) - byAmount.begin();
+                return indexRange(filter, byAmount, first, last);
+            }
+            case TransactionFilter::CATEGORY_SET: {
+                TransactionCursor cursor;
+                TransactionCursor::Source source;
+                size_t buckets = min(filter.categoryMask.size(), transactionIndex.byCategory.size());
+                for (size_t id = 0; id < buckets; id++) {
+                    const vector<Transaction*>& bucket = transactionIndex.byCategory[id];
+                    if (filter.categoryMask[id] && !bucket.empty()) {
+                        source.ranges.push_back({bucket.data(), bucket.data() + bucket.size()});
+                        cursor.cost += bucket.size();
+                    }
+                }
+                source.checks.push_back(&filter);
+                cursor.sources.push_back(source);
+                cursor.indexed = true;
+                return cursor;
+            }
+            case TransactionFilter::ALL_OF: {
+                if (filter.children.empty()) {
+                    return fullScan(filter);
+                }
+                TransactionCursor best = plan(filter.children[0]);
+                for (size_t i = 1; i < filter.children.size(); i++) {
+                    TransactionCursor candidate = plan(filter.children[i]);
+                    if (candidate.cost < best.cost) {
+                        best = candidate;
+                    }
+                }
+                for (auto& source : best.sources) {
+                    source.checks.push_back(&filter);
+                }
+                return best;
+            }
+            case TransactionFilter::ANY_OF: {
+                TransactionCursor merged;
+                merged.indexed = true;
+                for (const auto& child : filter.children) {
+                    TransactionCursor candidate = plan(child);
+                    if (!candidate.indexed) {
+                        return fullScan(filter);
+                    }
+                    merged.sources.insert(merged.sources.end(), candidate.sources.begin(), candidate.sources.end());
+                    merged.cost += candidate.cost;
+                }
+                if (merged.cost >= transactions.size() && !filter.children.empty()) {
+                    return fullScan(filter);
+                }
+                return merged;
+            }
+            default:
+                return fullScan(filter);
+        }
+    }
+    
+    // The filter must outlive the returned cursor
+    TransactionCursor query(const TransactionFilter& filter) {
+        if (transactionIndex.dirty) {
+            FINANCE_TIME_SCOPE("index_rebuild");
+            transactionIndex.rebuild(transactions);
+        }
+        TransactionCursor cursor = plan(filter);
+        if (cursor.indexed) {
+            FINANCE_COUNT("query_index_hits", 1);
+        } else {
+            FINANCE_COUNT("query_full_scans", 1);
+        }
+        return cursor;
+    }
+    
+    static vector<Transaction*> collect(TransactionCursor cursor) {
+        vector<Transaction*> results;
+        while (Transaction* t = cursor.next()) {
+            results.push_back(t);
+        }
+        return results;
+    }
+    
+    vector<Investment*> searchInvestmentsByAmountRange(double minAmount, double maxAmount) {
+        FINANCE_TIME_SCOPE("search_investments_by_amount");
+        vector<Investment*> results;
+        ensureInvestmentIndex();
+        investmentIndex.amountRange(investments, minAmount, maxAmount, [&](unsigned p) {
+            results.push_back(&investments[p]);
+        });
+        return results;
+    }
+    
+    vector<Investment*> searchInvestmentsByType(const string& type) {
+        FINANCE_TIME_SCOPE("search_investments_by_type");
+        vector<Investment*> results;
+        int index = productIndex(type);
+        ensureInvestmentIndex();
+        if (index >= 0 && index < (int)investmentIndex.byType.size()) {
+            for (unsigned p : investmentIndex.byType[index]) {
+                results.push_back(&investments[p]);
+            }
+        }
+        return results;
+    }
+    
+    // Earliest maturity first
+    vector<Investment*> searchInvestmentsMaturingBetween(const Date& from, const Date& to) {
+        FINANCE_TIME_SCOPE("search_investments_by_maturity");
+        vector<Investment*> results;
+        ensureInvestmentIndex();
+        investmentIndex.maturingBetween(investments, from.dayNumber(), to.dayNumber(), [&](unsigned p) {
+            results.push_back(&investments[p]);
+        });
+        return results;
+    }
+    
+    // Started on or before date and not yet matured
+    vector<Investment*> searchInvestmentsActiveOn(const Date& date) {
+        FINANCE_TIME_SCOPE("search_investments_active");
+        vector<Investment*> results;
+        ensureInvestmentIndex();
+        if (investmentIndex.treeDirty) {
+            investmentIndex.buildTree(investments);
+        }
+        investmentIndex.activeOn(date.dayNumber(), [&](unsigned p) {
+            results.push_back(&investments[p]);
+        });
+        return results;
+    }
+    
+    void ensureInvestmentIndex() {
+        if (investmentIndex.dirty) {
+            FINANCE_TIME_SCOPE("index_rebuild");
+            investmentIndex.rebuild(investments);
+        }
+        FINANCE_COUNT("query_index_hits", 1);
+    }
+    
+    // Investments maturing in [from, to], grouped by month with the amount due
+    void displayMaturityCalendar(const Date& from, const Date& to) {
+        vector<Investment*> maturing = searchInvestmentsMaturingBetween(from, to);
+        if (maturing.empty()) {
+            cout << "No investments mature between " << from << " and " << to << "." << endl;
+            return;
+        }
+        size_t first = 0;
+        while (first < maturing.size()) {
+            Date month = Date::fromDayNumber(maturing[first]->maturityDay());
+            size_t last = first;
+            double due = 0.0;
+            while (last < maturing.size()) {
+                Date date = Date::fromDayNumber(maturing[last]->maturityDay());
+                if (date.month != month.month || date.year != month.year) break;
+                due += maturing[last]->maturityAmount() * fx.rate(maturing[last]->currency, maturing[last]->startDate.dayNumber());
+                last++;
+            }
+            cout << "\n" << month.month << "/" << month.year << ": " << last - first << " maturing, "
+                 << fixed << setprecision(2) << due << " due" << endl;
+            showInvestments("", vector<Investment*>(maturing.begin() + first, maturing.begin() + last));
+            first = last;
+        }
+    }
+    
+    void displayTransactionSearchResults(const vector<Transaction*>& results) {
+        if (results.empty()) {
+            cout << "No matching transactions found." << endl;
+            return;
+        }
+        
+        showTransactions("\n--SEARCH RESULTS--\n", results);
+    }
+    
+    void displayInvestmentSearchResults(const vector<Investment*>& results) {
+        if (results.empty()) {
+            cout << "No matching investments found." << endl;
+            return;
+        }
+        
+        showInvestments("\n--SEARCH RESULTS--\n", results);
+    }
+    
+    void showTransactions(const string& title, const vector<Transaction*>& rows, bool withIndex = false) {
+        Pager pager;
+        pager.show(title + Transaction::header(withIndex), rows.size(), [&](size_t row, OutputBuffer& out) {
+            if (withIndex) out.appendInt(row, 5);
+            rows[row]->format(out);
+        });
+    }
+    
+    void showInvestments(const string& title, const vector<Investment*>& rows, bool withIndex = false) {
+        Pager pager;
+        pager.show(title + Investment::header(withIndex), rows.size(), [&](size_t row, OutputBuffer& out) {
+            if (withIndex) out.appendInt(row, 5);
+            rows[row]->format(out);
+        });
+    }
+    
+    void showInvestments(const string& title, const vector<Investment>& rows, bool withIndex = false) {
+        Pager pager;
+        pager.show(title + Investment::header(withIndex), rows.size(), [&](size_t row, OutputBuffer& out) {
+            if (withIndex) out.appendInt(row, 5);
+            rows[row].format(out);
+        });
+    }
+    
+    // What every investment will be worth when it matures
+    double portfolioMaturityValue() const {
+        double total = 0.0;
+        for (const auto& i : investments) {
+            total += i.maturityAmount() * fx.rate(i.currency, i.startDate.dayNumber());
+        }
+        return total;
+    }
+    
+    // The removed row is kept by the edit history for undo
+    bool deleteTransaction(int index) {
+        if (index < 0 || index >= transactions.size()) {
+            return false;
+        }
+        
+        Transaction* removed = removeTransactionAt(index);
+        history.record(LedgerEdit(LedgerEdit::DELETE, index, removed, nullptr));
+        return true;
+    }
+    
+    bool deleteInvestment(int index) {
+        if (index < 0 || index >= investments.size()) {
+            return false;
+        }
+        
+        LedgerEdit edit(LedgerEdit::DELETE, index, nullptr, nullptr);
+        edit.investmentBefore = investments[index];
+        removeInvestmentAt(index);
+        history.record(edit);
+        return true;
+    }
+    
+    bool updateTransaction(int index, Transaction* newTransaction) {
+        if (index < 0 || index >= transactions.size()) {
+            return false;
+        }
+        
+        categorize(newTransaction);
+        Transaction* old = replaceTransactionAt(index, newTransaction);
+        history.record(LedgerEdit(LedgerEdit::UPDATE, index, old, newTransaction));
+        return true;
+    }
+    
+    bool updateInvestment(int index, const Investment& newInvestment) {
+        if (index < 0 || index >= investments.size()) {
+            return false;
+        }
+        
+        LedgerEdit edit(LedgerEdit::UPDATE, index, nullptr, nullptr);
+        edit.investmentBefore = investments[index];
+        replaceInvestmentAt(index, newInvestment);
+        edit.investmentAfter = investments[index];
+        history.record(edit);
+        return true;
+    }
+    
+    // Row edits shared by the public edits and by undo/redo, which must not record
+    void insertTransactionAt(size_t index, Transaction* t) {
+        index = min(index, transactions.size());
+        transactions.insert(transactions.begin() + index, t);
+        transactionSegments.markFrom(index);
+        track(t);
+        syncTransactionWrite(t);
+    }
+    
+    Transaction* removeTransactionAt(size_t index) {
+        Transaction* t = transactions[index];
+        untrack(t);
+        transactions.erase(transactions.begin() + index);
+        transactionSegments.markFrom(index);
+        syncRemoval(t->recordId, 'T');
+        return t;
+    }
+    
+    // The replacement takes over the record id, so other replicas see an update
+    Transaction* replaceTransactionAt(size_t index, Transaction* t) {
+        Transaction* old = transactions[index];
+        untrack(old);
+        transactions[index] = t;
+        transactionSegments.markRow(index);
+        track(t);
+        t->recordId = old->recordId;
+        syncTransactionWrite(t);
+        return old;
+    }
+    
+    void insertInvestmentAt(size_t index, const Investment& i) {
+        index = min(index, investments.size());
+        investments.insert(investments.begin() + index, i);
+        syncInvestmentWrite(investments[index]);
+        if (index + 1 == investments.size()) {
+            investmentIndex.insert(investments, index);
+            investmentSegments.markRow(index);
+        } else {
+            investmentIndex.markDirty();
+            investmentSegments.markFrom(index);
+        }
+        trackInvestment(i, 1);
+    }
+    
+    void removeInvestmentAt(size_t index) {
+        trackInvestment(investments[index], -1);
+        syncRemoval(investments[index].recordId, 'I');
+        investments.erase(investments.begin() + index);
+        investmentIndex.markDirty();
+        investmentSegments.markFrom(index);
+    }
+    
+    void replaceInvestmentAt(size_t index, const Investment& i) {
+        trackInvestment(investments[index], -1);
+        investmentIndex.erase(investments, index);
+        unsigned long long recordId = investments[index].recordId;
+        investments[index] = i;
+        investments[index].recordId = recordId;
+        syncInvestmentWrite(investments[index]);
+        investmentIndex.insert(investments, index);
+        trackInvestment(i, 1);
+        investmentSegments.markRow(index);
+    }
+    
+    // Every change to a live row goes through these, so each one becomes a sync write
+    void syncTransactionWrite(Transaction* t) {
+        if (!sync.enabled()) return;
+        if (!t->recordId) t->recordId = sync.newRecordId();
+        sync.liveRows[t->recordId] = t;
+        sync.write(t->recordId, 'T', false);
+    }
+    
+    void syncInvestmentWrite(Investment& i) {
+        if (!sync.enabled()) return;
+        if (!i.recordId) i.recordId = sync.newRecordId();
+        sync.write(i.recordId, 'I', false);
+    }
+    
+    void syncRemoval(unsigned long long recordId, char kind) {
+        if (!sync.enabled()) return;
+        if (kind == 'T') sync.liveRows.erase(recordId);
+        sync.write(recordId, kind, true);
+    }
+    
+    // Sorting moves rows, so an edited row is looked for at its old position first
+    size_t positionOf(const Transaction* t, size_t hint) const {
+        if (hint < transactions.size() && transactions[hint] == t) return hint;
+        return std::find(transactions.begin(), transactions.end(), t) - transactions.begin();
+    }
+    
+    static bool sameInvestment(const Investment& a, const Investment& b) {
+        return a.amount == b.amount && a.duration == b.duration && a.startDate.dayNumber() == b.startDate.dayNumber()
+            && a.currency == b.currency && a.product.index() == b.product.index() && a.monthly() == b.monthly();
+    }
+    
+    size_t positionOf(const Investment& i, size_t hint) const {
+        if (hint < investments.size() && sameInvestment(investments[hint], i)) return hint;
+        for (size_t p = 0; p < investments.size(); p++) {
+            if (sameInvestment(investments[p], i)) return p;
+        }
+        return investments.size();
+    }
+    
+    // Takes out what an edit put in and puts back what it took out
+    bool revert(const LedgerEdit& edit, bool undoing) {
+        Transaction* out = undoing ? edit.after : edit.before;
+        Transaction* in = undoing ? edit.before : edit.after;
+        const optional<Investment>& investmentOut = undoing ? edit.investmentAfter : edit.investmentBefore;
+        const optional<Investment>& investmentIn = undoing ? edit.investmentBefore : edit.investmentAfter;
+        if (edit.isInvestment()) {
+            size_t at = edit.position;
+            if (investmentOut) {
+                at = positionOf(*investmentOut, edit.position);
+                if (at == investments.size()) return false;
+            }
+            if (investmentOut && investmentIn) replaceInvestmentAt(at, *investmentIn);
+            else if (investmentOut) removeInvestmentAt(at);
+            else insertInvestmentAt(at, *investmentIn);
+            return true;
+        }
+        size_t at = edit.position;
+        if (out) {
+            at = positionOf(out, edit.position);
+            if (at == transactions.size()) return false;
+        }
+        if (out && in) replaceTransactionAt(at, in);
+        else if (out) removeTransactionAt(at);
+        else insertTransactionAt(at, in);
+        return true;
+    }
+    
+    bool undo() {
+        if (!history.canUndo() || !revert(history.edits[history.applied - 1], true)) {
+            return false;
+        }
+        history.applied--;
+        return true;
+    }
+    
+    bool redo() {
+        if (!history.canRedo() || !revert(history.edits[history.applied], false)) {
+            return false;
+        }
+        history.applied++;
+        return true;
+    }
+    
+    // The live transactions as they stood at an earlier or undone version.
+    // Rows added since are left out and rows removed since come back at the
+    // end; the objects themselves are still held by the history.
+    bool transactionsAsOf(size_t version, vector<Transaction*>& rows) const {
+        if (version < history.oldestVersion() || version > history.newestVersion()) {
+            return false;
+        }
+        unordered_set<const Transaction*> gone;
+        vector<Transaction*> back;
+        auto take = [&](Transaction* out, Transaction* in) {
+            if (out) gone.insert(out);
+            if (in) {
+                if (!gone.erase(in)) back.push_back(in);
+            }
+        };
+        size_t target = version - history.forgotten;
+        for (size_t e = history.applied; e > target; e--) {
+            take(history.edits[e - 1].after, history.edits[e - 1].before);
+        }
+        for (size_t e = history.applied; e < target; e++) {
+            take(history.edits[e].before, history.edits[e].after);
+        }
+        rows.clear();
+        for (auto t : transactions) {
+            if (!gone.count(t)) rows.push_back(t);
+        }
+        for (auto t : back) {
+            if (!gone.count(t)) rows.push_back(t);
+        }
+        return true;
+    }
+    
+    // One line per remembered edit; * marks the current version
+    void displayHistory() {
+        if (history.edits.empty()) {
+            cout << "No edits since the ledger was loaded." << endl;
+            return;
+        }
+        const char* verbs[] = {"Added", "Deleted", "Updated"};
+        for (size_t e = 0; e < history.edits.size(); e++) {
+            const LedgerEdit& edit = history.edits[e];
+            OutputBuffer out;
+            out.append(e + 1 == history.applied ? "* " : "  ");
+            out.appendField(to_string(history.forgotten + e + 1), 6);
+            out.append(e < history.applied ? "  " : "  (undone) ");
+            out.append(verbs[edit.kind]);
+            out.append(edit.isInvestment() ? " investment" : " transaction");
+            out.newline();
+            if (edit.isInvestment()) {
+                if (edit.investmentBefore) edit.investmentBefore->format(out);
+                if (edit.investmentAfter) edit.investmentAfter->format(out);
+            } else {
+                if (edit.before) edit.before->format(out);
+                if (edit.after) edit.after->format(out);
+            }
+            out.flush(cout);
+        }
+    }
+    
+    // Makes this ledger a sync replica. Every row gets a record id and a first
+    // write, so the first sync sends the whole ledger; archived rows are sent
+    // as they are but never change again.
+    void enableSync() {
+        if (sync.enabled()) return;
+        random_device device;
+        mt19937 random(device() ^ (unsigned)HybridClock::physicalNow());
+        while (!sync.replica) {
+            sync.replica = random() & 0x7fffffff;
+        }
+        for (auto t : transactions) {
+            syncTransactionWrite(t);
+        }
+        for (auto& i : investments) {
+            syncInvestmentWrite(i);
+        }
+        size_t coldRows = coldStore.rowCount();
+        for (size_t row = 0; row < coldRows; row++) {
+            unsigned long long id = sync.newRecordId();
+            sync.write(id, 'T', false);
+            sync.records[id].coldRow = row;
+        }
+        // Every row now carries its id
+        transactionSegments.markAll();
+        investmentSegments.markAll();
+    }
+    
+    // After loading, finds the row of each live record. Rows the saved sync
+    // state does not know get a first write.
+    void attachSyncRows() {
+        if (!sync.enabled()) return;
+        for (size_t row = 0; row < transactions.size(); row++) {
+            Transaction* t = transactions[row];
+            auto found = sync.records.find(t->recordId);
+            if (found != sync.records.end() && !found->second.deleted && found->second.coldRow < 0) {
+                sync.liveRows[t->recordId] = t;
+                continue;
+            }
+            if (!t->recordId) transactionSegments.markRow(row);
+            syncTransactionWrite(t);
+        }
+        for (size_t row = 0; row < investments.size(); row++) {
+            Investment& i = investments[row];
+            auto found = sync.records.find(i.recordId);
+            if (found != sync.records.end() && !found->second.deleted) continue;
+            if (!i.recordId) investmentSegments.markRow(row);
+            syncInvestmentWrite(i);
+        }
+    }
+    
+    // Archived rows keep their records, now pointing into the cold store
+    void archiveSyncRows(const vector<Transaction*>& frozen, size_t firstColdRow) {
+        if (!sync.enabled()) return;
+        for (size_t i = 0; i < frozen.size(); i++) {
+            auto found = sync.records.find(frozen[i]->recordId);
+            if (found == sync.records.end()) continue;
+            found->second.coldRow = firstColdRow + i;
+            sync.liveRows.erase(found->first);
+            sync.changedRecords.insert(found->first);
+            sync.changed = true;
+        }
+    }
+    
+    // The writes a replica that has seen peerSeen is missing. Fails if a
+    // record has lost its row, rather than sending a delta that leaves it out
+    // while its version vector claims it.
+    bool syncDelta(const map<unsigned, unsigned long long>& peerSeen, vector<SyncOp>& ops) {
+        FINANCE_TIME_SCOPE("sync_delta");
+        ops.clear();
+        vector<unsigned long long> ids = sync.missingFrom(peerSeen);
+        if (ids.empty()) {
+            return true;
+        }
+        unordered_map<unsigned long long, size_t> investmentRows;
+        for (size_t row = 0; row < investments.size(); row++) {
+            investmentRows[investments[row].recordId] = row;
+        }
+        vector<pair<size_t, size_t>> archived;   // (cold row, op)
+        ostringstream row;
+        row.precision(15);
+        ops.reserve(ids.size());
+        for (auto id : ids) {
+            const SyncRecord& record = sync.records.at(id);
+            SyncOp op{id, record.stamp, record.sequence, record.kind, record.deleted, ""};
+            if (!record.deleted) {
+                row.str("");
+                if (record.coldRow >= 0) {
+                    archived.push_back({(size_t)record.coldRow, ops.size()});
+                } else if (record.kind == 'T') {
+                    auto live = sync.liveRows.find(id);
+                    if (live == sync.liveRows.end()) return false;
+                    writeTransactionRow(row, *live->second);
+                } else {
+                    auto live = investmentRows.find(id);
+                    if (live == investmentRows.end()) return false;
+                    writeInvestmentRow(row, investments[live->second]);
+                }
+                op.row = row.str();
+            }
+            ops.push_back(op);
+        }
+        
+        // Archived rows are decoded a block at a time, in cold store order
+        sort(archived.begin(), archived.end());
+        size_t next = 0, first = 0;
+        for (size_t b = 0; b < coldStore.blocks.size() && next < archived.size(); b++) {
+            size_t end = first + coldStore.blocks[b].rows;
+            if (archived[next].first < end) {
+                const vector<ColdRow>& decoded = coldStore.decode(b);
+                for (; next < archived.size() && archived[next].first < end; next++) {
+                    row.str("");
+                    writeTransactionRow(row, coldStore.materialize(decoded[archived[next].first - first]));
+                    ops[archived[next].second].row = row.str();
+                }
+            }
+            first = end;
+        }
+        return next == archived.size();
+    }
+    
+    // Applies writes from another replica and returns how many landed. A write
+    // only lands if it is later than the one held for its record, so merges
+    // can come in any order and repeating one changes nothing. Changing or
+    // removing rows this replica already had starts a fresh undo history.
+    // Every row is parsed first: a delta with a malformed row is rejected
+    // whole, so nothing in it is marked as seen without being applied.
+    bool mergeSync(const vector<SyncOp>& ops, const map<unsigned, unsigned long long>& senderSeen, size_t& merged) {
+        FINANCE_TIME_SCOPE("sync_merge");
+        merged = 0;
+        vector<Transaction*> rows(ops.size(), nullptr);
+        vector<optional<Investment>> investmentRows(ops.size());
+        istringstream in;
+        for (size_t i = 0; i < ops.size(); i++) {
+            const SyncOp& op = ops[i];
+            bool ok = op.kind == 'T' || op.kind == 'I';
+            if (ok && !op.deleted) {
+                in.clear();
+                in.str(op.row);
+                double amount;
+                ok = op.kind == 'T' ? (rows[i] = readTransactionRow(in)) != nullptr
+                                    : readInvestmentRow(in, investmentRows[i], amount) && investmentRows[i];
+            }
+            if (!ok) {
+                for (auto t : rows) delete t;
+                return false;
+            }
+        }
+        
+        vector<size_t> accepted;
+        for (size_t i = 0; i < ops.size(); i++) {
+            if (sync.accept(ops[i])) {
+                accepted.push_back(i);
+            } else {
+                delete rows[i];
+                rows[i] = nullptr;
+            }
+        }
+        sync.advance(senderSeen);
+        if (accepted.empty()) {
+            return true;
+        }
+        
+        // Rows this merge replaces or removes, found in one pass over the ledger
+        unordered_map<Transaction*, size_t> positions;
+        bool touchesInvestments = false;
+        for (size_t i : accepted) {
+            const SyncOp& op = ops[i];
+            if (op.kind == 'T') {
+                auto live = sync.liveRows.find(op.record);
+                if (live != sync.liveRows.end()) positions[live->second] = transactions.size();
+            } else {
+                for (const auto& investment : investments) touchesInvestments |= investment.recordId == op.record;
+            }
+        }
+        if (!positions.empty() || touchesInvestments) {
+            history.clear();
+        }
+        size_t pending = positions.size();
+        for (size_t row = 0; row < transactions.size() && pending > 0; row++) {
+            auto found = positions.find(transactions[row]);
+            if (found != positions.end()) {
+                found->second = row;
+                pending--;
+            }
+        }
+        
+        sync.applying = true;
+        vector<size_t> removed;
+        for (size_t i : accepted) {
+            const SyncOp& op = ops[i];
+            if (op.kind == 'I') {
+                applyInvestmentWrite(op, investmentRows[i]);
+                continue;
+            }
+            Transaction* replacement = rows[i];
+            if (replacement) {
+                replacement->recordId = op.record;
+                if (replacement->type == "Expenditure" && !replacement->autoCategorized) {
+                    categorizer.learn(replacement->description, replacement->category);
+                }
+            }
+            auto live = sync.liveRows.find(op.record);
+            if (live == sync.liveRows.end()) {
+                if (replacement) insertTransactionAt(transactions.size(), replacement);
+                continue;
+            }
+            // New rows only go on the end, so positions found up front stay right
+            size_t at = positions[live->second];
+            if (replacement) {
+                delete replaceTransactionAt(at, replacement);
+                positions[replacement] = at;
+            } else {
+                sync.liveRows.erase(live);
+                removed.push_back(at);
+            }
+        }
+        
+        // Deleted rows are taken out in one pass
+        if (!removed.empty()) {
+            sort(removed.begin(), removed.end());
+            for (size_t at : removed) {
+                untrack(transactions[at]);
+                delete transactions[at];
+                transactions[at] = nullptr;
+            }
+            transactions.erase(std::remove(transactions.begin(), transactions.end(), nullptr), transactions.end());
+            transactionSegments.markFrom(removed[0]);
+        }
+        sync.applying = false;
+        FINANCE_COUNT("sync_writes_merged", accepted.size());
+        merged = accepted.size();
+        return true;
+    }
+    
+    // replacement is the parsed row, empty for a delete
+    void applyInvestmentWrite(const SyncOp& op, optional<Investment> replacement) {
+        size_t at = 0;
+        while (at < investments.size() && investments[at].recordId != op.record) {
+            at++;
+        }
+        if (replacement) {
+            replacement->recordId = op.record;
+        }
+        if (at == investments.size()) {
+            if (replacement) insertInvestmentAt(at, *replacement);
+        } else if (replacement) {
+            replaceInvestmentAt(at, *replacement);
+        } else {
+            removeInvestmentAt(at);
+        }
+    }
+    
+    // Exchanges writes with other replicas through a folder they can all
+    // reach, e.g. a shared drive. Each replica publishes its version vector
+    // as <replica>.seen and leaves every peer the writes it is missing as
+    // <from>-<to>.delta, so only changes travel. Replicas converge once each
+    // has synced after the others. A delta that cannot be merged is left in
+    // the folder and the sync reports failure once the rest is exchanged.
+    bool syncThroughFolder(const string& folder, size_t& received, size_t& sent) {
+        FINANCE_TIME_SCOPE("sync_folder");
+        received = sent = 0;
+        enableSync();
+        error_code error;
+        filesystem::create_directories(folder, error);
+        vector<string> names;
+        for (filesystem::directory_iterator it(folder, error), end; !error && it != end; it.increment(error)) {
+            names.push_back(it->path().filename().string());
+        }
+        if (error) {
+            return false;
+        }
+        
+        string me = to_string(sync.replica);
+        string inbox = "-" + me + ".delta";
+        vector<string> peers;
+        bool complete = true;
+        for (const auto& name : names) {
+            string path = folder + "/" + name;
+            if (name.size() > inbox.size() && name.compare(name.size() - inbox.size(), inbox.size(), inbox) == 0) {
+                ifstream file(path);
+                unsigned from;
+                map<unsigned, unsigned long long> senderSeen;
+                vector<SyncOp> ops;
+                size_t merged;
+                if (SyncLog::readDelta(file, from, senderSeen, ops) && mergeSync(ops, senderSeen, merged)) {
+                    received += merged;
+                    file.close();
+                    remove(path.c_str());
+                } else {
+                    complete = false;
+                }
+            } else if (name.size() > 5 && name.compare(name.size() - 5, 5, ".seen") == 0 && name != me + ".seen") {
+                peers.push_back(name.substr(0, name.size() - 5));
+            }
+        }
+        
+        auto publish = [](const string& path, const string& contents) {
+            {
+                ofstream file(path + ".tmp", ios::binary);
+                file << contents;
+                file.close();
+                if (file.fail()) return false;
+            }
+            return SnapshotBatch::replaceFile(path + ".tmp", path);
+        };
+        ostringstream seen;
+        SyncLog::writeVector(seen, sync.seen);
+        if (!publish(folder + "/" + me + ".seen", seen.str())) {
+            return false;
+        }
+        for (const auto& peer : peers) {
+            ifstream file(folder + "/" + peer + ".seen");
+            map<unsigned, unsigned long long> peerSeen;
+            if (!SyncLog::readVector(file, peerSeen)) continue;
+            vector<SyncOp> ops;
+            if (!syncDelta(peerSeen, ops)) {
+                complete = false;
+                continue;
+            }
+            string path = folder + "/" + me + "-" + peer + ".delta";
+            if (ops.empty()) {
+                remove(path.c_str());
+                continue;
+            }
+            ostringstream delta;
+            SyncLog::writeDelta(delta, sync.replica, sync.seen, ops);
+            if (!publish(path, delta.str())) {
+                return false;
+            }
+            sent += ops.size();
+        }
+        FINANCE_COUNT("sync_writes_sent", sent);
+        return complete;
+    }
+    
+    void sortTransactionsByAmount(bool ascending = true) {
+        transactionSegments.markAll();
+        if (ascending) {
+            sort(transactions.begin(), transactions.end(), 
+                 [](Transaction* a, Transaction* b) { return a->amount < b->amount; });
+        } else {
+            sort(transactions.begin(), transactions.end(), 
+                 [](Transaction* a, Transaction* b) { return a->amount > b->amount; });
+        }
+    }
+    
+    void sortTransactionsByDate(bool ascending = true) {
+        transactionSegments.markAll();
+        if (ascending) {
+            sort(transactions.begin(), transactions.end(), 
+                 [](Transaction* a, Transaction* b) {
+                     Date dateA = a->date;
+                     Date dateB = b->date;
+                     if (dateA.year != dateB.year) return dateA.year < dateB.year;
+                     if (dateA.month != dateB.month) return dateA.month < dateB.month;
+                     return dateA.day < dateB.day;
+                 });
+        } else {
+            sort(transactions.begin(), transactions.end(), 
+                 [](Transaction* a, Transaction* b) {
+                     Date dateA = a->date;
+                     Date dateB = b->date;
+                     if (dateA.year != dateB.year) return dateA.year > dateB.year;
+                     if (dateA.month != dateB.month) return dateA.month > dateB.month;
+                     return dateA.day > dateB.day;
+                 });
+        }
+    }
+    
+    void sortTransactionsByCategory() {
+        transactionSegments.markAll();
+        sort(transactions.begin(), transactions.end(), 
+             [](Transaction* a, Transaction* b) {
+                 return static_cast<int>(a->category) < static_cast<int>(b->category);
+             });
+    }
+    
+    void sortInvestmentsByAmount(bool ascending = true) {
+        investmentSegments.markAll();
+        investmentIndex.markDirty();
+        if (ascending) {
+            sort(investments.begin(), investments.end(), 
+                 [](const Investment& a, const Investment& b) { return a.amount < b.amount; });
+        } else {
+            sort(investments.begin(), investments.end(), 
+                 [](const Investment& a, const Investment& b) { return a.amount > b.amount; });
+        }
+    }
+    
+    void sortInvestmentsByDuration(bool ascending = true) {
+        investmentSegments.markAll();
+        investmentIndex.markDirty();
+        if (ascending) {
+            sort(investments.begin(), investments.end(), 
+                 [](const Investment& a, const Investment& b) { return a.duration < b.duration; });
+        } else {
+            sort(investments.begin(), investments.end(), 
+                 [](const Investment& a, const Investment& b) { return a.duration > b.duration; });
+        }
+    }
+
+    // Replaces the forecast payments with the next occurrence of every
+    // recurring expense that has not lapsed and is not already scheduled
+    void refreshPredictedPayments() {
+        upcomingPayments.erase(remove_if(upcomingPayments.begin(), upcomingPayments.end(),
+                                         [](const UpcomingPayment& p) { return p.isPredicted; }),
+                               upcomingPayments.end());
+        size_t scheduled = upcomingPayments.size();
+        int today = Date().dayNumber();
+        for (const auto& pattern : recurrences.patterns) {
+            if (!pattern.recurring || pattern.income) continue;
+            Date next = RecurrenceDetector::nextDate(pattern);
+            if (next.dayNumber() + RecurrenceDetector::graceDays(pattern.period) < today) continue;
+            
+            const string& description = descriptionSuggestions[pattern.descriptionId];
+            bool known = false;
+            for (size_t i = 0; i < scheduled && !known; i++) {
+                known = upcomingPayments[i].description == description;
+            }
+            if (known) continue;
+            upcomingPayments.push_back(UpcomingPayment(next, description, pattern.amounts[pattern.count - 1]));
+            upcomingPayments.back().isPredicted = true;
+        }
+        sortUpcomingPayments();
+    }
+    
+    size_t savedUpcomingCount() const {
+        size_t count = 0;
+        for (const auto& payment : upcomingPayments) {
+            if (!payment.isPredicted) count++;
+        }
+        return count;
+    }
+    
+    void addUpcomingPayment(const Date& date, const string& desc, double amount, bool isInvestment = false) {
+        upcomingPayments.push_back(UpcomingPayment(date, desc, amount, isInvestment));
+        upcomingChanges++;
+        
+        sortUpcomingPayments();
+    }
+    
+    // Stable, so payments due the same day keep their order across save and load
+    void sortUpcomingPayments() {
+        stable_sort(upcomingPayments.begin(), upcomingPayments.end(),
+             [](const UpcomingPayment& a, const UpcomingPayment& b) {
+                 if (a.dueDate.year != b.dueDate.year) return a.dueDate.year < b.dueDate.year;
+                 if (a.dueDate.month != b.dueDate.month) return a.dueDate.month < b.dueDate.month;
+                 return a.dueDate.day < b.dueDate.day;
+             });
+    }
+    
+    void displayUpcomingPayments() {
+        OutputBuffer header;
+        header.append("\n--UPCOMING PAYMENTS--\n");
+        header.appendField("Date", 12);
+        header.appendField("Description", 20);
+        header.appendField("Amount", 15);
+        header.appendField("Type", 15);
+        header.newline();
+        header.append(string(62, '-'));
+        header.newline();
+        
+        Pager pager;
+        pager.show(header.data, upcomingPayments.size(), [&](size_t row, OutputBuffer& out) {
+            const UpcomingPayment& payment = upcomingPayments[row];
+            out.appendDate(payment.dueDate, 12);
+            out.appendField(payment.description, 20);
+            out.appendFixed(payment.amount, 2, 15);
+            out.appendField(payment.isPredicted ? "Predicted" : (payment.isInvestment ? "Investment" : "Payment"), 15);
+            out.newline();
+        });
+    }
+    
+    vector<string> getDescriptionSuggestions(const string& prefix) {
+        vector<string> suggestions;
+        for (const auto& desc : descriptionSuggestions) {
+            if (desc.find(prefix) == 0) {
+                suggestions.push_back(desc);
+            }
+        }
+        return suggestions;
+    }
+
+    void displayRecord(double balance) {
+        cout << "-----------------------------------" << endl;
+        cout << "|        Personal Finance        |" << endl;
+        cout << "-----------------------------------" << endl;
+
+        cout << "\n||--BALANCE--: " << fixed << setprecision(2) << balance;
+        if (!currencies().code(0).empty()) {
+            cout << " " << currencies().code(0);
+        }
+        cout << "||" << endl;
+
+        showTransactions("\n--SAVINGS--: \n", transactions);
+        if (!coldStore.blocks.empty()) {
+            cout << coldStore.rowCount() << " older transactions are archived; use Search Transactions to find them." << endl;
+        }
+        showInvestments("\n--INVESTMENTS--\n", investments);
+        if (!investments.empty()) {
+            cout << "Value of all investments at maturity: " << fixed << setprecision(2) << portfolioMaturityValue() << endl;
+        }
+    }
+    
+    void generateMonthlyReport(int month, int year) {
+        FINANCE_TIME_SCOPE("monthly_report");
+        cout << "\n----- Monthly Report for " << month << "/" << year << " -----" << endl;
+        
+        double totalIncome = 0.0;
+        double totalExpense = 0.0;
+        CategoryTree tree = categories().snapshot();
+        vector<double> categoryExpenses(tree.names.size(), 0.0);
+        
+        // The month's rows are gathered into columns so the currency
+        // conversion runs as one pass over the amounts
+        vector<double> amounts;
+        vector<int> currencyIds, days, kinds;
+        auto add = [&](const Transaction& t) {
+            int kind = t.type == "Income" ? -1 : (t.type == "Expenditure" ? t.category : -2);
+            if (kind == -2) return;
+            amounts.push_back(t.amount);
+            currencyIds.push_back(t.currency);
+            days.push_back(t.date.dayNumber());
+            kinds.push_back(kind);
+        };
+        for (auto t : transactions) {
+            Date date = t->date;
+            if (date.month == month && date.year == year) {
+                add(*t);
+            }
+        }
+        int lastDay = Date::daysInMonth(month, year);
+        coldStore.scan(TransactionFilter::dateRange(Date(1, month, year), Date(lastDay, month, year)), add);
+        
+        fx.toBase(amounts, currencyIds, days);
+        for (size_t i = 0; i < amounts.size(); i++) {
+            if (kinds[i] == -1) {
+                totalIncome += amounts[i];
+            } else {
+                totalExpense += amounts[i];
+                if (tree.valid(kinds[i])) categoryExpenses[kinds[i]] += amounts[i];
+            }
+        }
+        tree.rollUp(categoryExpenses);
+        
+        if (!currencies().code(0).empty()) {
+            cout << "Amounts in " << currencies().code(0) << endl;
+        }
+        cout << "Total Income: " << fixed << setprecision(2) << totalIncome << endl;
+        cout << "Total Expenses: " << fixed << setprecision(2) << totalExpense << endl;
+        cout << "Net Savings: " << fixed << setprecision(2) << (totalIncome - totalExpense) << endl;
+        
+        cout << "\nExpense Breakdown by Category:" << endl;
+        for (int id : tree.preorder()) {
+            if (categoryExpenses[id] > 0) {
+                int depth = tree.depth(id);
+                string label = depth == 0 ? tree.labels[id] : string(depth * 2, '-') + " " + tree.labels[id];
+                cout << setw(20) << label << ": " << fixed << setprecision(2) << categoryExpenses[id];
+                if (totalExpense > 0) {
+                    cout << " (" << fixed << setprecision(1) << (categoryExpenses[id] / totalExpense * 100) << "%)";
+                }
+                cout << endl;
+            }
+        }
+    }
+    
+    static void writeTransactionRow(ostream& out, const Transaction& t) {
+        out << t.type[0] << " " << t.amount << " " << t.description << " " 
+            << t.date.day << " " << t.date.month << " " << t.date.year << " " << categoryToString(t.category);
+        if (t.autoCategorized) {
+            out << " ?";
+        }
+        if (t.currency) {
+            out << " " << currencies().code(t.currency);
+        }
+    }
+    
+    static void writeInvestmentRow(ostream& out, const Investment& i) {
+        out << i.type() << " " << i.amount << " " << i.duration << " " 
+            << i.startDate.day << " " << i.startDate.month << " " << i.startDate.year;
+        if (const SIP* sip = get_if<SIP>(&i.product)) {
+            out << " " << sip->monthly;
+        }
+        if (i.currency) {
+            out << " " << currencies().code(i.currency);
+        }
+    }
+    
+    // Synced rows end with "@<record id>"
+    void writeTransactionRows(ostream& out, size_t first, size_t last) const {
+        for (size_t row = first; row < last; row++) {
+            writeTransactionRow(out, *transactions[row]);
+            if (transactions[row]->recordId) {
+                out << " @" << transactions[row]->recordId;
+            }
+            out << "\n";
+        }
+    }
+    
+    void writeInvestmentRows(ostream& out, size_t first, size_t last) const {
+        for (size_t row = first; row < last; row++) {
+            writeInvestmentRow(out, investments[row]);
+            if (investments[row].recordId) {
+                out << " @" << investments[row].recordId;
+            }
+            out << "\n";
+        }
+    }
+    
+    // The description goes last so it may contain spaces
+    void writeUpcomingPayments(ostream& out) const {
+        for (const auto& payment : upcomingPayments) {
+            if (payment.isPredicted) continue;
+            out << payment.dueDate.day << " " << payment.dueDate.month << " " << payment.dueDate.year << " "
+                << payment.amount << " " << (payment.isInvestment ? 1 : 0) << " " << payment.description << "\n";
+        }
+    }
+    
+    // Rows may end with ? for a guessed category, a currency code, for foreign
+    // currencies, and a record id, once synced
+    static void readRowTail(istream& in, int& currency, unsigned long long& recordId, bool& guessed) {
+        currency = 0;
+        recordId = 0;
+        guessed = false;
+        while (true) {
+            while (in.peek() == ' ') {
+                in.get();
+            }
+            int next = in.peek();
+            if (next == '\n' || next == '\r' || next == EOF) {
+                return;
+            }
+            string word;
+            in >> word;
+            if (word[0] == '@') {
+                recordId = strtoull(word.c_str() + 1, nullptr, 10);
+            } else if (word == "?") {
+                guessed = true;
+            } else {
+                currency = currencies().intern(word);
+            }
+        }
+    }
+    
+    // nullptr for a malformed row, which also fails the stream, or one of unknown type
+    static Transaction* readTransactionRow(istream& in) {
+        char type;
+        double amount;
+        string description, categoryStr;
+        int day, month, year;
+        
+        in >> type >> amount;
+        in.ignore();
+        
+        getline(in, description, ' ');
+        
+        in >> day >> month >> year;
+        Date date(day, month, year);
+        
+        in >> categoryStr;
+        if (in.fail()) {
+            return nullptr;
+        }
+        
+        CategoryType category = stringToCategory(categoryStr);
+        int currency;
+        unsigned long long recordId;
+        bool guessed;
+        readRowTail(in, currency, recordId, guessed);
+        
+        Transaction* t;
+        if (type == 'I') {
+            t = new Income(amount, description, date, category);
+        } else if (type == 'E') {
+            t = new Expenditure(amount, description, date, category);
+        } else {
+            return nullptr;
+        }
+        t->currency = currency;
+        t->recordId = recordId;
+        t->autoCategorized = guessed && type == 'E';
+        return t;
+    }
+    
+    // Returns false for a malformed row; an unknown type leaves investment empty
+    static bool readInvestmentRow(istream& in, optional<Investment>& investment, double& amount) {
+        string type;
+        int duration;
+        int day, month, year;
+        
+        in >> type >> amount >> duration;
+        in >> day >> month >> year;
+        Date startDate(day, month, year);
+        
+        investment.reset();
+        if (type == SIP::NAME) {
+            double monthly;
+            in >> monthly;
+            if (in.fail()) return false;
+            investment = Investment(amount, duration, startDate, SIP{monthly});
+        } else if (type == FD::NAME) {
+            if (in.fail()) return false;
+            investment = Investment(amount, duration, startDate, FD());
+        }
+        int currency;
+        unsigned long long recordId;
+        bool guessed;
+        readRowTail(in, currency, recordId, guessed);
+        if (investment) {
+            investment->currency = currency;
+            investment->recordId = recordId;
+        }
+        return true;
+    }
+    
+    bool readTransactionRows(istream& in, size_t count, double& balance) {
+        for (size_t i = 0; i < count; i++) {
+            Transaction* t = readTransactionRow(in);
+            if (in.fail()) {
+                return false;
+            }
+            if (!t) {
+                continue;
+            }
+            
+            transactions.push_back(t);
+            if (t->type == "Income") {
+                balance += t->amount;
+            } else {
+                if (!t->autoCategorized) categorizer.learn(t->description, t->category);
+                balance -= t->amount;
+            }
+        }
+        return true;
+    }
+    
+    bool readInvestmentRows(istream& in, size_t count, double& balance) {
+        for (size_t i = 0; i < count; i++) {
+            optional<Investment> investment;
+            double amount;
+            if (!readInvestmentRow(in, investment, amount)) {
+                return false;
+            }
+            if (investment) {
+                investments.push_back(*investment);
+            }
+            balance -= amount;
+        }
+        return true;
+    }
+    
+    void readUpcomingPayments(istream& in, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            int day, month, year, isInvestment;
+            double amount;
+            string description;
+            
+            in >> day >> month >> year >> amount >> isInvestment;
+            in >> ws;
+            getline(in, description);
+            upcomingPayments.push_back(UpcomingPayment(Date(day, month, year), description, amount, isInvestment != 0));
+        }
+        sortUpcomingPayments();
+    }
+    
+    // Serializes the segments that changed since the last snapshot under the
+    // same name, plus the upcoming payments and a manifest listing every
+    // segment file. The trackers treat the result as saved straight away, so
+    // batches must be written in the order they were prepared. checkDisk
+    // rereads the manifest to catch saves made by someone else.
+    SnapshotBatch prepareSnapshot(const string& filename, bool checkDisk) {
+        FINANCE_TIME_SCOPE("snapshot_prepare");
+        SnapshotBatch batch;
+        batch.filename = filename;
+        if (filename != snapshotFile || checkDisk) {
+            vector<string> onDisk;
+            unsigned long long diskGeneration = readManifestFiles(filename, onDisk);
+            if (filename != snapshotFile || diskGeneration != snapshotGeneration) {
+                // The snapshot under this name is not the one we last wrote, so replace it wholesale
+                transactionSegments.reset();
+                investmentSegments.reset();
+                coldStore.forgetFiles();
+                sync.files.clear();
+                snapshotUpcomingFile.clear();
+                batch.superseded = onDisk;
+                snapshotGeneration = diskGeneration;
+            }
+        }
+        unsigned long long generation = snapshotGeneration + 1;
+        
+        vector<string> transactionFiles, investmentFiles;
+        transactionSegments.renderChanged('t', transactions.size(), generation,
+            [this](ostream& out, size_t first, size_t last) { writeTransactionRows(out, first, last); },
+            transactionFiles, batch.files);
+        investmentSegments.renderChanged('i', investments.size(), generation,
+            [this](ostream& out, size_t first, size_t last) { writeInvestmentRows(out, first, last); },
+            investmentFiles, batch.files);
+        
+        string upcomingFile = "u." + to_string(generation);
+        ostringstream upcoming;
+        upcoming.precision(15);
+        writeUpcomingPayments(upcoming);
+        batch.files.push_back({upcomingFile, upcoming.str()});
+        
+        // Cold blocks never change once written; the dictionary only grows
+        vector<string> coldFiles;
+        for (size_t b = 0; b < coldStore.blocks.size(); b++) {
+            const ColdBlock& block = coldStore.blocks[b];
+            if (block.file.empty()) {
+                string suffix = "c" + to_string(b) + "." + to_string(generation);
+                batch.files.push_back({suffix, coldStore.renderBlock(block)});
+                coldFiles.push_back(suffix);
+            } else {
+                coldFiles.push_back(block.file);
+            }
+        }
+        string dictionaryFile = coldStore.dictionaryFile;
+        if (dictionaryFile.empty() || coldStore.dictionary.size() != coldStore.savedDictionarySize) {
+            dictionaryFile = "d." + to_string(generation);
+            batch.files.push_back({dictionaryFile, coldStore.renderDictionary()});
+            if (!coldStore.dictionaryFile.empty()) batch.superseded.push_back(coldStore.dictionaryFile);
+        }
+        
+        // Sync state is appended as the records changed since the last save
+        vector<string> syncFiles = sync.files;
+        if (sync.enabled() && (sync.files.empty() || sync.changed)) {
+            bool compact = sync.needsCompaction();
+            if (compact) {
+                batch.superseded.insert(batch.superseded.end(), syncFiles.begin(), syncFiles.end());
+                syncFiles.clear();
+            }
+            string suffix = "s" + to_string(syncFiles.size()) + "." + to_string(generation);
+            batch.files.push_back({suffix, sync.render(compact)});
+            syncFiles.push_back(suffix);
+        }
+        
+        ostringstream manifest;
+        manifest << "FINANCE-SEGMENTS 3\n";
+        manifest << "generation " << generation << "\n";
+        manifest << "transactions " << transactions.size() << " " << transactionFiles.size() << "\n";
+        for (size_t s = 0; s < transactionFiles.size(); s++) {
+            manifest << min(SegmentTracker::SEGMENT_ROWS, transactions.size() - s * SegmentTracker::SEGMENT_ROWS)
+                     << " " << transactionFiles[s] << "\n";
+        }
+        manifest << "investments " << investments.size() << " " << investmentFiles.size() << "\n";
+        for (size_t s = 0; s < investmentFiles.size(); s++) {
+            manifest << min(SegmentTracker::SEGMENT_ROWS, investments.size() - s * SegmentTracker::SEGMENT_ROWS)
+                     << " " << investmentFiles[s] << "\n";
+        }
+        manifest << "upcoming " << savedUpcomingCount() << " " << upcomingFile << "\n";
+        manifest << "dictionary " << coldStore.dictionary.size() << " " << dictionaryFile << "\n";
+        manifest << "cold " << coldFiles.size() << "\n";
+        for (size_t b = 0; b < coldFiles.size(); b++) {
+            manifest << coldStore.blocks[b].rows << " " << coldFiles[b] << "\n";
+        }
+        manifest << "sync " << syncFiles.size() << "\n";
+        for (const auto& suffix : syncFiles) {
+            manifest << suffix << "\n";
+        }
+        batch.manifest = manifest.str();
+        batch.records = transactions.size() + investments.size() + savedUpcomingCount();
+        
+        transactionSegments.commit(transactionFiles, batch.superseded);
+        investmentSegments.commit(investmentFiles, batch.superseded);
+        if (!snapshotUpcomingFile.empty()) {
+            batch.superseded.push_back(snapshotUpcomingFile);
+        }
+        for (size_t b = 0; b < coldFiles.size(); b++) {
+            coldStore.blocks[b].file = coldFiles[b];
+        }
+        coldStore.dictionaryFile = dictionaryFile;
+        coldStore.savedDictionarySize = coldStore.dictionary.size();
+        if (sync.enabled()) {
+            sync.saved(syncFiles);
+        }
+        transactionSegments.changes = 0;
+        investmentSegments.changes = 0;
+        upcomingChanges = 0;
+        snapshotFile = filename;
+        snapshotUpcomingFile = upcomingFile;
+        snapshotGeneration = generation;
+        return batch;
+    }
+    
+    // After a failed write the files on disk no longer match what the trackers
+    // think is saved, so the next snapshot starts from scratch
+    void forgetSnapshot() {
+        transactionSegments.reset();
+        investmentSegments.reset();
+        coldStore.forgetFiles();
+        sync.files.clear();
+        snapshotFile.clear();
+        snapshotUpcomingFile.clear();
+    }
+    
+    // Edits not yet in a snapshot; a ledger never saved as segments counts every record
+    size_t pendingChanges() const {
+        if (snapshotFile.empty()) {
+            return transactionCount() + investments.size() + savedUpcomingCount();
+        }
+        return transactionSegments.changes + investmentSegments.changes + upcomingChanges + coldStore.unsavedBlocks()
+            + (sync.changed ? 1 : 0);
+    }
+    
+    // Saves the ledger as segment files plus a manifest listing them. Only
+    // segments that changed since the last save to the same name are written.
+    bool saveToFile(const string& filename) {
+        FINANCE_TIME_SCOPE("save_to_file");
+        SnapshotBatch batch = prepareSnapshot(filename, true);
+        if (!batch.write()) {
+            forgetSnapshot();
+            return false;
+        }
+        updateMemoryGauges();
+        return true;
+    }
+    
+    // Lists the files of an existing snapshot and returns its generation
+    static unsigned long long readManifestFiles(const string& filename, vector<string>& files) {
+        ifstream manifest(filename + ".manifest");
+        string magic, label, word;
+        int version;
+        unsigned long long generation;
+        if (!(manifest >> magic >> version >> label >> generation) || magic != "FINANCE-SEGMENTS") {
+            return 0;
+        }
+        while (manifest >> word) {
+            // File entries are "<count> <suffix>"; suffixes start with a kind letter
+            if (word.size() > 2 && strchr("tiucds", word[0]) && word.find('.') != string::npos
+                && word != "transactions" && word != "investments" && word != "upcoming") {
+                files.push_back(word);
+            }
+        }
+        return generation;
+    }
+    
+    // Deletes a saved snapshot: the manifest, every file it lists, and any plain data file
+    static void removeSavedFiles(const string& filename) {
+        vector<string> files;
+        readManifestFiles(filename, files);
+        for (const auto& suffix : files) {
+            remove((filename + "." + suffix).c_str());
+        }
+        remove((filename + ".manifest").c_str());
+        remove(filename.c_str());
+    }
+    
+    void clearLedger() {
+        history.clear();
+        sync.clear();
+        for (auto t : transactions) delete t;
+        transactions.clear();
+        investments.clear();
+        investmentIndex.markDirty();
+        upcomingPayments.clear();
+        upcomingChanges = 0;
+        coldStore.clear();
+        recurrences.clear();
+    }
+    
+    // Reads the segment files listed in a manifest
+    bool loadSegments(const string& filename, istream& manifest, double& balance) {
+        string magic, label;
+        int version;
+        size_t total, segmentCount;
+        manifest >> magic >> version >> label >> snapshotGeneration;
+        if (magic != "FINANCE-SEGMENTS" || version < 1 || version > 3) {
+            return false;
+        }
+        
+        const char* kinds[] = {"transactions", "investments"};
+        SegmentTracker* trackers[] = {&transactionSegments, &investmentSegments};
+        for (int k = 0; k < 2; k++) {
+            if (!(manifest >> label >> total >> segmentCount) || label != kinds[k]) {
+                return false;
+            }
+            trackers[k]->reset();
+            for (size_t s = 0; s < segmentCount; s++) {
+                size_t rows;
+                string suffix;
+                manifest >> rows >> suffix;
+                ifstream file(filename + "." + suffix);
+                bool ok = file.is_open() && (k == 0 ? readTransactionRows(file, rows, balance) : readInvestmentRows(file, rows, balance));
+                if (!ok) {
+                    return false;
+                }
+                trackers[k]->files.push_back(suffix);
+            }
+            trackers[k]->dirty.assign(segmentCount, false);
+        }
+        
+        size_t paymentCount;
+        string upcomingFile;
+        if (!(manifest >> label >> paymentCount >> upcomingFile) || label != "upcoming") {
+            return false;
+        }
+        ifstream file(filename + "." + upcomingFile);
+        if (!file.is_open()) {
+            return false;
+        }
+        readUpcomingPayments(file, paymentCount);
+        
+        // Version 1 manifests have no cold tier
+        if (version >= 2) {
+            size_t wordCount, blockCount;
+            string dictionaryFile;
+            if (!(manifest >> label >> wordCount >> dictionaryFile) || label != "dictionary") {
+                return false;
+            }
+            ifstream dictionary(filename + "." + dictionaryFile, ios::binary);
+            if (!dictionary.is_open()) {
+                return false;
+            }
+            coldStore.readDictionary(dictionary, wordCount);
+            coldStore.dictionaryFile = dictionaryFile;
+            coldStore.savedDictionarySize = coldStore.dictionary.size();
+            
+            if (!(manifest >> label >> blockCount) || label != "cold") {
+                return false;
+            }
+            for (size_t b = 0; b < blockCount; b++) {
+                size_t rows;
+                string suffix;
+                manifest >> rows >> suffix;
+                ifstream blockFile(filename + "." + suffix, ios::binary);
+                ColdBlock block;
+                if (!blockFile.is_open() || !coldStore.readBlock(blockFile, block) || block.rows != rows) {
+                    return false;
+                }
+                block.file = suffix;
+                coldStore.addBlock(block);
+            }
+            coldStore.forEach([&](const Transaction& t) {
+                if (t.type == "Income") {
+                    balance += t.amount;
+                } else {
+                    if (!t.autoCategorized) categorizer.learn(t.description, t.category);
+                    balance -= t.amount;
+                }
+            });
+        }
+        
+        // Version 3 adds the sync state, if this ledger is synced
+        if (version >= 3) {
+            size_t syncCount;
+            if (!(manifest >> label >> syncCount) || label != "sync") {
+                return false;
+            }
+            vector<string> syncFiles(syncCount);
+            for (auto& suffix : syncFiles) {
+                manifest >> suffix;
+                ifstream syncFile(filename + "." + suffix);
+                if (!syncFile.is_open() || !sync.read(syncFile)) {
+                    return false;
+                }
+            }
+            sync.saved(syncFiles);
+        }
+        snapshotFile = filename;
+        snapshotUpcomingFile = upcomingFile;
+        return true;
+    }
+    
+    // The original single-file format: each section starts with its row count
+    bool loadPlainFile(istream& file, double& balance) {
+        size_t transactionCount;
+        file >> transactionCount;
+        file.ignore();
+        readTransactionRows(file, transactionCount, balance);
+        
+        size_t investmentCount;
+        file >> investmentCount;
+        file.ignore();
+        readInvestmentRows(file, investmentCount, balance);
+        
+        // Files written before upcoming payments were saved end here
+        size_t paymentCount;
+        if (file >> paymentCount) {
+            readUpcomingPayments(file, paymentCount);
+        }
+        
+        // Everything has to be written out as segments on the next save
+        forgetSnapshot();
+        return true;
+    }
+    
+    // Prefers a segmented snapshot and falls back to the plain data file
+    bool loadFromFile(const string& filename, double& balance) {
+        FINANCE_TIME_SCOPE("load_from_file");
+        ifstream manifest(filename + ".manifest");
+        ifstream file;
+        if (!manifest.is_open()) {
+            file.open(filename);
+            if (!file.is_open()) {
+                return false;
+            }
+        }
+        
+        clearLedger();
+        double loadedBalance = balance;
+        bool ok = manifest.is_open() ? loadSegments(filename, manifest, loadedBalance) : loadPlainFile(file, loadedBalance);
+        if (!ok) {
+            clearLedger();
+            transactionSegments.reset();
+            investmentSegments.reset();
+            snapshotFile.clear();
+            retrackAll();
+            return false;
+        }
+        balance = loadedBalance;
+        
+        // Guessed categories are guessed again, so rules added since apply to them
+        for (size_t row = 0; row < transactions.size(); row++) {
+            Transaction* t = transactions[row];
+            if (t->type != "Expenditure" || !t->autoCategorized) continue;
+            CategoryType category = categorizer.classify(t->description);
+            if (category != t->category) {
+                t->category = category;
+                transactionSegments.markRow(row);
+            }
+        }
+        retrackAll();
+        attachSyncRows();
+        refreshPredictedPayments();
+        
+        FINANCE_COUNT("records_loaded", transactionCount() + investments.size() + savedUpcomingCount());
+        updateMemoryGauges();
+        return true;
+    }
+};
+
+// Writes snapshot batches on a background thread in the order they were
+// submitted, so the caller never waits on the disk. A failed write drops the
+// batches queued behind it, since each assumes the one before it landed,
+// until the owner notices through takeFailure.
+struct AutosaveWorker {
+    mutex lock;
+    condition_variable wake;
+    condition_variable drained;
+    deque<SnapshotBatch> queue;
+    bool busy;
+    bool stopping;
+    bool failed;
+    thread worker;
+
+    AutosaveWorker() : busy(false), stopping(false), failed(false) {
+        worker = thread([this]() { run(); });
+    }
+
+    // Pending batches are still written before the thread exits
+    ~AutosaveWorker() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+
+    void submit(SnapshotBatch batch) {
+        {
+            lock_guard<mutex> guard(lock);
+            if (failed) return;
+            queue.push_back(move(batch));
+        }
+        wake.notify_one();
+    }
+
+    void waitIdle() {
+        unique_lock<mutex> guard(lock);
+        drained.wait(guard, [this]() { return queue.empty() && !busy; });
+    }
+
+    bool takeFailure() {
+        lock_guard<mutex> guard(lock);
+        bool result = failed;
+        failed = false;
+        return result;
+    }
+
+    void run() {
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            wake.wait(guard, [this]() { return stopping || !queue.empty(); });
+            if (queue.empty()) {
+                break;
+            }
+            SnapshotBatch batch = move(queue.front());
+            queue.pop_front();
+            busy = true;
+            guard.unlock();
+            bool ok = batch.write();
+            guard.lock();
+            busy = false;
+            if (!ok) {
+                failed = true;
+                queue.clear();
+            }
+            if (queue.empty()) {
+                drained.notify_all();
+            }
+        }
+    }
+};
+
+#endif
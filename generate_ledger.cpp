@@ -0,0 +1,44 @@
+#include "ledger_generator.h"
+
+#include <cstdlib>
+
+int main(int argc, char** argv) {
+    LedgerGeneratorOptions options;
+    string outFile = "generated_finance_data.txt";
+    unsigned threads = max(thread::hardware_concurrency(), 1u);
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--rows" && i + 1 < argc) {
+            options.transactions = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--investments" && i + 1 < argc) {
+            options.investments = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--start-year" && i + 1 < argc) {
+            options.startYear = atoi(argv[++i]);
+        } else if (arg == "--years" && i + 1 < argc) {
+            options.years = atoi(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = max(atoi(argv[++i]), 1);
+        } else if (arg == "--out" && i + 1 < argc) {
+            outFile = argv[++i];
+        } else {
+            cerr << "usage: " << argv[0] << " [--rows N] [--investments N] [--seed S] [--start-year Y]"
+                 << " [--years N] [--threads N] [--out <username>_finance_data.txt]" << endl;
+            return 1;
+        }
+    }
+
+    LedgerGenerator generator(options);
+    auto start = steady_clock::now();
+    if (!generator.writeDataFile(outFile, threads)) {
+        cerr << "Error writing " << outFile << endl;
+        return 1;
+    }
+    double seconds = duration<double>(steady_clock::now() - start).count();
+
+    cerr << "Wrote " << options.transactions << " transactions and " << generator.investmentCount()
+         << " investments to " << outFile << " in " << fixed << setprecision(2) << seconds << "s" << endl;
+    return 0;
+}
@@ -0,0 +1,343 @@
+#ifndef LEDGER_GENERATOR_H
+#define LEDGER_GENERATOR_H
+
+#include "finance_manager.h"
+
+#include <atomic>
+#include <random>
+
+struct GeneratedTransaction {
+    bool income;
+    double amount;
+    string description;
+    Date date;
+    CategoryType category;
+
+    Transaction* create() const {
+        if (income) {
+            return new Income(amount, description, date, category);
+        }
+        return new Expenditure(amount, description, date, category);
+    }
+
+    // One line of the <username>_finance_data.txt transaction section
+    void format(OutputBuffer& out) const {
+        out.append(income ? 'I' : 'E');
+        out.append(' ');
+        out.appendFixed(amount, 2);
+        out.append(' ');
+        out.append(description);
+        out.append(' ');
+        out.appendInt(date.day);
+        out.append(' ');
+        out.appendInt(date.month);
+        out.append(' ');
+        out.appendInt(date.year);
+        out.append(' ');
+        out.append(categories().name(category));
+        out.newline();
+    }
+};
+
+struct LedgerGeneratorOptions {
+    size_t transactions;
+    size_t investments;
+    unsigned long long seed;
+    int startYear;
+    int years;
+
+    LedgerGeneratorOptions() : transactions(100000), investments(0), seed(42), startYear(2015), years(10) {}
+};
+
+// Produces realistic multi-year ledgers: recurring bills and salary, merchant
+// names that repeat with a skewed popularity, heavy-tailed amounts and
+// categories whose weight changes with the season. Rows are produced in
+// fixed-size chunks and each chunk's random stream depends only on the seed
+// and the chunk number, so the output is identical whatever the thread count.
+struct LedgerGenerator {
+    static const size_t CHUNK_ROWS = 65536;
+
+    struct Recurring {
+        const char* description;
+        CategoryType category;
+        double amount;
+        int weight;
+    };
+
+    LedgerGeneratorOptions options;
+    int firstDay;
+    int totalDays;
+
+    LedgerGenerator(const LedgerGeneratorOptions& opts) : options(opts) {
+        firstDay = Date(1, 1, options.startYear).dayNumber();
+        totalDays = Date(1, 1, options.startYear + max(options.years, 1)).dayNumber() - firstDay;
+    }
+
+    size_t investmentCount() const {
+        return options.investments ? options.investments : options.transactions / 200 + 1;
+    }
+
+    size_t chunkCount() const {
+        return (options.transactions + CHUNK_ROWS - 1) / CHUNK_ROWS;
+    }
+
+    static unsigned long long mix(unsigned long long x) {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    static const vector<Recurring>& recurringItems() {
+        static const vector<Recurring> items = {
+            {"Monthly_Rent", HOUSING, 1200.00, 10},
+            {"Netflix_Subscription", ENTERTAINMENT, 15.99, 6},
+            {"Spotify_Premium", ENTERTAINMENT, 9.99, 6},
+            {"Internet_Service", UTILITIES, 59.99, 6},
+            {"Electricity_Bill", UTILITIES, 95.00, 6},
+            {"Mobile_Phone_Bill", UTILITIES, 35.00, 6},
+            {"Gym_Membership", HEALTHCARE, 40.00, 4},
+            {"Health_Insurance", HEALTHCARE, 210.00, 4},
+            {"Online_Course", EDUCATION, 29.00, 2},
+        };
+        return items;
+    }
+
+    static const vector<string>& merchantNames(CategoryType category) {
+        static const vector<vector<string>> names = {
+            {"Salary", "Freelance_Project", "Dividend_Payout", "Tax_Refund"},
+            {"Supermarket", "Bakery", "Cafe", "Restaurant", "Grocery_Store", "Pizza_Place", "Coffee_House"},
+            {"Hardware_Store", "Furniture_Outlet", "Home_Repair", "Landlord_Fees"},
+            {"Fuel_Station", "Taxi", "Uber", "Parking_Garage", "Train_Ticket", "Airline"},
+            {"Cinema", "Concert_Hall", "Game_Store", "Theatre", "Bowling_Alley"},
+            {"Water_Bill", "Gas_Bill", "Telecom_Shop"},
+            {"Pharmacy", "Dental_Clinic", "Hospital", "Doctor_Visit"},
+            {"Bookshop", "Textbook_Store", "School_Fees", "Tuition_Center"},
+            {"Department_Store", "Online_Marketplace", "Gift_Shop", "Electronics_Store", "Clothing_Store"},
+        };
+        return names[category];
+    }
+
+    // Relative weight of each expense category in a given month
+    static void seasonalWeights(int month, double weights[OTHER + 1]) {
+        static const double base[OTHER + 1] = {0, 34, 5, 14, 9, 6, 6, 4, 22};
+        for (int c = 0; c <= OTHER; c++) weights[c] = base[c];
+        if (month == 12 || month == 1 || month == 2) weights[UTILITIES] *= 1.8;
+        if (month >= 6 && month <= 8) weights[ENTERTAINMENT] *= 1.6;
+        if (month >= 6 && month <= 8) weights[TRANSPORTATION] *= 1.4;
+        if (month == 8 || month == 9) weights[EDUCATION] *= 3.0;
+        if (month == 11 || month == 12) weights[OTHER] *= 1.7;
+    }
+
+    void generateChunk(size_t chunk, vector<GeneratedTransaction>& rows) const {
+        size_t first = chunk * CHUNK_ROWS;
+        size_t last = min(first + CHUNK_ROWS, options.transactions);
+        rows.resize(last - first);
+
+        mt19937_64 rng(mix(options.seed ^ mix(chunk)));
+        uniform_real_distribution<double> unit(0.0, 1.0);
+        normal_distribution<double> normal(0.0, 1.0);
+        const vector<Recurring>& recurring = recurringItems();
+        int recurringWeight = 0;
+        for (const auto& item : recurring) recurringWeight += item.weight;
+
+        for (size_t i = first; i < last; i++) {
+            GeneratedTransaction& row = rows[i - first];
+            // Rows are spread evenly over the span, so the file is in date order
+            row.date = Date::fromDayNumber(firstDay + (int)((unsigned long long)i * totalDays / max<size_t>(options.transactions, 1)));
+            double roll = unit(rng);
+
+            if (roll < 0.02) {
+                row.income = true;
+                row.category = INCOME;
+                if (unit(rng) < 0.8) {
+                    row.description = "Salary";
+                    row.amount = 4200.0 * (1.0 + 0.01 * normal(rng));
+                } else {
+                    const vector<string>& names = merchantNames(INCOME);
+                    row.description = names[1 + rng() % (names.size() - 1)];
+                    row.amount = exp(6.5 + 1.0 * normal(rng));
+                }
+            } else if (roll < 0.14) {
+                int pick = rng() % recurringWeight;
+                size_t item = 0;
+                while (pick >= recurring[item].weight) {
+                    pick -= recurring[item].weight;
+                    item++;
+                }
+                row.income = false;
+                row.description = recurring[item].description;
+                row.category = recurring[item].category;
+                row.amount = recurring[item].amount;
+                if (row.category == UTILITIES && (row.date.month <= 2 || row.date.month == 12)) {
+                    row.amount *= 1.6;
+                }
+                if (recurring[item].category == UTILITIES) {
+                    row.amount *= 1.0 + 0.05 * normal(rng);
+                }
+            } else {
+                double weights[OTHER + 1];
+                seasonalWeights(row.date.month, weights);
+                double total = 0;
+                for (int c = FOOD; c <= OTHER; c++) total += weights[c];
+                double target = unit(rng) * total;
+                int category = FOOD;
+                while (category < OTHER && target >= weights[category]) {
+                    target -= weights[category];
+                    category++;
+                }
+
+                // Skewed towards a few favourite merchants of each kind
+                const vector<string>& names = merchantNames(category);
+                size_t kind = rng() % names.size();
+                int branch = (int)(pow(unit(rng), 3.0) * 40);
+                row.income = false;
+                row.category = category;
+                row.description = names[kind] + "_" + to_string(branch);
+
+                row.amount = exp(3.2 + 0.9 * normal(rng));
+                if (unit(rng) < 0.01) {
+                    row.amount *= pow(1.0 - unit(rng), -1.0 / 1.5); // Pareto tail
+                }
+            }
+            row.amount = max(0.01, round(row.amount * 100) / 100);
+        }
+    }
+
+    Investment generateInvestment(size_t index) const {
+        mt19937_64 rng(mix(options.seed ^ 0x1f83d9abfb41bd6bULL ^ mix(index)));
+        uniform_real_distribution<double> unit(0.0, 1.0);
+        normal_distribution<double> normal(0.0, 1.0);
+
+        Date start = Date::fromDayNumber(firstDay + (int)(rng() % max(totalDays, 1)));
+        int duration = 1 + (int)(rng() % 10);
+        double amount = round(exp(8.5 + 0.8 * normal(rng)));
+        if (unit(rng) < 0.6) {
+            return Investment(amount, duration, start, FD());
+        }
+        double monthly = round(exp(5.0 + 0.6 * normal(rng)));
+        return Investment(amount, duration, start, SIP{monthly});
+    }
+
+    // Next SIP installments and recurring bills after the generated span
+    vector<UpcomingPayment> upcomingPayments(const vector<Investment>& investments) const {
+        vector<UpcomingPayment> payments;
+        Date end = Date::fromDayNumber(firstDay + totalDays);
+        for (const auto& inv : investments) {
+            const SIP* sip = get_if<SIP>(&inv.product);
+            if (!sip) continue;
+            Date maturity(inv.startDate.day, inv.startDate.month, inv.startDate.year + inv.duration);
+            if (maturity.key() <= end.key()) continue;
+            int day = min(inv.startDate.day, 28);
+            payments.push_back(UpcomingPayment(Date(day, end.month, end.year), "SIP installment", sip->monthly, true));
+        }
+        for (const auto& item : recurringItems()) {
+            payments.push_back(UpcomingPayment(Date(1, end.month, end.year), item.description, item.amount));
+        }
+        return payments;
+    }
+
+    void fill(FinanceManager& manager) const {
+        vector<GeneratedTransaction> rows;
+        for (size_t chunk = 0; chunk < chunkCount(); chunk++) {
+            generateChunk(chunk, rows);
+            for (const auto& row : rows) {
+                manager.addTransaction(row.create());
+            }
+        }
+        for (size_t i = 0; i < investmentCount(); i++) {
+            manager.addInvestment(generateInvestment(i));
+        }
+        for (const auto& payment : upcomingPayments(manager.investments)) {
+            manager.upcomingPayments.push_back(payment);
+        }
+        manager.sortUpcomingPayments();
+    }
+
+    // Writes the ledger in the loadFromFile format. Chunks are formatted on
+    // worker threads a batch at a time and written in order.
+    bool writeDataFile(const string& filename, unsigned threads) const {
+        ofstream file(filename, ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        threads = max(threads, 1u);
+
+        OutputBuffer out;
+        out.appendInt(options.transactions);
+        out.newline();
+        out.flush(file);
+
+        // Row and text buffers are reused from batch to batch
+        size_t chunks = chunkCount();
+        size_t batch = threads * 4;
+        vector<OutputBuffer> formatted(batch);
+        vector<vector<GeneratedTransaction>> scratch(threads);
+        for (size_t begin = 0; begin < chunks; begin += batch) {
+            size_t end = min(begin + batch, chunks);
+            atomic<size_t> nextChunk(begin);
+            auto worker = [&](unsigned id) {
+                vector<GeneratedTransaction>& rows = scratch[id];
+                for (size_t chunk = nextChunk++; chunk < end; chunk = nextChunk++) {
+                    generateChunk(chunk, rows);
+                    OutputBuffer& chunkOut = formatted[chunk - begin];
+                    for (const auto& row : rows) row.format(chunkOut);
+                }
+            };
+
+            vector<thread> pool;
+            for (unsigned t = 1; t < threads; t++) pool.push_back(thread(worker, t));
+            worker(0);
+            for (auto& t : pool) t.join();
+
+            for (size_t chunk = begin; chunk < end; chunk++) {
+                formatted[chunk - begin].flush(file);
+            }
+        }
+
+        vector<Investment> investments;
+        for (size_t i = 0; i < investmentCount(); i++) {
+            investments.push_back(generateInvestment(i));
+        }
+        out.appendInt(investments.size());
+        out.newline();
+        for (const auto& inv : investments) {
+            out.append(inv.type());
+            out.append(' ');
+            out.appendFixed(inv.amount, 2);
+            out.append(' ');
+            out.appendInt(inv.duration);
+            out.append(' ');
+            out.appendInt(inv.startDate.day);
+            out.append(' ');
+            out.appendInt(inv.startDate.month);
+            out.append(' ');
+            out.appendInt(inv.startDate.year);
+            if (const SIP* sip = get_if<SIP>(&inv.product)) {
+                out.append(' ');
+                out.appendFixed(sip->monthly, 2);
+            }
+            out.newline();
+        }
+
+        vector<UpcomingPayment> payments = upcomingPayments(investments);
+        out.appendInt(payments.size());
+        out.newline();
+        for (const auto& payment : payments) {
+            out.appendInt(payment.dueDate.day);
+            out.append(' ');
+            out.appendInt(payment.dueDate.month);
+            out.append(' ');
+            out.appendInt(payment.dueDate.year);
+            out.append(' ');
+            out.appendFixed(payment.amount, 2);
+            out.append(payment.isInvestment ? " 1 " : " 0 ");
+            out.append(payment.description);
+            out.newline();
+        }
+        out.flush(file);
+        return file.good();
+    }
+};
+
+#endif
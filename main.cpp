@@ -1,664 +1,150 @@
-#include <iostream>
-#include <iomanip>
-#include <cmath>
-#include <string>
-#include <vector>
-#include <fstream>
-#include <limits>
-#include <chrono>
-#include <ctime>
-#include <thread>
-#include <algorithm>
+#include "finance_manager.h"
+#include "columnar_export.h"
+#include "annual_statements.h"
 
-using namespace std;
-using namespace std::chrono;
-
-struct Date {
-    int day, month, year;
-
-    Date() {
-        auto now = chrono::system_clock::now();
-        time_t now_time = chrono::system_clock::to_time_t(now);
-        tm* now_tm = localtime(&now_time);
-        
-        day = now_tm->tm_mday;
-        month = now_tm->tm_mon + 1;
-        year = now_tm->tm_year + 1900;
-    }
-    
-    Date(int d, int m, int y) : day(d), month(m), year(y) {}
-    
-    string toString() const {
-        return to_string(day) + "/" + to_string(month) + "/" + to_string(year);
-    }
-};
-
-ostream& operator<<(ostream& os, const Date& date) {
-    os << date.toString();
-    return os;
-}
-
-ofstream& operator<<(ofstream& ofs, const Date& date) {
-    ofs << date.day << " " << date.month << " " << date.year;
-    return ofs;
-}
-
-ifstream& operator>>(ifstream& ifs, Date& date) {
-    ifs >> date.day >> date.month >> date.year;
-    return ifs;
-}
-
-enum CategoryType {
-    INCOME,
-    FOOD,
-    HOUSING,
-    TRANSPORTATION,
-    ENTERTAINMENT,
-    UTILITIES,
-    HEALTHCARE,
-    EDUCATION,
-    OTHER
-};
-
-string categoryToString(CategoryType cat) {
-    switch(cat) {
-        case INCOME: return "Income";
-        case FOOD: return "Food";
-        case HOUSING: return "Housing";
-        case TRANSPORTATION: return "Transportation";
-        case ENTERTAINMENT: return "Entertainment";
-        case UTILITIES: return "Utilities";
-        case HEALTHCARE: return "Healthcare";
-        case EDUCATION: return "Education";
-        case OTHER: return "Other";
-        default: return "Unknown";
-    }
-}
-
-CategoryType stringToCategory(const string& str) {
-    if (str == "Income") return INCOME;
-    if (str == "Food") return FOOD;
-    if (str == "Housing") return HOUSING;
-    if (str == "Transportation") return TRANSPORTATION;
-    if (str == "Entertainment") return ENTERTAINMENT;
-    if (str == "Utilities") return UTILITIES;
-    if (str == "Healthcare") return HEALTHCARE;
-    if (str == "Education") return EDUCATION;
-    return OTHER;
-}
-
-struct UpcomingPayment {
-    Date dueDate;
-    string description;
-    double amount;
-    bool isInvestment;
-    
-    UpcomingPayment(const Date& date, const string& desc, double amt, bool inv = false)
-        : dueDate(date), description(desc), amount(amt), isInvestment(inv) {}
-};
-
-// Forward declaration
-struct SIP;
-
-struct Transaction {
-    double amount;
-    string description;
-    Date date;
-    CategoryType category;
-    string type;
-    
-    Transaction(double amt, const string &des, CategoryType cat = OTHER, string t = "Transaction") {
-        amount = amt;
-        description = des;
-        date = Date();
-        category = cat;
-        type = t;
-    }
-    
-    Transaction(double amt, const string &des, const Date& dt, CategoryType cat = OTHER, string t = "Transaction") {
-        amount = amt;
-        description = des;
-        date = dt;
-        category = cat;
-        type = t;
-    }
-
-    void display() {
-        cout << setw(15) << type;
-        cout << setw(12) << date << setw(15) << amount << setw(15) << categoryToString(category) << setw(20) << description << endl;
-    }
-};
-
-struct Income : Transaction {
-    Income(double amt, const string& des, CategoryType cat = INCOME) 
-        : Transaction(amt, des, cat, "Income") {}
-    
-    Income(double amt, const string& des, const Date& dt, CategoryType cat = INCOME) 
-        : Transaction(amt, des, dt, cat, "Income") {}
-};
-
-struct Expenditure : Transaction {
-    Expenditure(double amt, const string &des, CategoryType cat = OTHER) 
-        : Transaction(amt, des, cat, "Expenditure") {}
-    
-    Expenditure(double amt, const string &des, const Date& dt, CategoryType cat = OTHER) 
-        : Transaction(amt, des, dt, cat, "Expenditure") {}
-};
-
-struct Investment {
-    double amount;
-    int duration;
-    Date startDate;
-    string type;
-    double monthly; // Added to base class to avoid casting
-    
-    Investment(double amt, int dur, string t = "Investment") {
-        amount = amt;
-        duration = dur;
-        startDate = Date();
-        type = t;
-        monthly = 0;
-    }
+struct User {
+    FinanceManager manager;
+    string username;
+    string dataFile;
+    AutosaveWorker autosave;
+    steady_clock::time_point lastSave;
     
-    Investment(double amt, int dur, const Date& dt, string t = "Investment") {
-        amount = amt;
-        duration = dur;
-        startDate = dt;
-        type = t;
-        monthly = 0;
-    }
+    // An autosave starts after this many edits, or once edits are this old
+    static const size_t AUTOSAVE_CHANGES = 20;
+    static constexpr int AUTOSAVE_SECONDS = 30;
 
-    void display() {
-        cout << setw(15) << type;
-        cout << setw(15) << amount << setw(15) << duration << setw(15) << startDate;
-        if (type == "SIP") {
-            cout << setw(20) << monthly << endl;
+    User(double initialBalance, const string& name = "default") : lastSave(steady_clock::now()) {
+        // The balance is derived from the ledger, starting from this opening amount
+        manager.balanceTimeline.opening = initialBalance;
+        username = name;
+        dataFile = username + "_finance_data.txt";
+        manager.categorizer.loadRules(username + "_rules.txt");
+        manager.fx.loadFromFile(username + "_fx.txt");
+        manager.budgets.loadFromFile(username + "_budgets.txt");
+        
+        double loadedBalance = initialBalance;
+        if (!manager.loadFromFile(dataFile, loadedBalance)) {
+            cout << "No existing data found. Starting with a fresh account." << endl;
+            cout << endl << endl;
+            system("pause");
         } else {
-            cout << endl;
+            cout << "Loaded existing data for " << username << "." << endl;
+            cout << endl << endl;
+            system("pause");
         }
     }
-
-    virtual double maturityAmount() {
-        return amount;
-    }
-};
-
-struct FD : Investment {
-    FD(double amt, int dur) : Investment(amt, dur, "FD") {}
-    
-    FD(double amt, int dur, const Date& dt) : Investment(amt, dur, dt, "FD") {}
-
-    double maturityAmount() {
-        return amount * pow((1 + 0.071), duration);
-    }
-};
-
-struct SIP : Investment {
-    SIP(double amt, int dur, double monAmt) : Investment(amt, dur, "SIP") {
-        monthly = monAmt;
-    }
     
-    SIP(double amt, int dur, double monAmt, const Date& dt) : Investment(amt, dur, dt, "SIP") {
-        monthly = monAmt;
-    }
-
-    double maturityAmount() {
-        double final = amount * pow(1 + (0.096/12), duration*12);
-        return final + (monthly * 12 * duration);
+    ~User() {
+        saveData();
     }
-};
-
-struct FinanceManager {
-    vector<Transaction*> transactions;
-    vector<Investment*> investments;
-    vector<UpcomingPayment> upcomingPayments;
-    vector<string> descriptionSuggestions;
-    int nextTransactionId;
-    
-    FinanceManager() : nextTransactionId(0) {}
     
-    ~FinanceManager() {
-        for (auto t : transactions) {
-            delete t;
-        }
-        for (auto i : investments) {
-            delete i;
-        }
-    }
-
-    void addTransaction(Transaction* t) {
-        transactions.push_back(t);
-        
-        bool descriptionExists = false;
-        for (const auto& desc : descriptionSuggestions) {
-            if (desc == t->description) {
-                descriptionExists = true;
-                break;
-            }
-        }
-        
-        if (!descriptionExists) {
-            descriptionSuggestions.push_back(t->description);
+    // Metrics are exported alongside every save so a scraper can pick them up
+    bool saveData() {
+        // Earlier autosaves must land first; the segments they wrote are reused
+        autosave.waitIdle();
+        if (autosave.takeFailure()) {
+            manager.forgetSnapshot();
         }
-        
-        nextTransactionId++;
+        bool saved = manager.saveToFile(dataFile);
+        manager.budgets.saveToFile(username + "_budgets.txt");
+        lastSave = steady_clock::now();
+        FINANCE_METRICS_EXPORT(username + "_metrics.prom");
+        return saved;
     }
 
-    void addInvestment(Investment* i) {
-        investments.push_back(i);
-    }
-    
-    vector<Transaction*> searchTransactionsByDescription(const string& description) {
-        vector<Transaction*> results;
-        for (auto t : transactions) {
-            if (t->description.find(description) != string::npos) {
-                results.push_back(t);
-            }
-        }
-        return results;
-    }
-    
-    vector<Transaction*> searchTransactionsByDate(const Date& date) {
-        vector<Transaction*> results;
-        for (auto t : transactions) {
-            Date tDate = t->date;
-            if (tDate.day == date.day && tDate.month == date.month && tDate.year == date.year) {
-                results.push_back(t);
-            }
-        }
-        return results;
-    }
-    
-    vector<Transaction*> searchTransactionsByCategory(CategoryType category) {
-        vector<Transaction*> results;
-        for (auto t : transactions) {
-            if (t->category == category) {
-                results.push_back(t);
-            }
-        }
-        return results;
-    }
-    
-    vector<Investment*> searchInvestmentsByAmountRange(double minAmount, double maxAmount) {
-        vector<Investment*> results;
-        for (auto i : investments) {
-            double amount = i->amount;
-            if (amount >= minAmount && amount <= maxAmount) {
-                results.push_back(i);
-            }
+    // Called each time the menu comes back. Serializing the changed segments
+    // happens here; the disk writes happen on the autosave thread.
+    void autosaveIfDue() {
+        if (autosave.takeFailure()) {
+            cout << "Autosave failed; all data will be rewritten on the next save." << endl;
+            manager.forgetSnapshot();
         }
-        return results;
-    }
-    
-    vector<Investment*> searchInvestmentsByType(const string& type) {
-        vector<Investment*> results;
-        for (auto i : investments) {
-            if (i->type == type) {
-                results.push_back(i);
-            }
-        }
-        return results;
-    }
-    
-    void displayTransactionSearchResults(const vector<Transaction*>& results) {
-        if (results.empty()) {
-            cout << "No matching transactions found." << endl;
+        size_t changes = manager.pendingChanges();
+        if (changes == 0) {
             return;
         }
-        
-        cout << "\n--SEARCH RESULTS--" << endl;
-        cout << setw(15) << "Type" << setw(12) << "Date" << setw(15) << "Amount" 
-             << setw(15) << "Category" << setw(20) << "Description" << endl;
-        cout << string(77, '-') << endl;
-        
-        for (auto t : results) {
-            t->display();
-        }
-    }
-    
-    void displayInvestmentSearchResults(const vector<Investment*>& results) {
-        if (results.empty()) {
-            cout << "No matching investments found." << endl;
+        if (changes < AUTOSAVE_CHANGES && steady_clock::now() - lastSave < seconds(AUTOSAVE_SECONDS)) {
             return;
         }
-        
-        cout << "\n--SEARCH RESULTS--" << endl;
-        cout << setw(15) << "Type" << setw(15) << "Amount" << setw(15) << "Duration" 
-             << setw(15) << "Start Date" << setw(20) << "Monthly amount" << endl;
-        cout << string(80, '-') << endl;
-        
-        for (auto i : results) {
-            i->display();
-        }
+        autosave.submit(manager.prepareSnapshot(dataFile, false));
+        lastSave = steady_clock::now();
     }
-    
-    bool deleteTransaction(int index) {
-        if (index < 0 || index >= transactions.size()) {
-            return false;
-        }
-        
-        delete transactions[index];
-        transactions.erase(transactions.begin() + index);
-        return true;
-    }
-    
-    bool deleteInvestment(int index) {
-        if (index < 0 || index >= investments.size()) {
-            return false;
-        }
-        
-        delete investments[index];
-        investments.erase(investments.begin() + index);
-        return true;
-    }
-    
-    bool updateTransaction(int index, Transaction* newTransaction) {
-        if (index < 0 || index >= transactions.size()) {
-            return false;
-        }
-        
-        delete transactions[index];
-        transactions[index] = newTransaction;
-        return true;
-    }
-    
-    bool updateInvestment(int index, Investment* newInvestment) {
-        if (index < 0 || index >= investments.size()) {
-            return false;
+
+    // Only asked when the FX file names currencies other than the base one
+    int chooseCurrency() {
+        vector<string> codes = currencies().snapshot();
+        if (codes.size() <= 1) {
+            return 0;
         }
         
-        delete investments[index];
-        investments[index] = newInvestment;
-        return true;
-    }
-    
-    void sortTransactionsByAmount(bool ascending = true) {
-        if (ascending) {
-            sort(transactions.begin(), transactions.end(), 
-                 [](Transaction* a, Transaction* b) { return a->amount < b->amount; });
-        } else {
-            sort(transactions.begin(), transactions.end(), 
-                 [](Transaction* a, Transaction* b) { return a->amount > b->amount; });
-        }
-    }
-    
-    void sortTransactionsByDate(bool ascending = true) {
-        if (ascending) {
-            sort(transactions.begin(), transactions.end(), 
-                 [](Transaction* a, Transaction* b) {
-                     Date dateA = a->date;
-                     Date dateB = b->date;
-                     if (dateA.year != dateB.year) return dateA.year < dateB.year;
-                     if (dateA.month != dateB.month) return dateA.month < dateB.month;
-                     return dateA.day < dateB.day;
-                 });
-        } else {
-            sort(transactions.begin(), transactions.end(), 
-                 [](Transaction* a, Transaction* b) {
-                     Date dateA = a->date;
-                     Date dateB = b->date;
-                     if (dateA.year != dateB.year) return dateA.year > dateB.year;
-                     if (dateA.month != dateB.month) return dateA.month > dateB.month;
-                     return dateA.day > dateB.day;
-                 });
-        }
-    }
-    
-    void sortTransactionsByCategory() {
-        sort(transactions.begin(), transactions.end(), 
-             [](Transaction* a, Transaction* b) {
-                 return static_cast<int>(a->category) < static_cast<int>(b->category);
-             });
-    }
-    
-    void sortInvestmentsByAmount(bool ascending = true) {
-        if (ascending) {
-            sort(investments.begin(), investments.end(), 
-                 [](Investment* a, Investment* b) { return a->amount < b->amount; });
-        } else {
-            sort(investments.begin(), investments.end(), 
-                 [](Investment* a, Investment* b) { return a->amount > b->amount; });
+        cout << "Select currency:" << endl;
+        for (size_t id = 0; id < codes.size(); id++) {
+            cout << id + 1 << ". " << (id == 0 && codes[0].empty() ? "Base currency" : codes[id]) << endl;
         }
-    }
-    
-    void sortInvestmentsByDuration(bool ascending = true) {
-        if (ascending) {
-            sort(investments.begin(), investments.end(), 
-                 [](Investment* a, Investment* b) { return a->duration < b->duration; });
-        } else {
-            sort(investments.begin(), investments.end(), 
-                 [](Investment* a, Investment* b) { return a->duration > b->duration; });
-        }
-    }
-
-    void addUpcomingPayment(const Date& date, const string& desc, double amount, bool isInvestment = false) {
-        upcomingPayments.push_back(UpcomingPayment(date, desc, amount, isInvestment));
-        
-        sortUpcomingPayments();
-    }
-    
-    void sortUpcomingPayments() {
-        sort(upcomingPayments.begin(), upcomingPayments.end(), 
-             [](const UpcomingPayment& a, const UpcomingPayment& b) {
-                 if (a.dueDate.year != b.dueDate.year) return a.dueDate.year < b.dueDate.year;
-                 if (a.dueDate.month != b.dueDate.month) return a.dueDate.month < b.dueDate.month;
-                 return a.dueDate.day < b.dueDate.day;
-             });
-    }
-    
-    void displayUpcomingPayments() {
-        cout << "\n--UPCOMING PAYMENTS--" << endl;
-        cout << setw(12) << "Date" << setw(20) << "Description" << setw(15) << "Amount" << setw(15) << "Type" << endl;
-        cout << string(62, '-') << endl;
+        cout << "Enter choice: ";
         
-        for (const auto& payment : upcomingPayments) {
-            cout << setw(12) << payment.dueDate 
-                 << setw(20) << payment.description 
-                 << setw(15) << fixed << setprecision(2) << payment.amount
-                 << setw(15) << (payment.isInvestment ? "Investment" : "Payment") << endl;
-        }
+        int choice;
+        cin >> choice;
+        return choice >= 1 && choice <= (int)codes.size() ? choice - 1 : 0;
     }
     
-    vector<string> getDescriptionSuggestions(const string& prefix) {
-        vector<string> suggestions;
-        for (const auto& desc : descriptionSuggestions) {
-            if (desc.find(prefix) == 0) {
-                suggestions.push_back(desc);
-            }
-        }
-        return suggestions;
-    }
-
-    void displayRecord(double balance) {
-        cout << "-----------------------------------" << endl;
-        cout << "|        Personal Finance        |" << endl;
-        cout << "-----------------------------------" << endl;
-
-        cout << "\n||--BALANCE--: " << fixed << setprecision(2) << balance << "||" << endl;
-
-        cout << "\n--SAVINGS--: " << endl;
-        cout << setw(15) << "Type" << setw(12) << "Date" << setw(15) << "Amount" << setw(15) << "Category" << setw(20) << "Description" << endl;
-        cout << string(77, '-') << endl;
-        for (auto t : transactions) {
-            t->display();
-        }
-
-        cout << "\n--INVESTMENTS--" << endl;
-        cout << setw(15) << "Type" << setw(15) << "Amount" << setw(15) << "Duration" << setw(15) << "Start Date" << setw(20) << "Monthly amount" << endl;
-        cout << string(80, '-') << endl;
-        for (auto i : investments) {
-            i->display();
-        }
+    // Today's value of an amount in the base currency
+    double inBase(double amount, int currency) const {
+        return amount * manager.fx.rate(currency, Date().dayNumber());
     }
     
-    void generateMonthlyReport(int month, int year) {
-        cout << "\n----- Monthly Report for " << month << "/" << year << " -----" << endl;
-        
-        double totalIncome = 0.0;
-        double totalExpense = 0.0;
-        double categoryExpenses[9] = {0}; // One for each category
-        
-        for (auto t : transactions) {
-            Date date = t->date;
-            if (date.month == month && date.year == year) {
-                if (t->type == "Income") {
-                    totalIncome += t->amount;
-                } else if (t->type == "Expenditure") {
-                    totalExpense += t->amount;
-                    categoryExpenses[t->category] += t->amount;
-                }
+    // Lists the registered categories as a numbered tree and lets the user pick
+    // one or create a new one under an existing parent.
+    CategoryType chooseCategory(bool includeIncome, bool includeExpenses) {
+        CategoryTree tree = categories().snapshot();
+        vector<int> options;
+        for (int id : tree.preorder()) {
+            bool income = tree.isWithin(id, INCOME);
+            if ((income && includeIncome) || (!income && includeExpenses)) {
+                options.push_back(id);
             }
         }
         
-        cout << "Total Income: " << fixed << setprecision(2) << totalIncome << endl;
-        cout << "Total Expenses: " << fixed << setprecision(2) << totalExpense << endl;
-        cout << "Net Savings: " << fixed << setprecision(2) << (totalIncome - totalExpense) << endl;
-        
-        cout << "\nExpense Breakdown by Category:" << endl;
-        for (int i = 0; i < 9; i++) {
-            if (categoryExpenses[i] > 0) {
-                cout << setw(20) << categoryToString((CategoryType)i) << ": " << fixed << setprecision(2) << categoryExpenses[i];
-                if (totalExpense > 0) {
-                    cout << " (" << fixed << setprecision(1) << (categoryExpenses[i] / totalExpense * 100) << "%)";
-                }
-                cout << endl;
-            }
+        cout << "Select category:" << endl;
+        for (size_t i = 0; i < options.size(); i++) {
+            cout << i + 1 << ". " << string(tree.depth(options[i]) * 2, ' ') << tree.labels[options[i]] << endl;
         }
-    }
-    
-    bool saveToFile(const string& filename) {
-        ofstream file(filename);
-        if (!file.is_open()) {
-            return false;
-        }
-        
-        file << transactions.size() << endl;
-        for (auto t : transactions) {
-            file << t->type[0] << " " << t->amount << " " << t->description << " " 
-                 << t->date << " " << categoryToString(t->category) << endl;
-        }
-        
-        file << investments.size() << endl;
-        for (auto i : investments) {
-            file << i->type << " " << i->amount << " " << i->duration << " " << i->startDate;
-            if (i->type == "SIP") {
-                file << " " << i->monthly;
-            }
-            file << endl;
-        }
-        
-        file.close();
-        return true;
-    }
-    
-    bool loadFromFile(const string& filename, double& balance) {
-        ifstream file(filename);
-        if (!file.is_open()) {
-            return false;
-        }
-        
-        for (auto t : transactions) delete t;
-        for (auto i : investments) delete i;
-        transactions.clear();
-        investments.clear();
-        
-        int transactionCount;
-        file >> transactionCount;
-        file.ignore();
+        cout << options.size() + 1 << ". New category..." << endl;
+        cout << "Enter choice: ";
         
-        for (int i = 0; i < transactionCount; i++) {
-            char type;
-            double amount;
-            string description, categoryStr;
-            int day, month, year;
-            
-            file >> type >> amount;
-            file.ignore();
-            
-            getline(file, description, ' ');
-            
-            file >> day >> month >> year;
-            Date date(day, month, year);
-            
-            file >> categoryStr;
-            
-            CategoryType category = stringToCategory(categoryStr);
-            
-            if (type == 'I') {
-                transactions.push_back(new Income(amount, description, date, category));
-                balance += amount;
-            } else if (type == 'E') {
-                transactions.push_back(new Expenditure(amount, description, date, category));
-                balance -= amount;
-            }
+        int choice;
+        cin >> choice;
+        if (choice >= 1 && choice <= (int)options.size()) {
+            return options[choice - 1];
         }
-        
-        int investmentCount;
-        file >> investmentCount;
-        file.ignore();
-        
-        for (int i = 0; i < investmentCount; i++) {
-            string type;
-            double amount;
-            int duration;
-            int day, month, year;
-            
-            file >> type >> amount >> duration;
-            file >> day >> month >> year;
-            Date startDate(day, month, year);
-            
-            if (type == "SIP") {
-                double monthly;
-                file >> monthly;
-                investments.push_back(new SIP(amount, duration, monthly, startDate));
-            } else if (type == "FD") {
-                investments.push_back(new FD(amount, duration, startDate));
-            }
-            
-            balance -= amount;
+        if (choice != (int)options.size() + 1) {
+            return includeExpenses ? (CategoryType)OTHER : (CategoryType)INCOME;
         }
         
-        file.close();
-        return true;
-    }
-};
-
-struct User {
-    FinanceManager manager;
-    double balance;
-    string username;
-    string dataFile;
-
-    User(double initialBalance, const string& name = "default") {
-        balance = initialBalance;
-        username = name;
-        dataFile = username + "_finance_data.txt";
+        string label;
+        int parentOption;
+        cout << "Enter new category name: ";
+        cin.ignore();
+        getline(cin, label);
+        cout << "Enter parent category number (0 for none): ";
+        cin >> parentOption;
         
-        if (!manager.loadFromFile(dataFile, balance)) {
-            cout << "No existing data found. Starting with a fresh account." << endl;
-            cout << endl << endl;
-            system("pause");
-        } else {
-            cout << "Loaded existing data for " << username << "." << endl;
-            cout << endl << endl;
-            system("pause");
+        int parent = (parentOption >= 1 && parentOption <= (int)options.size()) ? options[parentOption - 1] : -1;
+        if (parent == -1 && includeIncome && !includeExpenses) {
+            parent = INCOME;
         }
+        int id = categories().add(label, parent);
+        return id == -1 ? (CategoryType)OTHER : id;
     }
     
-    ~User() {
-        saveData();
-    }
-    
-    bool saveData() {
-        return manager.saveToFile(dataFile);
-    }
-
     void searchTransactions() {
         int searchOption;
         cout << "\n--SEARCH TRANSACTIONS--" << endl;
         cout << "1. Search by Description" << endl;
         cout << "2. Search by Date" << endl;
         cout << "3. Search by Category" << endl;
+        cout << "4. Combined Search" << endl;
+        cout << "5. Search by Description (typo tolerant)" << endl;
         cout << "Enter choice: ";
         cin >> searchOption;
         
@@ -671,6 +157,10 @@ struct User {
                 cin.ignore();
                 getline(cin, description);
                 results = manager.searchTransactionsByDescription(description);
+                if (results.empty()) {
+                    results = manager.searchTransactionsFuzzy(description);
+                    if (!results.empty()) cout << "No exact matches; showing close matches." << endl;
+                }
                 break;
             }
             case 2: {
@@ -682,34 +172,72 @@ struct User {
                 break;
             }
             case 3: {
-                int categoryOption;
-                cout << "Select category:" << endl;
-                cout << "1. Income" << endl;
-                cout << "2. Food" << endl;
-                cout << "3. Housing" << endl;
-                cout << "4. Transportation" << endl;
-                cout << "5. Entertainment" << endl;
-                cout << "6. Utilities" << endl;
-                cout << "7. Healthcare" << endl;
-                cout << "8. Education" << endl;
-                cout << "9. Other" << endl;
-                cout << "Enter choice: ";
-                cin >> categoryOption;
+                CategoryType category = chooseCategory(true, true);
+                results = manager.searchTransactionsByCategory(category);
+                break;
+            }
+            case 4: {
+                vector<TransactionFilter> criteria;
+                char answer;
                 
-                CategoryType category;
-                switch(categoryOption) {
-                    case 1: category = INCOME; break;
-                    case 2: category = FOOD; break;
-                    case 3: category = HOUSING; break;
-                    case 4: category = TRANSPORTATION; break;
-                    case 5: category = ENTERTAINMENT; break;
-                    case 6: category = UTILITIES; break;
-                    case 7: category = HEALTHCARE; break;
-                    case 8: category = EDUCATION; break;
-                    default: category = OTHER; break;
+                cout << "Filter by date range? (y/n): ";
+                cin >> answer;
+                if (answer == 'y' || answer == 'Y') {
+                    int d1, m1, y1, d2, m2, y2;
+                    cout << "Enter start date (day month year): ";
+                    cin >> d1 >> m1 >> y1;
+                    cout << "Enter end date (day month year): ";
+                    cin >> d2 >> m2 >> y2;
+                    criteria.push_back(TransactionFilter::dateRange(Date(d1, m1, y1), Date(d2, m2, y2)));
                 }
                 
-                results = manager.searchTransactionsByCategory(category);
+                cout << "Filter by amount range? (y/n): ";
+                cin >> answer;
+                if (answer == 'y' || answer == 'Y') {
+                    double minAmount, maxAmount;
+                    cout << "Enter minimum amount: ";
+                    cin >> minAmount;
+                    cout << "Enter maximum amount: ";
+                    cin >> maxAmount;
+                    criteria.push_back(TransactionFilter::amountRange(minAmount, maxAmount));
+                }
+                
+                cout << "Filter by category? (y/n): ";
+                cin >> answer;
+                if (answer == 'y' || answer == 'Y') {
+                    criteria.push_back(TransactionFilter::inCategories(vector<CategoryType>(1, chooseCategory(true, true))));
+                }
+                
+                cout << "Filter by type? (1. Income, 2. Expenditure, 0. Any): ";
+                int typeOption;
+                cin >> typeOption;
+                if (typeOption == 1) {
+                    criteria.push_back(TransactionFilter::typeIs("Income"));
+                } else if (typeOption == 2) {
+                    criteria.push_back(TransactionFilter::typeIs("Expenditure"));
+                }
+                
+                string text;
+                cout << "Description contains (leave empty for any): ";
+                cin.ignore();
+                getline(cin, text);
+                if (!text.empty()) {
+                    criteria.push_back(TransactionFilter::textContains(text));
+                }
+                
+                TransactionFilter filter = TransactionFilter::allOf(criteria);
+                results = manager.find(filter);
+                break;
+            }
+            case 5: {
+                string description;
+                int typos;
+                cout << "Enter description to search for: ";
+                cin.ignore();
+                getline(cin, description);
+                cout << "Typos to allow (-1 for automatic): ";
+                cin >> typos;
+                results = manager.searchTransactionsFuzzy(description, typos);
                 break;
             }
             default:
@@ -725,6 +253,8 @@ struct User {
         cout << "\n--SEARCH INVESTMENTS--" << endl;
         cout << "1. Search by Amount Range" << endl;
         cout << "2. Search by Type (FD/SIP)" << endl;
+        cout << "3. Maturity calendar" << endl;
+        cout << "4. Active on a date" << endl;
         cout << "Enter choice: ";
         cin >> searchOption;
         
@@ -748,10 +278,28 @@ struct User {
                 cout << "Enter choice: ";
                 cin >> typeOption;
                 
-                string type = (typeOption == 1) ? "FD" : "SIP";
+                string type = (typeOption == 1) ? FD::NAME : SIP::NAME;
                 results = manager.searchInvestmentsByType(type);
                 break;
             }
+            case 3: {
+                int day, month, year;
+                cout << "Enter start date (day month year): ";
+                cin >> day >> month >> year;
+                Date from(day, month, year);
+                cout << "Enter end date (day month year): ";
+                cin >> day >> month >> year;
+                Date to(day, month, year);
+                manager.displayMaturityCalendar(from, to);
+                return;
+            }
+            case 4: {
+                int day, month, year;
+                cout << "Enter date (day month year): ";
+                cin >> day >> month >> year;
+                results = manager.searchInvestmentsActiveOn(Date(day, month, year));
+                break;
+            }
             default:
                 cout << "Invalid option!" << endl;
                 return;
@@ -775,15 +323,7 @@ struct User {
                     return;
                 }
                 
-                cout << "\n--TRANSACTIONS--" << endl;
-                cout << setw(5) << "Index" << setw(15) << "Type" << setw(12) << "Date" << setw(15) << "Amount"
-                    << setw(15) << "Category" << setw(20) << "Description" << endl;
-                cout << string(82, '-') << endl;
-                
-                for (size_t i = 0; i < manager.transactions.size(); i++) {
-                    cout << setw(5) << i;
-                    manager.transactions[i]->display();
-                }
+                manager.showTransactions("\n--TRANSACTIONS--\n", manager.transactions, true);
                 
                 int index;
                 cout << "\nEnter index of transaction to delete: ";
@@ -802,15 +342,7 @@ struct User {
                     return;
                 }
                 
-                cout << "\n--INVESTMENTS--" << endl;
-                cout << setw(5) << "Index" << setw(15) << "Type" << setw(15) << "Amount" << setw(15) << "Duration"
-                    << setw(15) << "Start Date" << setw(20) << "Monthly amount" << endl;
-                cout << string(85, '-') << endl;
-                
-                for (size_t i = 0; i < manager.investments.size(); i++) {
-                    cout << setw(5) << i;
-                    manager.investments[i]->display();
-                }
+                manager.showInvestments("\n--INVESTMENTS--\n", manager.investments, true);
                 
                 int index;
                 cout << "\nEnter index of investment to delete: ";
@@ -844,15 +376,7 @@ struct User {
                     return;
                 }
                 
-                cout << "\n--TRANSACTIONS--" << endl;
-                cout << setw(5) << "Index" << setw(15) << "Type" << setw(12) << "Date" << setw(15) << "Amount"
-                    << setw(15) << "Category" << setw(20) << "Description" << endl;
-                cout << string(82, '-') << endl;
-                
-                for (size_t i = 0; i < manager.transactions.size(); i++) {
-                    cout << setw(5) << i;
-                    manager.transactions[i]->display();
-                }
+                manager.showTransactions("\n--TRANSACTIONS--\n", manager.transactions, true);
                 
                 int index;
                 cout << "\nEnter index of transaction to update: ";
@@ -863,10 +387,6 @@ struct User {
                     return;
                 }
                 
-                Transaction* oldTransaction = manager.transactions[index];
-                string oldType = oldTransaction->type;
-                double oldAmount = oldTransaction->amount;
-                
                 int typeOption;
                 cout << "\nSelect new transaction type:" << endl;
                 cout << "1. Income" << endl;
@@ -877,7 +397,6 @@ struct User {
                 double amount;
                 string description;
                 int day, month, year;
-                int categoryOption;
                 
                 cout << "Enter new amount: ";
                 cin >> amount;
@@ -887,38 +406,13 @@ struct User {
                 cout << "Enter new date (day month year): ";
                 cin >> day >> month >> year;
                 
-                cout << "Select new category:" << endl;
-                if (typeOption == 1) {
-                    cout << "1. Income" << endl;
-                    categoryOption = 1;
-                } else {
-                    cout << "1. Food" << endl;
-                    cout << "2. Housing" << endl;
-                    cout << "3. Transportation" << endl;
-                    cout << "4. Entertainment" << endl;
-                    cout << "5. Utilities" << endl;
-                    cout << "6. Healthcare" << endl;
-                    cout << "7. Education" << endl;
-                    cout << "8. Other" << endl;
-                    cout << "Enter choice: ";
-                    cin >> categoryOption;
-                }
-                
                 CategoryType category;
                 if (typeOption == 1) {
-                    category = INCOME;
+                    category = categories().subtree(INCOME).size() == 1 ? (CategoryType)INCOME : chooseCategory(true, false);
                 } else {
-                    switch(categoryOption) {
-                        case 1: category = FOOD; break;
-                        case 2: category = HOUSING; break;
-                        case 3: category = TRANSPORTATION; break;
-                        case 4: category = ENTERTAINMENT; break;
-                        case 5: category = UTILITIES; break;
-                        case 6: category = HEALTHCARE; break;
-                        case 7: category = EDUCATION; break;
-                        default: category = OTHER; break;
-                    }
+                    category = chooseCategory(false, true);
                 }
+                int currency = chooseCurrency();
                 
                 Date date(day, month, year);
                 Transaction* newTransaction;
@@ -928,18 +422,7 @@ struct User {
                 } else {
                     newTransaction = new Expenditure(amount, description, date, category);
                 }
-                
-                if (oldType == "Income") {
-                    balance -= oldAmount;
-                } else {
-                    balance += oldAmount;
-                }
-                
-                if (typeOption == 1) {
-                    balance += amount;
-                } else {
-                    balance -= amount;
-                }
+                newTransaction->currency = currency;
                 
                 if (manager.updateTransaction(index, newTransaction)) {
                     cout << "Transaction updated successfully!" << endl;
@@ -954,15 +437,7 @@ struct User {
                     return;
                 }
                 
-                cout << "\n--INVESTMENTS--" << endl;
-                cout << setw(5) << "Index" << setw(15) << "Type" << setw(15) << "Amount" << setw(15) << "Duration"
-                    << setw(15) << "Start Date" << setw(20) << "Monthly amount" << endl;
-                cout << string(85, '-') << endl;
-                
-                for (size_t i = 0; i < manager.investments.size(); i++) {
-                    cout << setw(5) << i;
-                    manager.investments[i]->display();
-                }
+                manager.showInvestments("\n--INVESTMENTS--\n", manager.investments, true);
                 
                 int index;
                 cout << "\nEnter index of investment to update: ";
@@ -973,9 +448,6 @@ struct User {
                     return;
                 }
                 
-                Investment* oldInvestment = manager.investments[index];
-                double oldAmount = oldInvestment->amount;
-                
                 int typeOption;
                 cout << "\nSelect new investment type:" << endl;
                 cout << "1. Fixed Deposit (FD)" << endl;
@@ -995,19 +467,16 @@ struct User {
                 cin >> day >> month >> year;
                 
                 Date startDate(day, month, year);
-                Investment* newInvestment;
+                InvestmentProduct product = FD();
                 
-                if (typeOption == 1) {
-                    newInvestment = new FD(amount, duration, startDate);
-                } else {
+                if (typeOption != 1) {
                     double monthly;
                     cout << "Enter new monthly investment amount: ";
                     cin >> monthly;
-                    newInvestment = new SIP(amount, duration, monthly, startDate);
+                    product = SIP{monthly};
                 }
-                
-                balance += oldAmount;
-                balance -= amount;
+                Investment newInvestment(amount, duration, startDate, product);
+                newInvestment.currency = chooseCurrency();
                 
                 if (manager.updateInvestment(index, newInvestment)) {
                     cout << "Investment updated successfully!" << endl;
@@ -1064,14 +533,7 @@ struct User {
                 }
                 
                 cout << "\nTransactions sorted successfully!" << endl;
-                cout << "\nSorted Transactions:" << endl;
-                cout << setw(15) << "Type" << setw(12) << "Date" << setw(15) << "Amount"
-                    << setw(15) << "Category" << setw(20) << "Description" << endl;
-                cout << string(77, '-') << endl;
-                
-                for (auto t : manager.transactions) {
-                    t->display();
-                }
+                manager.showTransactions("\nSorted Transactions:\n", manager.transactions);
                 break;
             }
             case 2: {
@@ -1103,14 +565,7 @@ struct User {
                 }
                 
                 cout << "\nInvestments sorted successfully!" << endl;
-                cout << "\nSorted Investments:" << endl;
-                cout << setw(15) << "Type" << setw(15) << "Amount" << setw(15) << "Duration"
-                    << setw(15) << "Start Date" << setw(20) << "Monthly amount" << endl;
-                cout << string(80, '-') << endl;
-                
-                for (auto i : manager.investments) {
-                    i->display();
-                }
+                manager.showInvestments("\nSorted Investments:\n", manager.investments);
                 break;
             }
             default:
@@ -1119,9 +574,513 @@ struct User {
         }
     }
 
+    void showSpendingTrends() {
+        const SpendingAnalytics& analytics = manager.analytics;
+        Date today;
+        
+        cout << "\n--SPENDING TRENDS--" << endl;
+        cout << setw(10) << "Window" << setw(15) << "Income" << setw(15) << "Expenses" << setw(15) << "Avg/Day" << endl;
+        cout << string(55, '-') << endl;
+        int windows[] = {30, 90, 365};
+        for (int days : windows) {
+            cout << setw(7) << days << " d"
+                 << setw(15) << fixed << setprecision(2) << analytics.rollingIncome(today, days)
+                 << setw(15) << analytics.rollingExpense(today, days)
+                 << setw(15) << analytics.rollingExpenseAverage(today, days) << endl;
+        }
+        
+        cout << "\nThis week's expenses: " << fixed << setprecision(2) << analytics.weeklyExpense(today) << endl;
+        
+        cout << "\n" << setw(10) << "Month" << setw(15) << "Income" << setw(15) << "Expenses" << setw(15) << "YoY Expense" << endl;
+        cout << string(55, '-') << endl;
+        int month = today.month, year = today.year;
+        for (int i = 0; i < 6; i++) {
+            cout << setw(10) << (to_string(month) + "/" + to_string(year))
+                 << setw(15) << analytics.monthlyIncome(month, year)
+                 << setw(15) << analytics.monthlyExpense(month, year)
+                 << setw(15) << showpos << analytics.expenseYearOverYear(month, year) << noshowpos << endl;
+            if (--month == 0) {
+                month = 12;
+                year--;
+            }
+        }
+    }
+    
+    void showExpenseRankings() {
+        int option;
+        cout << "\n--LARGEST EXPENSES & PERCENTILES--" << endl;
+        cout << "1. Largest expenses" << endl;
+        cout << "2. Smallest expenses" << endl;
+        cout << "3. Median and 95th percentile by category (this year)" << endl;
+        cout << "Enter choice: ";
+        cin >> option;
+        
+        switch (option) {
+            case 1:
+            case 2: {
+                size_t count;
+                char answer;
+                cout << "How many? ";
+                cin >> count;
+                vector<TransactionFilter> criteria;
+                cout << "Only this year? (y/n): ";
+                cin >> answer;
+                if (answer == 'y' || answer == 'Y') {
+                    Date today;
+                    criteria.push_back(TransactionFilter::dateRange(Date(1, 1, today.year), Date(31, 12, today.year)));
+                }
+                cout << "Only one category? (y/n): ";
+                cin >> answer;
+                if (answer == 'y' || answer == 'Y') {
+                    criteria.push_back(TransactionFilter::inCategories(vector<CategoryType>(1, chooseCategory(false, true))));
+                }
+                vector<Transaction*> results = manager.topExpenses(count, option == 1, TransactionFilter::allOf(criteria));
+                manager.showTransactions(option == 1 ? "\nLargest expenses:\n" : "\nSmallest expenses:\n", results);
+                break;
+            }
+            case 3: {
+                Date today;
+                Date from(1, 1, today.year), to(31, 12, today.year);
+                CategoryTree tree = categories().snapshot();
+                cout << setw(25) << "Category" << setw(15) << "Median" << setw(15) << "95th pct" << endl;
+                cout << string(55, '-') << endl;
+                cout << setw(25) << "All spending" << fixed << setprecision(2)
+                     << setw(15) << manager.estimateExpenseQuantile(0.5, from, to)
+                     << setw(15) << manager.estimateExpenseQuantile(0.95, from, to) << endl;
+                for (int id = 0; id < (int)tree.names.size(); id++) {
+                    if (id == INCOME || tree.parents[id] != -1) continue;
+                    double median = manager.estimateExpenseQuantile(0.5, from, to, id);
+                    if (median == 0) continue;
+                    cout << setw(25) << tree.names[id] << setw(15) << median
+                         << setw(15) << manager.estimateExpenseQuantile(0.95, from, to, id) << endl;
+                }
+                cout << "Percentiles are estimates from monthly summaries." << endl;
+                break;
+            }
+            default:
+                cout << "Invalid option!" << endl;
+        }
+    }
+    
+    // Asks before recording what looks like a row already on the ledger
+    bool confirmNotDuplicate(const Transaction& t) {
+        Transaction* existing = manager.looksLikeDuplicate(t);
+        if (!existing) return true;
+        cout << "This looks like a transaction already recorded:" << endl;
+        cout << Transaction::header();
+        existing->display();
+        char answer;
+        cout << "Record it anyway? (y/n): ";
+        cin >> answer;
+        if (answer == 'y' || answer == 'Y') return true;
+        cout << "Not recorded." << endl;
+        return false;
+    }
+    
+    void reconcileStatements() {
+        int option;
+        cout << "\n--RECONCILE--" << endl;
+        cout << "1. Reconcile bank statements" << endl;
+        cout << "2. Find duplicate transactions" << endl;
+        cout << "Enter choice: ";
+        cin >> option;
+        
+        if (option == 2) {
+            vector<pair<Transaction*, Transaction*>> pairs = manager.findDuplicateRows();
+            if (pairs.empty()) {
+                cout << "No likely duplicates found." << endl;
+                return;
+            }
+            cout << pairs.size() << " likely duplicate pair(s):" << endl;
+            cout << Transaction::header();
+            for (const auto& duplicate : pairs) {
+                duplicate.first->display();
+                duplicate.second->display();
+                cout << endl;
+            }
+            return;
+        }
+        if (option != 1) {
+            cout << "Invalid option!" << endl;
+            return;
+        }
+        
+        // One file per account, lines of "<day> <month> <year> <amount> <description>"
+        string line, filename;
+        int tolerance;
+        cout << "Enter statement file names, separated by spaces: ";
+        cin.ignore();
+        getline(cin, line);
+        cout << "Allow dates to differ by how many days? ";
+        cin >> tolerance;
+        
+        vector<Statement> statements;
+        istringstream names(line);
+        while (names >> filename) {
+            Statement statement;
+            if (statement.loadFromFile(filename)) {
+                statements.push_back(statement);
+            } else {
+                cout << "Could not read " << filename << endl;
+            }
+        }
+        if (statements.empty()) {
+            return;
+        }
+        
+        ReconciliationReport report = manager.reconcile(statements, max(tolerance, 0));
+        for (size_t s = 0; s < statements.size(); s++) {
+            const Reconciliation& result = report.statements[s];
+            const vector<StatementLine>& lines = statements[s].lines;
+            cout << "\n" << result.account << ": " << result.matched.size() << " of " << lines.size()
+                 << " lines matched, " << result.unmatchedLines.size() << " unmatched, "
+                 << result.duplicateLines.size() << " repeated" << endl;
+            for (size_t i : result.unmatchedLines) {
+                cout << "  not in ledger: " << lines[i].date << " " << fixed << setprecision(2) << lines[i].amount
+                     << " " << lines[i].description << endl;
+            }
+            for (size_t i : result.duplicateLines) {
+                cout << "  repeated line: " << lines[i].date << " " << fixed << setprecision(2) << lines[i].amount
+                     << " " << lines[i].description << endl;
+            }
+        }
+        if (!report.unmatchedRows.empty()) {
+            manager.showTransactions("\nLedger rows on no statement:\n", report.unmatchedRows);
+        }
+        
+        size_t unmatched = 0;
+        for (const auto& result : report.statements) unmatched += result.unmatchedLines.size();
+        if (unmatched == 0) {
+            return;
+        }
+        char answer;
+        cout << "\nAdd the " << unmatched << " unmatched statement line(s) to the ledger? (y/n): ";
+        cin >> answer;
+        if (answer == 'y' || answer == 'Y') {
+            size_t added = 0;
+            for (size_t s = 0; s < statements.size(); s++) {
+                added += manager.importStatementLines(statements[s], report.statements[s].unmatchedLines);
+            }
+            cout << added << " transaction(s) added." << endl;
+        }
+    }
+    
+    void showBalanceHistory() {
+        const BalanceTimeline& timeline = manager.balanceTimeline;
+        int option;
+        cout << "\n--BALANCE HISTORY--" << endl;
+        cout << "1. Balance on a date" << endl;
+        cout << "2. Lowest balance between two dates" << endl;
+        cout << "3. First overdraft after a date" << endl;
+        cout << "Enter choice: ";
+        cin >> option;
+        
+        int day, month, year;
+        switch (option) {
+            case 1: {
+                cout << "Enter date (day month year): ";
+                cin >> day >> month >> year;
+                Date date(day, month, year);
+                cout << "Balance at the end of " << date << ": " << fixed << setprecision(2) << timeline.balanceOn(date) << endl;
+                break;
+            }
+            case 2: {
+                cout << "Enter start date (day month year): ";
+                cin >> day >> month >> year;
+                Date from(day, month, year);
+                cout << "Enter end date (day month year): ";
+                cin >> day >> month >> year;
+                Date to(day, month, year);
+                cout << "Lowest balance from " << from << " to " << to << ": "
+                     << fixed << setprecision(2) << timeline.minBalance(from, to) << endl;
+                break;
+            }
+            case 3: {
+                cout << "Enter date (day month year): ";
+                cin >> day >> month >> year;
+                Date from(day, month, year);
+                Date when;
+                if (timeline.firstOverdraft(from, when)) {
+                    cout << "The balance first goes negative on " << when << " ("
+                         << fixed << setprecision(2) << timeline.balanceOn(when) << ")." << endl;
+                } else {
+                    cout << "The balance never goes negative after " << from << "." << endl;
+                }
+                break;
+            }
+            default:
+                cout << "Invalid option!" << endl;
+        }
+    }
+    
+    void showBudgets() {
+        BudgetEngine& engine = manager.budgets;
+        int option;
+        cout << "\n--BUDGETS--" << endl;
+        cout << "1. Show budgets" << endl;
+        cout << "2. Add budget" << endl;
+        cout << "3. Remove budget" << endl;
+        cout << "Enter choice: ";
+        cin >> option;
+        
+        switch (option) {
+            case 1: {
+                if (engine.budgets.empty()) {
+                    cout << "No budgets set." << endl;
+                    break;
+                }
+                Date today;
+                cout << setw(5) << "No." << setw(25) << "Category" << setw(10) << "Period"
+                     << setw(15) << "Spent" << setw(15) << "Limit" << setw(10) << "Used" << endl;
+                for (size_t i = 0; i < engine.budgets.size(); i++) {
+                    const Budget& budget = engine.budgets[i];
+                    double spent = engine.spent(i, today);
+                    cout << setw(5) << i << setw(25) << (budget.category == -1 ? string("All spending") : categoryToString(budget.category))
+                         << setw(10) << BudgetEngine::periodName(budget.period)
+                         << fixed << setprecision(2) << setw(15) << spent << setw(15) << budget.limit
+                         << setprecision(1) << setw(9) << (budget.limit > 0 ? spent / budget.limit * 100 : 0.0) << "%" << endl;
+                }
+                break;
+            }
+            case 2: {
+                Budget budget;
+                int periodOption, categoryOption;
+                cout << "1. Weekly" << endl;
+                cout << "2. Monthly" << endl;
+                cout << "3. Yearly" << endl;
+                cout << "Enter period: ";
+                cin >> periodOption;
+                budget.period = periodOption == 1 ? WEEKLY : (periodOption == 3 ? YEARLY : MONTHLY);
+                cout << "1. All spending" << endl;
+                cout << "2. One category" << endl;
+                cout << "Enter choice: ";
+                cin >> categoryOption;
+                budget.category = categoryOption == 2 ? chooseCategory(false, true) : -1;
+                cout << "Enter limit: ";
+                cin >> budget.limit;
+                if (budget.limit <= 0) {
+                    cout << "Invalid limit!" << endl;
+                    break;
+                }
+                
+                // Alert when spending reaches these percentages of the limit
+                string line;
+                cout << "Enter alert percentages (e.g. 80 100): ";
+                cin.ignore();
+                getline(cin, line);
+                istringstream in(line);
+                double percent;
+                while (in >> percent) {
+                    if (percent > 0) budget.thresholds.push_back(percent / 100);
+                }
+                if (budget.thresholds.empty()) {
+                    budget.thresholds.push_back(1.0);
+                }
+                
+                engine.add(budget);
+                manager.rebuildBudgetTotals();
+                cout << "Budget added." << endl;
+                break;
+            }
+            case 3: {
+                size_t index;
+                cout << "Enter budget number: ";
+                cin >> index;
+                if (index >= engine.budgets.size()) {
+                    cout << "Invalid budget number!" << endl;
+                    break;
+                }
+                engine.remove(index);
+                cout << "Budget removed." << endl;
+                break;
+            }
+            default:
+                cout << "Invalid option!" << endl;
+        }
+    }
+    
+    void showRecurring() {
+        manager.refreshPredictedPayments();
+        manager.displayUpcomingPayments();
+        
+        cout << "\n--RECURRING TRANSACTIONS--" << endl;
+        cout << setw(25) << "Description" << setw(15) << "Type" << setw(10) << "Every"
+             << setw(15) << "Amount" << setw(12) << "Last" << setw(12) << "Next" << endl;
+        cout << string(89, '-') << endl;
+        bool any = false;
+        for (const auto& pattern : manager.recurrences.patterns) {
+            if (!pattern.recurring) continue;
+            any = true;
+            const char* every = pattern.period == WEEKLY ? "Week" : (pattern.period == MONTHLY ? "Month" : "Year");
+            cout << setw(25) << manager.descriptionSuggestions[pattern.descriptionId]
+                 << setw(15) << (pattern.income ? "Income" : "Expenditure") << setw(10) << every
+                 << setw(15) << fixed << setprecision(2) << pattern.amounts[pattern.count - 1]
+                 << setw(12) << Date::fromDayNumber(pattern.days[pattern.count - 1])
+                 << setw(12) << RecurrenceDetector::nextDate(pattern) << endl;
+        }
+        if (!any) {
+            cout << "No recurring transactions found yet." << endl;
+        }
+    }
+    
+    // Devices share a folder, e.g. on a shared drive; each run of this swaps the changes made since the last one
+    void syncDevices() {
+        string folder;
+        cout << "Enter the shared sync folder: ";
+        cin.ignore();
+        getline(cin, folder);
+        if (folder.empty()) {
+            cout << "No folder given." << endl;
+            return;
+        }
+        bool first = !manager.sync.enabled();
+        size_t received, sent;
+        if (!manager.syncThroughFolder(folder, received, sent)) {
+            cout << "Could not complete syncing through " << folder << "; what was received is kept." << endl;
+            saveData();
+            return;
+        }
+        if (first) {
+            cout << "This device now syncs as replica " << manager.sync.replica << "." << endl;
+        }
+        cout << received << " change(s) received, " << sent << " change(s) left for other devices." << endl;
+        // What was merged must be on disk before other devices stop resending it
+        saveData();
+    }
+    
+    // The year's months are totalled in parallel; the statement is also kept as a file
+    void showAnnualStatement() {
+        int year;
+        cout << "Enter year: ";
+        cin >> year;
+        AnnualStatementGenerator generator(year);
+        AnnualStatement statement = generator.generate(manager, username);
+        OutputBuffer out;
+        out.newline();
+        statement.render(out, generator.deductible);
+        out.flush(cout);
+        if (!generator.result.failed.empty()) {
+            cout << "Could not write " << generator.statementFile(username) << "." << endl;
+        } else {
+            cout << "\nSaved to " << generator.statementFile(username) << "." << endl;
+        }
+    }
+    
+    // Arrow files open directly in pandas, polars or DuckDB; Parquet is smaller
+    void exportForAnalysis() {
+        int format;
+        cout << "\n--EXPORT FOR ANALYSIS--" << endl;
+        cout << "1. Arrow IPC (.arrow)" << endl;
+        cout << "2. Parquet (.parquet)" << endl;
+        cout << "Enter choice: ";
+        cin >> format;
+        if (format != 1 && format != 2) {
+            cout << "Invalid option!" << endl;
+            return;
+        }
+        string prefix = username + "_export";
+        string extension = format == 2 ? ".parquet" : ".arrow";
+        ColumnarExporter exporter(manager);
+        if (!exporter.exportLedger(prefix, format == 2)) {
+            cout << "Error writing the export files." << endl;
+            return;
+        }
+        cout << "Wrote " << manager.transactionCount() << " transaction(s) to " << prefix << "_transactions" << extension
+             << " and " << manager.investments.size() << " investment(s) to " << prefix << "_investments" << extension << "." << endl;
+    }
+    
+    // Archived rows stay in searches and reports but leave the Delete/Update lists
+    void archiveOldTransactions() {
+        char answer;
+        cout << "Archive transactions older than the last " << manager.hotMonths << " months?" << endl;
+        cout << "They can no longer be deleted or updated, and the undo history is cleared. (y/n): ";
+        cin >> answer;
+        if (answer != 'y' && answer != 'Y') {
+            cout << "Nothing archived." << endl;
+            return;
+        }
+        size_t archived = manager.freezeClosedMonths();
+        cout << "Archived " << archived << " transaction(s)." << endl;
+    }
+    
+    void showHistory() {
+        EditHistory& history = manager.history;
+        int option;
+        cout << "\n--UNDO / REDO--" << endl;
+        cout << "1. Undo last edit" << endl;
+        cout << "2. Redo" << endl;
+        cout << "3. Show edit history" << endl;
+        cout << "4. Transactions as of a version" << endl;
+        cout << "Enter choice: ";
+        cin >> option;
+        
+        switch (option) {
+            case 1:
+                cout << (manager.undo() ? "Undone." : "Nothing to undo.") << endl;
+                break;
+            case 2:
+                cout << (manager.redo() ? "Redone." : "Nothing to redo.") << endl;
+                break;
+            case 3:
+                manager.displayHistory();
+                break;
+            case 4: {
+                size_t version;
+                cout << "Enter version (" << history.oldestVersion() << "-" << history.newestVersion() << "): ";
+                cin >> version;
+                vector<Transaction*> rows;
+                if (!manager.transactionsAsOf(version, rows)) {
+                    cout << "That version is no longer kept." << endl;
+                    break;
+                }
+                manager.showTransactions("\nTransactions as of version " + to_string(version) + ":\n", rows);
+                break;
+            }
+            default:
+                cout << "Invalid option!" << endl;
+        }
+    }
+    
+    // Alerts raised by the changes just made
+    void showBudgetAlerts() {
+        BudgetEngine& engine = manager.budgets;
+        while (!engine.alerts.empty()) {
+            const BudgetAlert& alert = engine.alerts.front();
+            const Budget& budget = engine.budgets[alert.budget];
+            cout << "\n*** Budget alert: " << (budget.category == -1 ? string("all spending") : categoryToString(budget.category))
+                 << " has reached " << fixed << setprecision(0) << alert.threshold * 100 << "% of its "
+                 << BudgetEngine::periodName(budget.period) << " limit for the period starting "
+                 << BudgetEngine::periodStart(budget.period, alert.period) << " ("
+                 << setprecision(2) << alert.spent << " of " << alert.limit << ") ***" << endl;
+            engine.alerts.pop_front();
+        }
+    }
+    
+    // Flags raised by the changes just made
+    void showAnomalyFlags() {
+        AnomalyDetector& detector = manager.anomalies;
+        while (!detector.flags.empty()) {
+            const AnomalyFlag& flag = detector.flags.front();
+            cout << "\n*** Check this: " << flag.description << " on " << flag.date << " for "
+                 << fixed << setprecision(2) << flag.amount;
+            if (flag.kind == UNUSUAL_AMOUNT) {
+                cout << " is far above the usual " << flag.typical;
+            } else if (flag.kind == NEW_MERCHANT) {
+                cout << " is a first charge from this merchant, well above the usual "
+                     << flag.typical << " for " << categoryToString(flag.category);
+            } else {
+                cout << " makes " << (int)flag.count << (flag.wholeCategory ? " " + categoryToString(flag.category) : string(""))
+                     << " rows that day, against about " << setprecision(1) << flag.typical << " on a usual day";
+            }
+            cout << " ***" << endl;
+            detector.flags.pop_front();
+        }
+    }
+    
     void operations() {
         int choice = -1;
         while (choice != 0) {
+            autosaveIfDue();
             system("cls");
             cout << "\n--CHOOSE--" << endl;
             cout << "1. Record Income" << endl;
@@ -1138,6 +1097,17 @@ struct User {
             cout << "12. Delete Record" << endl;
             cout << "13. Update Record" << endl;
             cout << "14. Sort Records" << endl;
+            cout << "15. Spending Trends" << endl;
+            cout << "16. Balance History" << endl;
+            cout << "17. Budgets" << endl;
+            cout << "18. Upcoming & Recurring Payments" << endl;
+            cout << "19. Undo / Redo" << endl;
+            cout << "20. Largest Expenses & Percentiles" << endl;
+            cout << "21. Reconcile & Duplicates" << endl;
+            cout << "22. Sync With Other Devices" << endl;
+            cout << "23. Export for Analysis" << endl;
+            cout << "24. Annual Statement" << endl;
+            cout << "25. Archive Old Transactions" << endl;
             cout << "0. Exit" << endl << endl << endl;
             cout << "Enter choice : ";
             
@@ -1152,10 +1122,16 @@ struct User {
                     cout << "Enter description: ";
                     cin.ignore();
                     getline(cin, description);
+                    int currency = chooseCurrency();
                     
                     if (amount > 0) {
-                        manager.addTransaction(new Income(amount, description));
-                        balance += amount;
+                        Transaction* income = new Income(amount, description);
+                        income->currency = currency;
+                        if (!confirmNotDuplicate(*income)) {
+                            delete income;
+                            break;
+                        }
+                        manager.addTransaction(income);
                         cout << "Income recorded successfully!" << endl;
                     } else {
                         cout << "Invalid amount!" << endl;
@@ -1170,10 +1146,16 @@ struct User {
                     cout << "Enter description: ";
                     cin.ignore();
                     getline(cin, description);
+                    int currency = chooseCurrency();
                     
-                    if (amount > 0 && amount <= balance) {
-                        manager.addTransaction(new Expenditure(amount, description));
-                        balance -= amount;
+                    if (amount > 0 && inBase(amount, currency) <= manager.currentBalance()) {
+                        Transaction* expense = new Expenditure(amount, description);
+                        expense->currency = currency;
+                        if (!confirmNotDuplicate(*expense)) {
+                            delete expense;
+                            break;
+                        }
+                        manager.addTransaction(expense);
                         cout << "Expenditure recorded successfully!" << endl;
                     } else {
                         cout << "Invalid amount or insufficient balance!" << endl;
@@ -1184,10 +1166,10 @@ struct User {
                     makeInvestment();
                     break;
                 case 4:
-                    manager.displayRecord(balance);
+                    manager.displayRecord(manager.currentBalance());
                     break;
                 case 5:
-                    manager.displayRecord(balance);
+                    manager.displayRecord(manager.currentBalance());
                     break;
                 case 6: {
                     int month, year;
@@ -1271,12 +1253,58 @@ struct User {
                     sortRecords();
                     break;
                 }
+                case 15: {
+                    showSpendingTrends();
+                    break;
+                }
+                case 16: {
+                    showBalanceHistory();
+                    break;
+                }
+                case 17: {
+                    showBudgets();
+                    break;
+                }
+                case 18: {
+                    showRecurring();
+                    break;
+                }
+                case 19: {
+                    showHistory();
+                    break;
+                }
+                case 20: {
+                    showExpenseRankings();
+                    break;
+                }
+                case 21: {
+                    reconcileStatements();
+                    break;
+                }
+                case 22: {
+                    syncDevices();
+                    break;
+                }
+                case 23: {
+                    exportForAnalysis();
+                    break;
+                }
+                case 24: {
+                    showAnnualStatement();
+                    break;
+                }
+                case 25: {
+                    archiveOldTransactions();
+                    break;
+                }
                 case 0:
                     cout << "Exiting..." << endl;
                     break;
                 default:
                     cout << "Invalid choice!" << endl;
             }
+            showBudgetAlerts();
+            showAnomalyFlags();
             
             if (choice != 0) {
                 if(choice != 9){
@@ -1306,18 +1334,21 @@ struct User {
         cin >> amount;
         cout << "Enter duration (in years): ";
         cin >> duration;
+        int currency = chooseCurrency();
         
-        if (amount <= balance) {
+        if (inBase(amount, currency) <= manager.currentBalance()) {
             if (choice == 1) {
-                manager.addInvestment(new FD(amount, duration));
-                balance -= amount;
+                Investment fd(amount, duration, FD());
+                fd.currency = currency;
+                manager.addInvestment(fd);
                 cout << "FD created successfully!" << endl;
             } else if (choice == 2) {
                 double monthly;
                 cout << "Enter monthly investment amount: ";
                 cin >> monthly;
-                manager.addInvestment(new SIP(amount, duration, monthly));
-                balance -= amount;
+                Investment sip(amount, duration, SIP{monthly});
+                sip.currency = currency;
+                manager.addInvestment(sip);
                 cout << "SIP created successfully!" << endl;
             } else {
                 cout << "Invalid choice!" << endl;
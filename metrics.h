@@ -0,0 +1,274 @@
+#ifndef FINANCE_METRICS_H
+#define FINANCE_METRICS_H
+
+// Hot-path instrumentation: latency histograms, counters and gauges, exported
+// as Prometheus text. Build with -DFINANCE_DISABLE_METRICS and every
+// FINANCE_* macro below compiles to nothing.
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef FINANCE_DISABLE_METRICS
+
+// Latency samples from one thread. Only the owning thread writes, so a relaxed
+// load and store is enough and recording never takes a lock; exporters read
+// the atomics from other threads.
+struct HistogramShard {
+    // Four sub-buckets per power of two of nanoseconds, roughly 19% wide
+    static const int BUCKETS = 256;
+
+    std::atomic<uint64_t> counts[BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+
+    HistogramShard() : count(0), sum(0) {
+        for (auto& c : counts) c.store(0, std::memory_order_relaxed);
+    }
+
+    static int bucketFor(uint64_t ns) {
+        if (ns < 4) return (int)ns;
+        int msb = 63 - __builtin_clzll(ns);
+        int sub = (int)((ns >> (msb - 2)) & 3);
+        int bucket = msb * 4 + sub;
+        return bucket < BUCKETS ? bucket : BUCKETS - 1;
+    }
+
+    // Upper edge of a bucket, used when estimating quantiles
+    static double bucketLimit(int bucket) {
+        if (bucket < 4) return bucket;
+        int msb = bucket / 4;
+        int sub = bucket % 4;
+        return std::ldexp(1.0, msb) * (1.0 + (sub + 1) / 4.0);
+    }
+
+    void add(uint64_t ns) {
+        std::atomic<uint64_t>& c = counts[bucketFor(ns)];
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum.store(sum.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    }
+};
+
+struct Histogram {
+    std::string name;
+    std::string help;
+    size_t id;
+    std::mutex shardLock;
+    std::deque<HistogramShard> shards;
+
+    HistogramShard& localShard() {
+        thread_local std::vector<HistogramShard*> cache;
+        if (id >= cache.size()) cache.resize(id + 1, nullptr);
+        if (!cache[id]) {
+            std::lock_guard<std::mutex> guard(shardLock);
+            shards.emplace_back();
+            cache[id] = &shards.back();
+        }
+        return *cache[id];
+    }
+
+    void record(uint64_t ns) {
+        localShard().add(ns);
+    }
+
+    void merge(std::vector<uint64_t>& counts, uint64_t& count, uint64_t& sum) {
+        counts.assign(HistogramShard::BUCKETS, 0);
+        count = sum = 0;
+        std::lock_guard<std::mutex> guard(shardLock);
+        for (auto& shard : shards) {
+            for (int b = 0; b < HistogramShard::BUCKETS; b++) {
+                counts[b] += shard.counts[b].load(std::memory_order_relaxed);
+            }
+            count += shard.count.load(std::memory_order_relaxed);
+            sum += shard.sum.load(std::memory_order_relaxed);
+        }
+    }
+
+    static double quantile(const std::vector<uint64_t>& counts, uint64_t count, double q) {
+        if (count == 0) return 0.0;
+        uint64_t rank = (uint64_t)std::ceil(q * count);
+        uint64_t seen = 0;
+        for (int b = 0; b < HistogramShard::BUCKETS; b++) {
+            seen += counts[b];
+            if (seen >= rank && counts[b] > 0) return HistogramShard::bucketLimit(b);
+        }
+        return HistogramShard::bucketLimit(HistogramShard::BUCKETS - 1);
+    }
+};
+
+struct Counter {
+    std::string name;
+    std::string help;
+    std::atomic<uint64_t> value;
+
+    Counter() : value(0) {}
+
+    void add(uint64_t n) {
+        value.fetch_add(n, std::memory_order_relaxed);
+    }
+};
+
+struct Gauge {
+    std::string name;
+    std::string help;
+    std::atomic<int64_t> value;
+
+    Gauge() : value(0) {}
+
+    void set(int64_t v) {
+        value.store(v, std::memory_order_relaxed);
+    }
+};
+
+// Metrics are created on first use and live for the rest of the process.
+// Lookups by name take a lock, so call sites cache the returned reference.
+struct MetricsRegistry {
+    std::mutex lock;
+    std::deque<Histogram> histograms;
+    std::deque<Counter> counters;
+    std::deque<Gauge> gauges;
+    std::map<std::string, void*> byName;
+
+    Histogram& histogram(const std::string& name, const std::string& help = "") {
+        std::lock_guard<std::mutex> guard(lock);
+        void*& slot = byName["h:" + name];
+        if (!slot) {
+            histograms.emplace_back();
+            histograms.back().name = name;
+            histograms.back().help = help;
+            histograms.back().id = histograms.size() - 1;
+            slot = &histograms.back();
+        }
+        return *static_cast<Histogram*>(slot);
+    }
+
+    Counter& counter(const std::string& name, const std::string& help = "") {
+        std::lock_guard<std::mutex> guard(lock);
+        void*& slot = byName["c:" + name];
+        if (!slot) {
+            counters.emplace_back();
+            counters.back().name = name;
+            counters.back().help = help;
+            slot = &counters.back();
+        }
+        return *static_cast<Counter*>(slot);
+    }
+
+    Gauge& gauge(const std::string& name, const std::string& help = "") {
+        std::lock_guard<std::mutex> guard(lock);
+        void*& slot = byName["g:" + name];
+        if (!slot) {
+            gauges.emplace_back();
+            gauges.back().name = name;
+            gauges.back().help = help;
+            slot = &gauges.back();
+        }
+        return *static_cast<Gauge*>(slot);
+    }
+
+    // Prometheus text exposition format; latencies are summaries in seconds
+    void writePrometheus(std::ostream& out) {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto& h : histograms) {
+            std::vector<uint64_t> counts;
+            uint64_t count, sum;
+            h.merge(counts, count, sum);
+            std::string name = "finance_" + h.name + "_seconds";
+            if (!h.help.empty()) out << "# HELP " << name << " " << h.help << "\n";
+            out << "# TYPE " << name << " summary\n";
+            const double quantiles[] = {0.5, 0.99, 0.999};
+            for (double q : quantiles) {
+                out << name << "{quantile=\"" << q << "\"} " << Histogram::quantile(counts, count, q) / 1e9 << "\n";
+            }
+            out << name << "_sum " << sum / 1e9 << "\n";
+            out << name << "_count " << count << "\n";
+        }
+        for (auto& c : counters) {
+            std::string name = "finance_" + c.name + "_total";
+            if (!c.help.empty()) out << "# HELP " << name << " " << c.help << "\n";
+            out << "# TYPE " << name << " counter\n";
+            out << name << " " << c.value.load(std::memory_order_relaxed) << "\n";
+        }
+        for (auto& g : gauges) {
+            std::string name = "finance_" + g.name;
+            if (!g.help.empty()) out << "# HELP " << name << " " << g.help << "\n";
+            out << "# TYPE " << name << " gauge\n";
+            out << name << " " << g.value.load(std::memory_order_relaxed) << "\n";
+        }
+    }
+
+    // Written to a temporary file and renamed, so a scraper never sees half a file
+    bool writeToFile(const std::string& filename) {
+        std::string temp = filename + ".tmp";
+        {
+            std::ofstream file(temp);
+            if (!file.is_open()) return false;
+            writePrometheus(file);
+            if (!file.good()) return false;
+        }
+        std::remove(filename.c_str());
+        return std::rename(temp.c_str(), filename.c_str()) == 0;
+    }
+};
+
+inline MetricsRegistry& metrics() {
+    // Never destroyed, so timers running during static destruction stay safe
+    static MetricsRegistry* registry = new MetricsRegistry();
+    return *registry;
+}
+
+struct ScopedTimer {
+    Histogram& histogram;
+    std::chrono::steady_clock::time_point start;
+
+    explicit ScopedTimer(Histogram& h) : histogram(h), start(std::chrono::steady_clock::now()) {}
+
+    ~ScopedTimer() {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        histogram.record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+};
+
+#define FINANCE_METRIC_JOIN2(a, b) a##b
+#define FINANCE_METRIC_JOIN(a, b) FINANCE_METRIC_JOIN2(a, b)
+
+// Times the rest of the enclosing scope
+#define FINANCE_TIME_SCOPE(name) \
+    static Histogram& FINANCE_METRIC_JOIN(financeHistogram, __LINE__) = metrics().histogram(name); \
+    ScopedTimer FINANCE_METRIC_JOIN(financeTimer, __LINE__)(FINANCE_METRIC_JOIN(financeHistogram, __LINE__))
+
+#define FINANCE_COUNT(name, n) \
+    do { \
+        static Counter& financeCounter = metrics().counter(name); \
+        financeCounter.add(n); \
+    } while (0)
+
+#define FINANCE_GAUGE_SET(name, v) \
+    do { \
+        static Gauge& financeGauge = metrics().gauge(name); \
+        financeGauge.set((int64_t)(v)); \
+    } while (0)
+
+#define FINANCE_METRICS_EXPORT(filename) metrics().writeToFile(filename)
+
+#else
+
+#define FINANCE_TIME_SCOPE(name) do {} while (0)
+#define FINANCE_COUNT(name, n) do {} while (0)
+#define FINANCE_GAUGE_SET(name, v) do {} while (0)
+#define FINANCE_METRICS_EXPORT(filename) do {} while (0)
+
+#endif
+
+#endif